@@ -0,0 +1,115 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_STATE_SNAPSHOT_H__
+#define __WAYHOUSE_STATE_SNAPSHOT_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * WayHouse publishes a snapshot of its state in shared memory.
+ * Readers send a "snapshot" request on the IPC socket (WAYHOUSE_IPC):
+ * the reply comes with a read-only file descriptor, passed as SCM_RIGHTS
+ * ancillary data. They can mmap() it read-only once and then use
+ * wh_state_snapshot_read() at any rate, without any syscall or round
+ * trip to the compositor.
+ */
+
+#define WH_STATE_SNAPSHOT_MAGIC 0x53485757 /* "WWHS" */
+#define WH_STATE_SNAPSHOT_VERSION 1
+
+#define WH_STATE_SNAPSHOT_NAME_SIZE 64
+#define WH_STATE_SNAPSHOT_TITLE_SIZE 256
+#define WH_STATE_SNAPSHOT_MAX_OUTPUTS 16
+#define WH_STATE_SNAPSHOT_MAX_WORKSPACES 64
+#define WH_STATE_SNAPSHOT_NONE ((uint32_t) -1)
+
+typedef enum {
+    WH_STATE_SNAPSHOT_WORKSPACE_FOCUSED = (1 << 0),
+    WH_STATE_SNAPSHOT_WORKSPACE_VISIBLE = (1 << 1),
+} WhStateSnapshotWorkspaceFlags;
+
+typedef struct {
+    char name[WH_STATE_SNAPSHOT_NAME_SIZE];
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+    uint32_t workspace;
+    uint32_t padding;
+} WhStateSnapshotOutput;
+
+typedef struct {
+    char name[WH_STATE_SNAPSHOT_NAME_SIZE];
+    uint64_t number;
+    uint32_t output;
+    uint32_t flags;
+    uint32_t windows;
+    uint32_t padding;
+} WhStateSnapshotWorkspace;
+
+typedef struct {
+    uint64_t serial;
+    uint32_t n_outputs;
+    uint32_t n_workspaces;
+    struct {
+        char app_id[WH_STATE_SNAPSHOT_NAME_SIZE];
+        char title[WH_STATE_SNAPSHOT_TITLE_SIZE];
+        uint32_t workspace;
+        uint32_t padding;
+    } focus;
+    WhStateSnapshotOutput outputs[WH_STATE_SNAPSHOT_MAX_OUTPUTS];
+    WhStateSnapshotWorkspace workspaces[WH_STATE_SNAPSHOT_MAX_WORKSPACES];
+} WhStateSnapshotData;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    /* Sequence lock: odd while the compositor is writing */
+    uint32_t sequence;
+    WhStateSnapshotData data;
+} WhStateSnapshot;
+
+static inline int
+wh_state_snapshot_check(const WhStateSnapshot *snapshot)
+{
+    return ( snapshot->magic == WH_STATE_SNAPSHOT_MAGIC ) && ( snapshot->version == WH_STATE_SNAPSHOT_VERSION ) && ( snapshot->size == sizeof(WhStateSnapshot) );
+}
+
+static inline void
+wh_state_snapshot_read(const WhStateSnapshot *snapshot, WhStateSnapshotData *data)
+{
+    uint32_t begin, end;
+
+    do
+    {
+        while ( ( begin = __atomic_load_n(&snapshot->sequence, __ATOMIC_ACQUIRE) ) & 1 )
+            ;
+        memcpy(data, &snapshot->data, sizeof(WhStateSnapshotData));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&snapshot->sequence, __ATOMIC_RELAXED);
+    } while ( begin != end );
+}
+
+#endif /* __WAYHOUSE_STATE_SNAPSHOT_H__ */
@@ -0,0 +1,482 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "types.h"
+#include "assigns.h"
+
+/*
+ * Patterns are literal strings, globs (with * and ?) or,
+ * with a "re:" prefix, regular expressions
+ */
+#define WH_ASSIGN_REGEX_PREFIX "re:"
+
+typedef struct {
+    gchar *name;
+    guint index;
+    gchar *app_id_literal;
+    GRegex *app_id;
+    GRegex *title;
+    WhWorkspaceConfig workspace;
+} WhAssign;
+
+/*
+ * All the patterns of a class of rules in a single regex,
+ * each alternative followed by an empty marker group.
+ * Patterns referring to their groups by number cannot be moved
+ * in there, their groups would be renumbered: they stay on their own.
+ */
+typedef struct {
+    GRegex *regex;
+    GPtrArray *rules;
+    GArray *markers;
+    GPtrArray *standalone;
+} WhAssignMatcher;
+
+struct _WhAssigns {
+    GQueue rules;
+    GHashTable *rules_by_name;
+    gboolean dirty;
+    WhAssignProperty references;
+    GHashTable *literals;
+    WhAssignMatcher app_id;
+    WhAssignMatcher title;
+    GPtrArray *both;
+};
+
+static gchar *
+_wh_assign_pattern_to_regex(const gchar *pattern)
+{
+    if ( g_str_has_prefix(pattern, WH_ASSIGN_REGEX_PREFIX) )
+        return g_strdup(pattern + strlen(WH_ASSIGN_REGEX_PREFIX));
+
+    GString *regex;
+    const gchar *s, *c;
+
+    regex = g_string_new("");
+    for ( s = pattern ; ( c = strpbrk(s, "*?") ) != NULL ; s = c + 1 )
+    {
+        gchar *escaped;
+        escaped = g_regex_escape_string(s, c - s);
+        g_string_append(regex, escaped);
+        g_free(escaped);
+        g_string_append(regex, ( *c == '*' ) ? ".*" : ".");
+    }
+    gchar *escaped;
+    escaped = g_regex_escape_string(s, -1);
+    g_string_append(regex, escaped);
+    g_free(escaped);
+
+    return g_string_free(regex, FALSE);
+}
+
+static gboolean
+_wh_assign_pattern_is_literal(const gchar *pattern)
+{
+    return ( ! g_str_has_prefix(pattern, WH_ASSIGN_REGEX_PREFIX) ) && ( strpbrk(pattern, "*?") == NULL );
+}
+
+static GRegex *
+_wh_assign_pattern_compile(const gchar *name, const gchar *pattern)
+{
+    GRegex *regex;
+    gchar *source, *anchored;
+    GError *error = NULL;
+
+    source = _wh_assign_pattern_to_regex(pattern);
+    anchored = g_strdup_printf("^(?:%s)$", source);
+    regex = g_regex_new(anchored, 0, 0, &error);
+    if ( regex == NULL )
+    {
+        g_warning("Invalid pattern '%s' in assign %s: %s", pattern, name, error->message);
+        g_error_free(error);
+    }
+    g_free(anchored);
+    g_free(source);
+
+    return regex;
+}
+
+/* Backreferences (\1, \g1, \g{-1}) and subroutine calls ((?1), (?-1), (?R)) */
+static gboolean
+_wh_assign_regex_has_numbered_references(const gchar *pattern)
+{
+    const gchar *c;
+
+    for ( c = pattern ; *c != '\0' ; ++c )
+    {
+        if ( c[0] == '\\' )
+        {
+            if ( c[1] == '\0' )
+                break;
+            if ( g_ascii_isdigit(c[1]) && ( c[1] != '0' ) )
+                return TRUE;
+            if ( ( c[1] == 'g' ) && ( g_ascii_isdigit(c[2]) || ( c[2] == '-' ) || ( c[2] == '+' ) || ( ( c[2] == '{' ) && ( g_ascii_isdigit(c[3]) || ( c[3] == '-' ) || ( c[3] == '+' ) ) ) ) )
+                return TRUE;
+            ++c;
+        }
+        else if ( ( c[0] == '(' ) && ( c[1] == '?' ) && ( g_ascii_isdigit(c[2]) || ( c[2] == '-' ) || ( c[2] == '+' ) || ( c[2] == 'R' ) ) )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+_wh_assign_free(gpointer data)
+{
+    WhAssign *self = data;
+
+    if ( self->title != NULL )
+        g_regex_unref(self->title);
+    if ( self->app_id != NULL )
+        g_regex_unref(self->app_id);
+    g_free(self->app_id_literal);
+    g_free(self->workspace.name);
+    g_free(self->name);
+
+    g_slice_free(WhAssign, self);
+}
+
+static gboolean
+_wh_assign_match(WhAssign *self, const gchar *app_id, const gchar *title)
+{
+    if ( self->app_id_literal != NULL )
+    {
+        if ( g_strcmp0(self->app_id_literal, app_id) != 0 )
+            return FALSE;
+    }
+    else if ( self->app_id != NULL )
+    {
+        if ( ( app_id == NULL ) || ( ! g_regex_match(self->app_id, app_id, 0, NULL) ) )
+            return FALSE;
+    }
+
+    if ( self->title != NULL )
+    {
+        if ( ( title == NULL ) || ( ! g_regex_match(self->title, title, 0, NULL) ) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+_wh_assign_matcher_init(WhAssignMatcher *self)
+{
+    self->rules = g_ptr_array_new();
+    self->markers = g_array_new(FALSE, FALSE, sizeof(gint));
+    self->standalone = g_ptr_array_new();
+}
+
+static void
+_wh_assign_matcher_clear(WhAssignMatcher *self)
+{
+    if ( self->regex != NULL )
+        g_regex_unref(self->regex);
+    self->regex = NULL;
+    g_ptr_array_set_size(self->rules, 0);
+    g_array_set_size(self->markers, 0);
+    g_ptr_array_set_size(self->standalone, 0);
+}
+
+static void
+_wh_assign_matcher_uninit(WhAssignMatcher *self)
+{
+    _wh_assign_matcher_clear(self);
+    g_ptr_array_unref(self->standalone);
+    g_array_unref(self->markers);
+    g_ptr_array_unref(self->rules);
+}
+
+static void
+_wh_assign_matcher_compile(WhAssignMatcher *self, GString *pattern)
+{
+    GError *error = NULL;
+
+    if ( self->rules->len == 0 )
+        return;
+
+    g_string_prepend(pattern, "^(?:");
+    g_string_append(pattern, ")$");
+    self->regex = g_regex_new(pattern->str, G_REGEX_OPTIMIZE, 0, &error);
+    if ( self->regex == NULL )
+    {
+        /* e.g. the same named group in two rules, we check them one by one */
+        g_debug("Could not combine assign patterns: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+static void
+_wh_assign_matcher_add(WhAssignMatcher *self, GString *pattern, WhAssign *rule, GRegex *regex)
+{
+    gint marker;
+
+    if ( _wh_assign_regex_has_numbered_references(g_regex_get_pattern(regex)) )
+    {
+        g_ptr_array_add(self->standalone, rule);
+        return;
+    }
+
+    if ( self->rules->len > 0 )
+        g_string_append_c(pattern, '|');
+
+    /* The individual regex is already anchored */
+    g_string_append_printf(pattern, "(?:%s)()", g_regex_get_pattern(regex));
+
+    marker = ( ( self->markers->len > 0 ) ? g_array_index(self->markers, gint, self->markers->len - 1) : 0 ) + g_regex_get_capture_count(regex) + 1;
+    g_ptr_array_add(self->rules, rule);
+    g_array_append_val(self->markers, marker);
+}
+
+/* Returns the first rule matching before best, or best */
+static WhAssign *
+_wh_assign_matcher_match_each(GPtrArray *rules, const gchar *string, WhAssign *best)
+{
+    guint i;
+
+    for ( i = 0 ; i < rules->len ; ++i )
+    {
+        WhAssign *rule = g_ptr_array_index(rules, i);
+        if ( ( best != NULL ) && ( rule->index > best->index ) )
+            break;
+        /* Rules in a matcher only have the one property, so we can pass it twice */
+        if ( _wh_assign_match(rule, string, string) )
+            return rule;
+    }
+
+    return best;
+}
+
+static WhAssign *
+_wh_assign_matcher_match(WhAssignMatcher *self, const gchar *string)
+{
+    WhAssign *rule = NULL;
+
+    if ( self->regex == NULL )
+        rule = _wh_assign_matcher_match_each(self->rules, string, NULL);
+    else
+    {
+        GMatchInfo *info;
+        guint i;
+
+        if ( g_regex_match(self->regex, string, 0, &info) )
+        {
+            for ( i = 0 ; ( rule == NULL ) && ( i < self->rules->len ) ; ++i )
+            {
+                gint start, end;
+                if ( g_match_info_fetch_pos(info, g_array_index(self->markers, gint, i), &start, &end) && ( start >= 0 ) )
+                    rule = g_ptr_array_index(self->rules, i);
+            }
+        }
+        g_match_info_free(info);
+    }
+
+    return _wh_assign_matcher_match_each(self->standalone, string, rule);
+}
+
+static void
+_wh_assigns_compile(WhAssigns *self)
+{
+    GString *app_id, *title;
+    GList *link;
+    guint index = 0;
+
+    g_hash_table_remove_all(self->literals);
+    _wh_assign_matcher_clear(&self->app_id);
+    _wh_assign_matcher_clear(&self->title);
+    g_ptr_array_set_size(self->both, 0);
+    self->references = 0;
+
+    app_id = g_string_new("");
+    title = g_string_new("");
+
+    for ( link = self->rules.head ; link != NULL ; link = g_list_next(link) )
+    {
+        WhAssign *rule = link->data;
+        gboolean has_app_id = ( rule->app_id_literal != NULL ) || ( rule->app_id != NULL );
+
+        rule->index = index++;
+
+        if ( has_app_id )
+            self->references |= WH_ASSIGN_PROPERTY_APP_ID;
+        if ( rule->title != NULL )
+            self->references |= WH_ASSIGN_PROPERTY_TITLE;
+
+        if ( has_app_id && ( rule->title != NULL ) )
+            g_ptr_array_add(self->both, rule);
+        else if ( rule->title != NULL )
+            _wh_assign_matcher_add(&self->title, title, rule, rule->title);
+        else if ( rule->app_id != NULL )
+            _wh_assign_matcher_add(&self->app_id, app_id, rule, rule->app_id);
+        else if ( ! g_hash_table_contains(self->literals, rule->app_id_literal) )
+            g_hash_table_insert(self->literals, rule->app_id_literal, rule);
+    }
+
+    _wh_assign_matcher_compile(&self->app_id, app_id);
+    _wh_assign_matcher_compile(&self->title, title);
+
+    g_string_free(title, TRUE);
+    g_string_free(app_id, TRUE);
+
+    self->dirty = FALSE;
+}
+
+WhAssigns *
+wh_assigns_new(void)
+{
+    WhAssigns *self;
+
+    self = g_new0(WhAssigns, 1);
+
+    g_queue_init(&self->rules);
+    self->rules_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    self->literals = g_hash_table_new(g_str_hash, g_str_equal);
+    _wh_assign_matcher_init(&self->app_id);
+    _wh_assign_matcher_init(&self->title);
+    self->both = g_ptr_array_new();
+
+    return self;
+}
+
+void
+wh_assigns_free(WhAssigns *self)
+{
+    if ( self == NULL )
+        return;
+
+    g_ptr_array_unref(self->both);
+    _wh_assign_matcher_uninit(&self->title);
+    _wh_assign_matcher_uninit(&self->app_id);
+    g_hash_table_unref(self->literals);
+    g_hash_table_unref(self->rules_by_name);
+    g_queue_foreach(&self->rules, (GFunc) _wh_assign_free, NULL);
+    g_queue_clear(&self->rules);
+
+    g_free(self);
+}
+
+gboolean
+wh_assigns_add(WhAssigns *self, const gchar *name, const gchar *app_id, const gchar *title, guint64 number, const gchar *workspace)
+{
+    WhAssign *rule;
+
+    if ( ( app_id == NULL ) && ( title == NULL ) )
+        return FALSE;
+
+    rule = g_slice_new0(WhAssign);
+    rule->name = g_strdup(name);
+    rule->workspace.number = number;
+    rule->workspace.name = g_strdup(workspace);
+
+    if ( ( app_id != NULL ) && _wh_assign_pattern_is_literal(app_id) )
+        rule->app_id_literal = g_strdup(app_id);
+    else if ( ( app_id != NULL ) && ( ( rule->app_id = _wh_assign_pattern_compile(name, app_id) ) == NULL ) )
+        goto error;
+
+    if ( ( title != NULL ) && ( ( rule->title = _wh_assign_pattern_compile(name, title) ) == NULL ) )
+        goto error;
+
+    wh_assigns_remove(self, name);
+    g_queue_push_tail(&self->rules, rule);
+    g_hash_table_insert(self->rules_by_name, rule->name, self->rules.tail);
+    self->dirty = TRUE;
+
+    return TRUE;
+
+error:
+    _wh_assign_free(rule);
+    return FALSE;
+}
+
+void
+wh_assigns_remove(WhAssigns *self, const gchar *name)
+{
+    GList *link;
+
+    link = g_hash_table_lookup(self->rules_by_name, name);
+    if ( link == NULL )
+        return;
+
+    g_hash_table_remove(self->rules_by_name, name);
+    _wh_assign_free(link->data);
+    g_queue_delete_link(&self->rules, link);
+    self->dirty = TRUE;
+}
+
+gboolean
+wh_assigns_references(WhAssigns *self, WhAssignProperty properties)
+{
+    if ( self->dirty )
+        _wh_assigns_compile(self);
+
+    return ( ( self->references & properties ) != 0 );
+}
+
+/*
+ * Only the rules referencing one of the given properties are considered,
+ * the first one (in configuration order) matching wins
+ */
+const WhWorkspaceConfig *
+wh_assigns_match(WhAssigns *self, const gchar *app_id, const gchar *title, WhAssignProperty properties)
+{
+    WhAssign *best = NULL, *rule;
+    guint i;
+
+    if ( ! wh_assigns_references(self, properties) )
+        return NULL;
+
+    if ( ( properties & WH_ASSIGN_PROPERTY_APP_ID ) && ( app_id != NULL ) )
+    {
+        best = g_hash_table_lookup(self->literals, app_id);
+        rule = _wh_assign_matcher_match(&self->app_id, app_id);
+        if ( ( rule != NULL ) && ( ( best == NULL ) || ( rule->index < best->index ) ) )
+            best = rule;
+    }
+
+    if ( ( properties & WH_ASSIGN_PROPERTY_TITLE ) && ( title != NULL ) )
+    {
+        rule = _wh_assign_matcher_match(&self->title, title);
+        if ( ( rule != NULL ) && ( ( best == NULL ) || ( rule->index < best->index ) ) )
+            best = rule;
+    }
+
+    for ( i = 0 ; i < self->both->len ; ++i )
+    {
+        rule = g_ptr_array_index(self->both, i);
+        if ( ( best != NULL ) && ( rule->index > best->index ) )
+            break;
+        if ( _wh_assign_match(rule, app_id, title) )
+        {
+            best = rule;
+            break;
+        }
+    }
+
+    return ( best != NULL ) ? &best->workspace : NULL;
+}
@@ -0,0 +1,43 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_ASSIGNS_H__
+#define __WAYHOUSE_ASSIGNS_H__
+
+#include "types.h"
+
+typedef enum {
+    WH_ASSIGN_PROPERTY_APP_ID = (1 << 0),
+    WH_ASSIGN_PROPERTY_TITLE  = (1 << 1),
+    WH_ASSIGN_PROPERTY_ALL    = WH_ASSIGN_PROPERTY_APP_ID | WH_ASSIGN_PROPERTY_TITLE,
+} WhAssignProperty;
+
+WhAssigns *wh_assigns_new(void);
+void wh_assigns_free(WhAssigns *assigns);
+
+gboolean wh_assigns_add(WhAssigns *assigns, const gchar *name, const gchar *app_id, const gchar *title, guint64 number, const gchar *workspace);
+void wh_assigns_remove(WhAssigns *assigns, const gchar *name);
+
+gboolean wh_assigns_references(WhAssigns *assigns, WhAssignProperty properties);
+const WhWorkspaceConfig *wh_assigns_match(WhAssigns *assigns, const gchar *app_id, const gchar *title, WhAssignProperty properties);
+
+#endif /* __WAYHOUSE_ASSIGNS_H__ */
@@ -0,0 +1,317 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include <wayland-server.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "spawner.h"
+#include "containers.h"
+#include "autostart.h"
+
+/*
+ * Each launch gets a token in its environment. Clients do not have
+ * to know about it: we read it back from /proc when their first
+ * surface shows up, and place the surface accordingly.
+ */
+#define WH_AUTOSTART_ENV "WAYHOUSE_STARTUP_ID"
+
+/* How long we wait for a stage to show up before launching the next one */
+#define WH_AUTOSTART_STAGE_TIMEOUT 3000
+/* How long tokens are honoured after the last launch */
+#define WH_AUTOSTART_TOKEN_TIMEOUT 30000
+
+typedef struct {
+    gchar *name;
+    gchar **argv;
+    gint stage;
+    WhWorkspaceConfig workspace;
+    gchar *token;
+    gboolean arrived;
+} WhAutostartEntry;
+
+struct _WhAutostart {
+    WhCore *core;
+    GHashTable *entries;
+    GHashTable *tokens;
+    GList *queue;
+    gint stage;
+    guint stage_source;
+    guint expire_source;
+};
+
+static void
+_wh_autostart_entry_free(gpointer data)
+{
+    WhAutostartEntry *self = data;
+
+    g_free(self->token);
+    g_free(self->workspace.name);
+    g_strfreev(self->argv);
+    g_free(self->name);
+
+    g_slice_free(WhAutostartEntry, self);
+}
+
+static gint
+_wh_autostart_entry_compare(gconstpointer a_, gconstpointer b_)
+{
+    const WhAutostartEntry *a = a_, *b = b_;
+
+    if ( a->stage != b->stage )
+        return ( a->stage < b->stage ) ? -1 : 1;
+    return g_strcmp0(a->name, b->name);
+}
+
+WhAutostart *
+wh_autostart_new(WhCore *core)
+{
+    WhAutostart *self;
+
+    self = g_new0(WhAutostart, 1);
+    self->core = core;
+
+    self->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _wh_autostart_entry_free);
+    self->tokens = g_hash_table_new(g_str_hash, g_str_equal);
+
+    return self;
+}
+
+void
+wh_autostart_free(WhAutostart *self)
+{
+    if ( self->expire_source > 0 )
+        g_source_remove(self->expire_source);
+    if ( self->stage_source > 0 )
+        g_source_remove(self->stage_source);
+
+    g_list_free(self->queue);
+    g_hash_table_unref(self->tokens);
+    g_hash_table_unref(self->entries);
+
+    g_free(self);
+}
+
+void
+wh_autostart_add(WhAutostart *self, const gchar *name, gchar **argv, gint stage, guint64 number, const gchar *workspace)
+{
+    WhAutostartEntry *entry;
+
+    entry = g_slice_new0(WhAutostartEntry);
+    entry->name = g_strdup(name);
+    entry->argv = argv;
+    entry->stage = stage;
+    entry->workspace.number = number;
+    entry->workspace.name = g_strdup(workspace);
+
+    wh_autostart_remove(self, name);
+    g_hash_table_insert(self->entries, entry->name, entry);
+}
+
+void
+wh_autostart_remove(WhAutostart *self, const gchar *name)
+{
+    WhAutostartEntry *entry;
+
+    entry = g_hash_table_lookup(self->entries, name);
+    if ( entry == NULL )
+        return;
+
+    if ( entry->token != NULL )
+        g_hash_table_remove(self->tokens, entry->token);
+    self->queue = g_list_remove(self->queue, entry);
+    g_hash_table_remove(self->entries, name);
+}
+
+static void
+_wh_autostart_done(WhAutostart *self)
+{
+    if ( self->expire_source > 0 )
+        g_source_remove(self->expire_source);
+    self->expire_source = 0;
+
+    g_hash_table_remove_all(self->tokens);
+    wh_workspaces_set_batching(wh_core_get_workspaces(self->core), FALSE);
+}
+
+static gboolean
+_wh_autostart_expire(gpointer user_data)
+{
+    WhAutostart *self = user_data;
+
+    self->expire_source = 0;
+    g_debug("Autostart tokens expired");
+    _wh_autostart_done(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void _wh_autostart_launch_stage(WhAutostart *self);
+static gboolean
+_wh_autostart_stage_timeout(gpointer user_data)
+{
+    WhAutostart *self = user_data;
+
+    self->stage_source = 0;
+    g_debug("Autostart stage %d timed out", self->stage);
+    _wh_autostart_launch_stage(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_autostart_launch_stage(WhAutostart *self)
+{
+    WhSpawner *spawner = wh_core_get_spawner(self->core);
+    WhAutostartEntry *entry;
+
+    if ( self->stage_source > 0 )
+        g_source_remove(self->stage_source);
+    self->stage_source = 0;
+
+    if ( self->queue == NULL )
+        return;
+
+    entry = self->queue->data;
+    self->stage = entry->stage;
+    g_debug("Autostart stage %d", self->stage);
+
+    while ( ( self->queue != NULL ) && ( ( entry = self->queue->data )->stage == self->stage ) )
+    {
+        gchar **env;
+
+        self->queue = g_list_delete_link(self->queue, self->queue);
+
+        g_free(entry->token);
+        entry->token = g_strdup_printf("%08x-%s", g_random_int(), entry->name);
+        entry->arrived = FALSE;
+        g_hash_table_insert(self->tokens, entry->token, entry);
+
+        env = g_environ_setenv(g_get_environ(), WH_AUTOSTART_ENV, entry->token, TRUE);
+        g_debug("Autostart %s: %s", entry->name, entry->argv[0]);
+        wh_spawner_spawn(spawner, NULL, entry->argv, env);
+        g_strfreev(env);
+    }
+
+    if ( self->queue != NULL )
+        self->stage_source = g_timeout_add(WH_AUTOSTART_STAGE_TIMEOUT, _wh_autostart_stage_timeout, self);
+
+    if ( self->expire_source > 0 )
+        g_source_remove(self->expire_source);
+    self->expire_source = g_timeout_add(WH_AUTOSTART_TOKEN_TIMEOUT, _wh_autostart_expire, self);
+}
+
+void
+wh_autostart_launch(WhAutostart *self)
+{
+    GHashTableIter iter;
+    WhAutostartEntry *entry;
+
+    g_hash_table_iter_init(&iter, self->entries);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &entry) )
+        self->queue = g_list_prepend(self->queue, entry);
+    self->queue = g_list_sort(self->queue, _wh_autostart_entry_compare);
+
+    if ( self->queue == NULL )
+        return;
+
+    wh_workspaces_set_batching(wh_core_get_workspaces(self->core), TRUE);
+    _wh_autostart_launch_stage(self);
+}
+
+static gchar *
+_wh_autostart_get_token(struct wl_client *client)
+{
+    pid_t pid;
+    gchar *path, *contents, *token = NULL;
+    gsize length;
+
+    wl_client_get_credentials(client, &pid, NULL, NULL);
+
+    path = g_strdup_printf("/proc/%d/environ", (gint) pid);
+    if ( g_file_get_contents(path, &contents, &length, NULL) )
+    {
+        const gchar *var;
+        for ( var = contents ; var < ( contents + length ) ; var += strlen(var) + 1 )
+        {
+            if ( g_str_has_prefix(var, WH_AUTOSTART_ENV "=") )
+            {
+                token = g_strdup(var + strlen(WH_AUTOSTART_ENV "="));
+                break;
+            }
+        }
+        g_free(contents);
+    }
+    g_free(path);
+
+    return token;
+}
+
+const WhWorkspaceConfig *
+wh_autostart_match(WhAutostart *self, struct wl_client *client)
+{
+    WhAutostartEntry *entry;
+    gchar *token;
+
+    if ( ( client == NULL ) || ( g_hash_table_size(self->tokens) == 0 ) )
+        return NULL;
+
+    token = _wh_autostart_get_token(client);
+    if ( token == NULL )
+        return NULL;
+
+    entry = g_hash_table_lookup(self->tokens, token);
+    g_free(token);
+    if ( entry == NULL )
+        return NULL;
+
+    if ( ! entry->arrived )
+    {
+        GHashTableIter iter;
+        WhAutostartEntry *other;
+        gboolean done = TRUE;
+
+        entry->arrived = TRUE;
+        g_debug("Autostart %s arrived", entry->name);
+
+        g_hash_table_iter_init(&iter, self->tokens);
+        while ( done && g_hash_table_iter_next(&iter, NULL, (gpointer *) &other) )
+            done = other->arrived;
+
+        /* No need to wait for the timeout if the whole stage is here */
+        if ( done && ( self->queue != NULL ) )
+            _wh_autostart_launch_stage(self);
+        else if ( done )
+            wh_workspaces_set_batching(wh_core_get_workspaces(self->core), FALSE);
+    }
+
+    if ( ( entry->workspace.number == WH_WORKSPACE_NO_NUMBER ) && ( entry->workspace.name == NULL ) )
+        return NULL;
+    return &entry->workspace;
+}
@@ -0,0 +1,39 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_AUTOSTART_H__
+#define __WAYHOUSE_AUTOSTART_H__
+
+#include "types.h"
+
+struct wl_client;
+
+WhAutostart *wh_autostart_new(WhCore *core);
+void wh_autostart_free(WhAutostart *autostart);
+
+void wh_autostart_add(WhAutostart *autostart, const gchar *name, gchar **argv, gint stage, guint64 number, const gchar *workspace);
+void wh_autostart_remove(WhAutostart *autostart, const gchar *name);
+
+void wh_autostart_launch(WhAutostart *autostart);
+const WhWorkspaceConfig *wh_autostart_match(WhAutostart *autostart, struct wl_client *client);
+
+#endif /* __WAYHOUSE_AUTOSTART_H__ */
@@ -0,0 +1,231 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include <glib.h>
+#include <nkutils-colour.h>
+
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "background.h"
+
+/*
+ * A plain solid-colour surface per output, drawn by the renderer
+ * directly: no client, no buffer, and there from the first frame
+ */
+
+struct _WhBackground {
+    WhCore *core;
+    struct weston_layer *layer;
+    NkColour colour;
+    GHashTable *outputs;
+    struct wl_listener output_created_listener;
+    struct wl_listener output_destroyed_listener;
+    struct wl_listener output_moved_listener;
+    struct wl_listener output_resized_listener;
+};
+
+typedef struct {
+    WhBackground *background;
+    struct weston_output *output;
+    struct weston_surface *surface;
+    struct weston_view *view;
+} WhBackgroundOutput;
+
+static void
+_wh_background_output_configure(WhBackgroundOutput *self)
+{
+    NkColour *colour = &self->background->colour;
+    struct weston_output *output = self->output;
+
+    weston_surface_set_color(self->surface, colour->red, colour->green, colour->blue, 1.0);
+    weston_surface_set_size(self->surface, output->width, output->height);
+
+    pixman_region32_fini(&self->surface->opaque);
+    pixman_region32_init_rect(&self->surface->opaque, 0, 0, output->width, output->height);
+
+    weston_view_set_position(self->view, output->x, output->y);
+    weston_view_geometry_dirty(self->view);
+    weston_surface_damage(self->surface);
+}
+
+static void
+_wh_background_output_new(WhBackground *background, struct weston_output *output)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(background->core);
+    WhBackgroundOutput *self;
+
+    self = g_slice_new0(WhBackgroundOutput);
+    self->background = background;
+    self->output = output;
+
+    self->surface = weston_surface_create(compositor);
+    if ( self->surface == NULL )
+    {
+        g_slice_free(WhBackgroundOutput, self);
+        return;
+    }
+
+    /* Clicks go through to nothing */
+    pixman_region32_fini(&self->surface->input);
+    pixman_region32_init(&self->surface->input);
+
+    self->view = weston_view_create(self->surface);
+    weston_layer_entry_insert(&background->layer->view_list, &self->view->layer_link);
+    self->surface->is_mapped = true;
+    self->view->is_mapped = true;
+    self->view->output = output;
+
+    _wh_background_output_configure(self);
+
+    g_hash_table_insert(background->outputs, output, self);
+}
+
+static void
+_wh_background_output_free(gpointer data)
+{
+    WhBackgroundOutput *self = data;
+
+    weston_surface_destroy(self->surface);
+
+    g_slice_free(WhBackgroundOutput, self);
+}
+
+static void
+_wh_background_output_created(struct wl_listener *listener, void *data)
+{
+    WhBackground *self = wl_container_of(listener, self, output_created_listener);
+    struct weston_output *output = data;
+
+    _wh_background_output_new(self, output);
+}
+
+static void
+_wh_background_output_destroyed(struct wl_listener *listener, void *data)
+{
+    WhBackground *self = wl_container_of(listener, self, output_destroyed_listener);
+    struct weston_output *output = data;
+
+    g_hash_table_remove(self->outputs, output);
+}
+
+static void
+_wh_background_output_changed(WhBackground *self, struct weston_output *output)
+{
+    WhBackgroundOutput *background_output;
+
+    background_output = g_hash_table_lookup(self->outputs, output);
+    if ( background_output != NULL )
+        _wh_background_output_configure(background_output);
+}
+
+static void
+_wh_background_output_moved(struct wl_listener *listener, void *data)
+{
+    WhBackground *self = wl_container_of(listener, self, output_moved_listener);
+
+    _wh_background_output_changed(self, data);
+}
+
+static void
+_wh_background_output_resized(struct wl_listener *listener, void *data)
+{
+    WhBackground *self = wl_container_of(listener, self, output_resized_listener);
+
+    _wh_background_output_changed(self, data);
+}
+
+WhBackground *
+wh_background_new(WhCore *core, struct weston_layer *layer)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(core);
+    WhBackground *self;
+
+    self = g_new0(WhBackground, 1);
+    self->core = core;
+    self->layer = layer;
+
+    wh_background_set_colour(self, NULL);
+    self->outputs = g_hash_table_new_full(NULL, NULL, NULL, _wh_background_output_free);
+
+    struct weston_output *output;
+    wl_list_for_each(output, &compositor->output_list, link)
+        _wh_background_output_new(self, output);
+
+    self->output_created_listener.notify = _wh_background_output_created;
+    wl_signal_add(&compositor->output_created_signal, &self->output_created_listener);
+    self->output_destroyed_listener.notify = _wh_background_output_destroyed;
+    wl_signal_add(&compositor->output_destroyed_signal, &self->output_destroyed_listener);
+    self->output_moved_listener.notify = _wh_background_output_moved;
+    wl_signal_add(&compositor->output_moved_signal, &self->output_moved_listener);
+    self->output_resized_listener.notify = _wh_background_output_resized;
+    wl_signal_add(&compositor->output_resized_signal, &self->output_resized_listener);
+
+    return self;
+}
+
+void
+wh_background_free(WhBackground *self)
+{
+    if ( self == NULL )
+        return;
+
+    wl_list_remove(&self->output_resized_listener.link);
+    wl_list_remove(&self->output_moved_listener.link);
+    wl_list_remove(&self->output_destroyed_listener.link);
+    wl_list_remove(&self->output_created_listener.link);
+
+    g_hash_table_unref(self->outputs);
+
+    g_free(self);
+}
+
+void
+wh_background_set_colour(WhBackground *self, const gchar *colour)
+{
+    if ( ( colour == NULL ) || ( ! nk_colour_parse(colour, &self->colour) ) )
+    {
+        if ( colour != NULL )
+            g_warning("Invalid background colour %s", colour);
+
+        /* Same default as ww-background used to get, tells instances apart */
+        guint32 pid = getpid();
+        self->colour.red = ( ( pid >> 16 ) & 0xff ) / 255.;
+        self->colour.green = ( ( pid >> 8 ) & 0xff ) / 255.;
+        self->colour.blue = ( pid & 0xff ) / 255.;
+        self->colour.alpha = 1.0;
+    }
+
+    if ( self->outputs == NULL )
+        return;
+
+    GHashTableIter iter;
+    WhBackgroundOutput *output;
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+        _wh_background_output_configure(output);
+}
@@ -0,0 +1,742 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <xkbcommon/xkbcommon.h>
+
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "commands.h"
+#include "bindings.h"
+#include "spawner.h"
+#include "latency.h"
+
+/*
+ * Keycodes and buttons fit in 24 bits, leaving room for the modifiers
+ * so that a binding is a single integer key in the mode tables
+ */
+#define WH_BINDING_MAX_CODE ((1 << 24) - 1)
+#define WH_BINDING_KEY(modifiers, code) GUINT_TO_POINTER(( (modifiers) << 24 ) | (code))
+
+/* xkb keycodes are evdev ones shifted by 8 */
+#define WH_BINDING_XKB_OFFSET 8
+
+#define WH_BINDINGS_DEFAULT_TIMEOUT 1000
+
+/* Seats rarely use more than a couple of keymap and group combinations */
+#define WH_BINDINGS_RESOLVED_MAX 8
+
+struct _WhAction {
+    WhCore *core;
+    enum {
+        WH_ACTION_COMMAND,
+        WH_ACTION_EXEC,
+    } type;
+    union {
+        WhCommand *command;
+        gchar **argv;
+    };
+};
+
+typedef struct {
+    gsize length;
+    WhBindingKey *keys;
+    gboolean keysym;
+    WhAction *action;
+} WhKeyBinding;
+
+typedef struct _WhBindingNode WhBindingNode;
+struct _WhBindingNode {
+    WhAction *action;
+    GHashTable *children;
+};
+
+typedef struct {
+    gchar *name;
+    GSList *keys;
+    GHashTable *buttons;
+} WhBindingMode;
+
+/*
+ * The key bindings resolved against a keymap and group: each seat has
+ * its own, so we keep the few last used ones around
+ */
+typedef struct {
+    struct xkb_keymap *keymap;
+    guint32 group;
+    GHashTable *modifier_keys;
+    /* mode -> prefix trie of its key bindings, not owning the actions */
+    GHashTable *modes;
+} WhBindingsResolved;
+
+struct _WhBindings {
+    WhCore *core;
+    GHashTable *modes;
+    WhBindingMode *mode;
+    guint timeout;
+    GQueue *resolved;
+    gboolean dirty;
+    guint64 generation;
+};
+
+struct _WhBindingsState {
+    WhBindings *bindings;
+    WhSeat *seat;
+    WhBindingNode *node;
+    guint64 generation;
+    guint timeout;
+};
+
+WhAction *
+wh_action_new_command(WhCore *core, WhCommand *command)
+{
+    WhAction *self;
+
+    self = g_new0(WhAction, 1);
+    self->core = core;
+    self->type = WH_ACTION_COMMAND;
+    self->command = command;
+
+    return self;
+}
+
+WhAction *
+wh_action_new_exec(WhCore *core, gchar **argv)
+{
+    WhAction *self;
+
+    self = g_new0(WhAction, 1);
+    self->core = core;
+    self->type = WH_ACTION_EXEC;
+    self->argv = argv;
+
+    return self;
+}
+
+void
+wh_action_free(WhAction *self)
+{
+    switch ( self->type )
+    {
+    case WH_ACTION_COMMAND:
+        wh_command_free(self->command);
+    break;
+    case WH_ACTION_EXEC:
+        g_strfreev(self->argv);
+    break;
+    }
+
+    g_free(self);
+}
+
+void
+wh_action_trigger(WhAction *self, WhSeat *seat)
+{
+    switch ( self->type )
+    {
+    case WH_ACTION_COMMAND:
+        g_debug("command %s", wh_command_get_string(self->command));
+        wh_latency_begin(wh_core_get_latency(self->core), wh_command_get_string(self->command), TRUE);
+        wh_command_call(self->command, seat);
+    break;
+    case WH_ACTION_EXEC:
+        g_debug("exec %s", self->argv[0]);
+        wh_latency_begin(wh_core_get_latency(self->core), self->argv[0], TRUE);
+        wh_spawner_spawn(wh_core_get_spawner(self->core), NULL, self->argv, NULL);
+    break;
+    }
+}
+
+static void
+_wh_key_binding_free(gpointer data)
+{
+    WhKeyBinding *self = data;
+
+    wh_action_free(self->action);
+    g_free(self->keys);
+
+    g_slice_free(WhKeyBinding, self);
+}
+
+static WhBindingNode *
+_wh_binding_node_new(void)
+{
+    return g_slice_new0(WhBindingNode);
+}
+
+static void
+_wh_binding_node_free(gpointer data)
+{
+    WhBindingNode *self = data;
+
+    if ( self->children != NULL )
+        g_hash_table_unref(self->children);
+
+    g_slice_free(WhBindingNode, self);
+}
+
+static WhBindingNode *
+_wh_binding_node_get_child(WhBindingNode *self, guint32 modifiers, guint32 code)
+{
+    gpointer key = WH_BINDING_KEY(modifiers, code);
+    WhBindingNode *child;
+
+    if ( self->children == NULL )
+        self->children = g_hash_table_new_full(NULL, NULL, NULL, _wh_binding_node_free);
+
+    child = g_hash_table_lookup(self->children, key);
+    if ( child == NULL )
+    {
+        child = _wh_binding_node_new();
+        g_hash_table_insert(self->children, key, child);
+    }
+
+    return child;
+}
+
+static WhBindingNode *
+_wh_binding_node_lookup(WhBindingNode *self, guint32 modifiers, guint32 code)
+{
+    if ( ( self->children == NULL ) || ( code > WH_BINDING_MAX_CODE ) )
+        return NULL;
+
+    return g_hash_table_lookup(self->children, WH_BINDING_KEY(modifiers, code));
+}
+
+static WhBindingMode *
+_wh_binding_mode_new(const gchar *name)
+{
+    WhBindingMode *self;
+
+    self = g_slice_new0(WhBindingMode);
+    self->name = g_strdup(name);
+    self->buttons = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) wh_action_free);
+
+    return self;
+}
+
+static void
+_wh_binding_mode_free(gpointer data)
+{
+    WhBindingMode *self = data;
+
+    g_hash_table_unref(self->buttons);
+    g_slist_free_full(self->keys, _wh_key_binding_free);
+    g_free(self->name);
+
+    g_slice_free(WhBindingMode, self);
+}
+
+static void
+_wh_bindings_invalidate(WhBindings *self)
+{
+    /* Partial sequences may point to nodes we are about to drop */
+    self->dirty = TRUE;
+    ++self->generation;
+}
+
+static WhBindingMode *
+_wh_bindings_get_mode(WhBindings *self, const gchar *name)
+{
+    WhBindingMode *mode;
+
+    mode = g_hash_table_lookup(self->modes, name);
+    if ( mode == NULL )
+    {
+        mode = _wh_binding_mode_new(name);
+        g_hash_table_insert(self->modes, mode->name, mode);
+        /* Resolved bindings have a trie for each mode */
+        _wh_bindings_invalidate(self);
+    }
+
+    return mode;
+}
+
+gboolean
+wh_bindings_add_keys(WhBindings *self, const gchar *mode_name, const WhBindingKey *keys, gsize length, WhAction *action)
+{
+    WhBindingMode *mode;
+    WhKeyBinding *binding;
+    gboolean keysym = FALSE;
+    gsize i;
+    GSList *link;
+
+    if ( length < 1 )
+        return FALSE;
+
+    for ( i = 0 ; i < length ; ++i )
+    {
+        if ( keys[i].keysym )
+            keysym = TRUE;
+        else if ( keys[i].code > WH_BINDING_MAX_CODE )
+            return FALSE;
+    }
+
+    mode = _wh_bindings_get_mode(self, mode_name);
+    _wh_bindings_invalidate(self);
+
+    for ( link = mode->keys ; link != NULL ; link = g_slist_next(link) )
+    {
+        binding = link->data;
+        if ( ( binding->length == length ) && ( memcmp(binding->keys, keys, sizeof(WhBindingKey) * length) == 0 ) )
+        {
+            wh_action_free(binding->action);
+            binding->action = action;
+            return TRUE;
+        }
+    }
+
+    binding = g_slice_new(WhKeyBinding);
+    binding->length = length;
+    binding->keys = g_memdup(keys, sizeof(WhBindingKey) * length);
+    binding->keysym = keysym;
+    binding->action = action;
+
+    mode->keys = g_slist_prepend(mode->keys, binding);
+
+    return TRUE;
+}
+
+void
+wh_bindings_remove_keys(WhBindings *self, const gchar *mode_name, const WhBindingKey *keys, gsize length)
+{
+    WhBindingMode *mode;
+    GSList *link;
+
+    mode = g_hash_table_lookup(self->modes, mode_name);
+    if ( mode == NULL )
+        return;
+
+    for ( link = mode->keys ; link != NULL ; link = g_slist_next(link) )
+    {
+        WhKeyBinding *binding = link->data;
+        if ( ( binding->length == length ) && ( memcmp(binding->keys, keys, sizeof(WhBindingKey) * length) == 0 ) )
+        {
+            _wh_bindings_invalidate(self);
+            mode->keys = g_slist_delete_link(mode->keys, link);
+            _wh_key_binding_free(binding);
+            return;
+        }
+    }
+}
+
+gboolean
+wh_bindings_add_button(WhBindings *self, const gchar *mode, guint32 modifiers, guint32 button, WhAction *action)
+{
+    if ( button > WH_BINDING_MAX_CODE )
+        return FALSE;
+
+    g_hash_table_insert(_wh_bindings_get_mode(self, mode)->buttons, WH_BINDING_KEY(modifiers, button), action);
+    return TRUE;
+}
+
+void
+wh_bindings_remove_button(WhBindings *self, const gchar *mode_name, guint32 modifiers, guint32 button)
+{
+    WhBindingMode *mode;
+
+    mode = g_hash_table_lookup(self->modes, mode_name);
+    if ( ( mode == NULL ) || ( button > WH_BINDING_MAX_CODE ) )
+        return;
+
+    g_hash_table_remove(mode->buttons, WH_BINDING_KEY(modifiers, button));
+}
+
+void
+wh_bindings_set_timeout(WhBindings *self, guint timeout)
+{
+    /* Unset, use our default */
+    if ( timeout == 0 )
+        timeout = WH_BINDINGS_DEFAULT_TIMEOUT;
+    self->timeout = timeout;
+}
+
+void
+wh_bindings_switch_mode(WhBindings *self, WhSeat *seat, const gchar *name)
+{
+    WhBindingMode *mode;
+
+    mode = g_hash_table_lookup(self->modes, name);
+    if ( mode == NULL )
+    {
+        g_warning("Unknown binding mode %s", name);
+        return;
+    }
+
+    g_debug("Switch to binding mode %s", mode->name);
+    self->mode = mode;
+    /* Drop partial sequences of the previous mode */
+    ++self->generation;
+}
+
+static gboolean
+_wh_bindings_is_modifier(xkb_keysym_t keysym)
+{
+    return ( ( keysym >= XKB_KEY_Shift_L ) && ( keysym <= XKB_KEY_Hyper_R ) )
+        || ( ( keysym >= XKB_KEY_ISO_Lock ) && ( keysym <= XKB_KEY_ISO_Last_Group_Lock ) );
+}
+
+static GHashTable *
+_wh_bindings_map_keysyms(WhBindingsResolved *self)
+{
+    GHashTable *map;
+    xkb_keycode_t min = xkb_keymap_min_keycode(self->keymap);
+    xkb_keycode_t max = xkb_keymap_max_keycode(self->keymap);
+    xkb_keycode_t keycode;
+
+    /*
+     * keysym -> list of (code << 1 | level) for the first two levels,
+     * the second one only being reachable with shift
+     */
+    map = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify) g_slist_free);
+
+    for ( keycode = min ; keycode <= max ; ++keycode )
+    {
+        if ( ( keycode < WH_BINDING_XKB_OFFSET ) || ( keycode - WH_BINDING_XKB_OFFSET > WH_BINDING_MAX_CODE ) )
+            continue;
+
+        xkb_layout_index_t layout = self->group;
+        xkb_layout_index_t num_layouts = xkb_keymap_num_layouts_for_key(self->keymap, keycode);
+        if ( num_layouts == 0 )
+            continue;
+        if ( layout >= num_layouts )
+            layout = 0;
+
+        xkb_level_index_t level, num_levels = MIN(xkb_keymap_num_levels_for_key(self->keymap, keycode, layout), 2);
+        for ( level = 0 ; level < num_levels ; ++level )
+        {
+            const xkb_keysym_t *syms;
+            gint n, i;
+
+            n = xkb_keymap_key_get_syms_by_level(self->keymap, keycode, layout, level, &syms);
+            for ( i = 0 ; i < n ; ++i )
+            {
+                gpointer key = GUINT_TO_POINTER(syms[i]);
+                guint32 code = ( ( keycode - WH_BINDING_XKB_OFFSET ) << 1 ) | level;
+                GSList *codes;
+
+                if ( ( level == 0 ) && _wh_bindings_is_modifier(syms[i]) )
+                    g_hash_table_add(self->modifier_keys, GUINT_TO_POINTER(keycode - WH_BINDING_XKB_OFFSET));
+
+                codes = g_hash_table_lookup(map, key);
+                if ( codes != NULL )
+                    g_hash_table_steal(map, key);
+                g_hash_table_insert(map, key, g_slist_prepend(codes, GUINT_TO_POINTER(code)));
+            }
+        }
+    }
+
+    return map;
+}
+
+static gboolean _wh_bindings_resolve_key(WhBindingNode *node, GHashTable *map, WhKeyBinding *binding, gsize i);
+
+static gboolean
+_wh_bindings_resolve_code(WhBindingNode *node, GHashTable *map, WhKeyBinding *binding, gsize i, guint32 code)
+{
+    WhBindingNode *child;
+
+    child = _wh_binding_node_get_child(node, binding->keys[i].modifiers, code);
+    if ( i + 1 >= binding->length )
+    {
+        if ( child->action == NULL )
+            child->action = binding->action;
+        return TRUE;
+    }
+
+    if ( _wh_bindings_resolve_key(child, map, binding, i + 1) )
+        return TRUE;
+
+    /* The rest of the sequence is unreachable with this keymap, do not leave a dead prefix behind */
+    if ( ( child->action == NULL ) && ( ( child->children == NULL ) || ( g_hash_table_size(child->children) == 0 ) ) )
+        g_hash_table_remove(node->children, WH_BINDING_KEY(binding->keys[i].modifiers, code));
+
+    return FALSE;
+}
+
+static gboolean
+_wh_bindings_resolve_key(WhBindingNode *node, GHashTable *map, WhKeyBinding *binding, gsize i)
+{
+    const WhBindingKey *key = &binding->keys[i];
+    gboolean resolved = FALSE;
+
+    if ( ! key->keysym )
+        return _wh_bindings_resolve_code(node, map, binding, i, key->code);
+
+    if ( map == NULL )
+        return FALSE;
+
+    GSList *code;
+    for ( code = g_hash_table_lookup(map, GUINT_TO_POINTER(key->code)) ; code != NULL ; code = g_slist_next(code) )
+    {
+        guint32 value = GPOINTER_TO_UINT(code->data);
+        if ( ( ( value & 1 ) != 0 ) && ( ( key->modifiers & MODIFIER_SHIFT ) == 0 ) )
+            continue;
+
+        if ( _wh_bindings_resolve_code(node, map, binding, i, value >> 1) )
+            resolved = TRUE;
+    }
+
+    return resolved;
+}
+
+static void
+_wh_bindings_resolved_free(gpointer data)
+{
+    WhBindingsResolved *self = data;
+
+    g_hash_table_unref(self->modes);
+    g_hash_table_unref(self->modifier_keys);
+    if ( self->keymap != NULL )
+        xkb_keymap_unref(self->keymap);
+
+    g_slice_free(WhBindingsResolved, self);
+}
+
+static WhBindingsResolved *
+_wh_bindings_resolved_new(WhBindings *bindings, struct xkb_keymap *keymap, guint32 group)
+{
+    WhBindingsResolved *self;
+    GHashTable *map = NULL;
+    GHashTableIter iter;
+    WhBindingMode *mode;
+
+    self = g_slice_new0(WhBindingsResolved);
+    /* Our reference keeps the pointer from being reused by another keymap */
+    self->keymap = ( keymap != NULL ) ? xkb_keymap_ref(keymap) : NULL;
+    self->group = group;
+    self->modifier_keys = g_hash_table_new(NULL, NULL);
+    self->modes = g_hash_table_new_full(NULL, NULL, NULL, _wh_binding_node_free);
+
+    if ( self->keymap != NULL )
+        map = _wh_bindings_map_keysyms(self);
+
+    g_hash_table_iter_init(&iter, bindings->modes);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &mode) )
+    {
+        WhBindingNode *root;
+        GSList *link;
+
+        root = _wh_binding_node_new();
+        g_hash_table_insert(self->modes, mode, root);
+
+        /* Explicit keycode bindings win, so they go first */
+        for ( link = mode->keys ; link != NULL ; link = g_slist_next(link) )
+        {
+            WhKeyBinding *binding = link->data;
+            if ( ! binding->keysym )
+                _wh_bindings_resolve_key(root, map, binding, 0);
+        }
+        for ( link = mode->keys ; link != NULL ; link = g_slist_next(link) )
+        {
+            WhKeyBinding *binding = link->data;
+            if ( binding->keysym )
+                _wh_bindings_resolve_key(root, map, binding, 0);
+        }
+    }
+
+    if ( map != NULL )
+        g_hash_table_unref(map);
+
+    return self;
+}
+
+static WhBindingsResolved *
+_wh_bindings_resolve(WhBindings *self, struct xkb_keymap *keymap, guint32 group)
+{
+    WhBindingsResolved *resolved;
+    GList *link;
+
+    if ( self->dirty )
+    {
+        /* Sequences in progress were dropped when we got dirty */
+        g_queue_free_full(self->resolved, _wh_bindings_resolved_free);
+        self->resolved = g_queue_new();
+        self->dirty = FALSE;
+    }
+
+    for ( link = self->resolved->head ; link != NULL ; link = g_list_next(link) )
+    {
+        resolved = link->data;
+        if ( ( resolved->keymap != keymap ) || ( resolved->group != group ) )
+            continue;
+
+        /* Most recently used first */
+        g_queue_unlink(self->resolved, link);
+        g_queue_push_head_link(self->resolved, link);
+        return resolved;
+    }
+
+    if ( g_queue_get_length(self->resolved) >= WH_BINDINGS_RESOLVED_MAX )
+    {
+        /* Partial sequences may point to the nodes we drop */
+        _wh_bindings_resolved_free(g_queue_pop_tail(self->resolved));
+        ++self->generation;
+    }
+
+    resolved = _wh_bindings_resolved_new(self, keymap, group);
+    g_queue_push_head(self->resolved, resolved);
+
+    return resolved;
+}
+
+static void
+_wh_bindings_state_reset(WhBindingsState *self)
+{
+    if ( self->timeout != 0 )
+        g_source_remove(self->timeout);
+    self->timeout = 0;
+    self->node = NULL;
+    self->generation = self->bindings->generation;
+}
+
+static gboolean
+_wh_bindings_state_timeout(gpointer user_data)
+{
+    WhBindingsState *self = user_data;
+    WhBindingNode *node = self->node;
+    gboolean valid = ( self->generation == self->bindings->generation );
+
+    self->timeout = 0;
+    _wh_bindings_state_reset(self);
+
+    /* A prefix that is also a binding on its own fires when the sequence is abandoned */
+    if ( valid && ( node != NULL ) && ( node->action != NULL ) )
+        wh_action_trigger(node->action, self->seat);
+
+    return G_SOURCE_REMOVE;
+}
+
+WhBindingsState *
+wh_bindings_state_new(WhBindings *bindings, WhSeat *seat)
+{
+    WhBindingsState *self;
+
+    self = g_new0(WhBindingsState, 1);
+    self->bindings = bindings;
+    self->seat = seat;
+
+    return self;
+}
+
+void
+wh_bindings_state_free(WhBindingsState *self)
+{
+    if ( self->timeout != 0 )
+        g_source_remove(self->timeout);
+
+    g_free(self);
+}
+
+gboolean
+wh_bindings_handle_key(WhBindings *self, WhBindingsState *state, struct xkb_keymap *keymap, guint32 group, guint32 modifiers, guint32 key)
+{
+    WhBindingsResolved *resolved;
+    WhBindingNode *root, *node;
+
+    resolved = _wh_bindings_resolve(self, keymap, group);
+    root = g_hash_table_lookup(resolved->modes, self->mode);
+
+    if ( state->generation != self->generation )
+        _wh_bindings_state_reset(state);
+
+    if ( state->node != NULL )
+    {
+        /* Pressing shift for the next key must not break the sequence */
+        if ( g_hash_table_contains(resolved->modifier_keys, GUINT_TO_POINTER(key)) )
+            return FALSE;
+
+        node = _wh_binding_node_lookup(state->node, modifiers, key);
+        _wh_bindings_state_reset(state);
+        if ( node == NULL )
+            node = _wh_binding_node_lookup(root, modifiers, key);
+    }
+    else
+        node = _wh_binding_node_lookup(root, modifiers, key);
+
+    if ( node == NULL )
+        return FALSE;
+
+    if ( ( node->children != NULL ) && ( g_hash_table_size(node->children) > 0 ) )
+    {
+        state->node = node;
+        state->timeout = g_timeout_add(self->timeout, _wh_bindings_state_timeout, state);
+    }
+    else if ( node->action != NULL )
+        wh_action_trigger(node->action, state->seat);
+    else
+        return FALSE;
+
+    return TRUE;
+}
+
+gboolean
+wh_bindings_handle_button(WhBindings *self, WhSeat *seat, guint32 modifiers, guint32 button)
+{
+    WhAction *action;
+
+    if ( button > WH_BINDING_MAX_CODE )
+        return FALSE;
+
+    action = g_hash_table_lookup(self->mode->buttons, WH_BINDING_KEY(modifiers, button));
+    if ( action == NULL )
+        return FALSE;
+
+    wh_action_trigger(action, seat);
+    return TRUE;
+}
+
+WhBindings *
+wh_bindings_new(WhCore *core)
+{
+    WhBindings *self;
+
+    self = g_new0(WhBindings, 1);
+    self->core = core;
+    self->timeout = WH_BINDINGS_DEFAULT_TIMEOUT;
+
+    self->modes = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _wh_binding_mode_free);
+    self->mode = _wh_bindings_get_mode(self, WH_BINDINGS_DEFAULT_MODE);
+    self->resolved = g_queue_new();
+    self->dirty = TRUE;
+
+    return self;
+}
+
+void
+wh_bindings_free(WhBindings *self)
+{
+    if ( self == NULL )
+        return;
+
+    g_queue_free_full(self->resolved, _wh_bindings_resolved_free);
+    g_hash_table_unref(self->modes);
+
+    g_free(self);
+}
@@ -0,0 +1,60 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_BINDINGS_H__
+#define __WAYHOUSE_BINDINGS_H__
+
+#include "types.h"
+
+struct xkb_keymap;
+
+#define WH_BINDINGS_DEFAULT_MODE "default"
+
+typedef struct {
+    guint32 modifiers;
+    guint32 code;
+    gboolean keysym;
+} WhBindingKey;
+
+WhBindings *wh_bindings_new(WhCore *core);
+void wh_bindings_free(WhBindings *bindings);
+
+WhAction *wh_action_new_command(WhCore *core, WhCommand *command);
+WhAction *wh_action_new_exec(WhCore *core, gchar **argv);
+void wh_action_free(WhAction *action);
+void wh_action_trigger(WhAction *action, WhSeat *seat);
+
+gboolean wh_bindings_add_keys(WhBindings *bindings, const gchar *mode, const WhBindingKey *keys, gsize length, WhAction *action);
+void wh_bindings_remove_keys(WhBindings *bindings, const gchar *mode, const WhBindingKey *keys, gsize length);
+gboolean wh_bindings_add_button(WhBindings *bindings, const gchar *mode, guint32 modifiers, guint32 button, WhAction *action);
+void wh_bindings_remove_button(WhBindings *bindings, const gchar *mode, guint32 modifiers, guint32 button);
+void wh_bindings_set_timeout(WhBindings *bindings, guint timeout);
+
+void wh_bindings_switch_mode(WhBindings *bindings, WhSeat *seat, const gchar *mode);
+
+WhBindingsState *wh_bindings_state_new(WhBindings *bindings, WhSeat *seat);
+void wh_bindings_state_free(WhBindingsState *state);
+
+gboolean wh_bindings_handle_key(WhBindings *bindings, WhBindingsState *state, struct xkb_keymap *keymap, guint32 group, guint32 modifiers, guint32 key);
+gboolean wh_bindings_handle_button(WhBindings *bindings, WhSeat *seat, guint32 modifiers, guint32 button);
+
+#endif /* __WAYHOUSE_BINDINGS_H__ */
@@ -40,6 +40,9 @@
 #include "wayhouse.h"
 #include "outputs.h"
 #include "containers.h"
+#include "bindings.h"
+#include "keymaps.h"
+#include "config_.h"
 #include "commands.h"
 
 struct _WhCommands {
@@ -55,6 +58,7 @@ typedef enum {
     WH_COMMAND_SCOPE_LAYOUT,
     WH_COMMAND_SCOPE_ORIENTATION,
     WH_COMMAND_SCOPE_STATE_CHANGE,
+    WH_COMMAND_SCOPE_CRITERIA,
 } WhCommandScope;
 
 typedef enum {
@@ -65,6 +69,13 @@ typedef enum {
     WH_COMMAND_FULLSCREEN,
     WH_COMMAND_LAYOUT,
     WH_COMMAND_OUTPUT,
+    WH_COMMAND_MARK,
+    WH_COMMAND_UNMARK,
+    WH_COMMAND_MODE,
+    WH_COMMAND_RELOAD,
+    WH_COMMAND_KEYMAP,
+    WH_COMMAND_SAVE,
+    WH_COMMAND_RESTORE,
 } WhCommandCommandSymbol;
 
 
@@ -76,10 +87,19 @@ static const gchar * const _wh_commands_symbols[] = {
     [WH_COMMAND_FULLSCREEN] = "fullscreen",
     [WH_COMMAND_LAYOUT]     = "layout",
     [WH_COMMAND_OUTPUT]     = "output",
+    [WH_COMMAND_MARK]       = "mark",
+    [WH_COMMAND_UNMARK]     = "unmark",
+    [WH_COMMAND_MODE]       = "mode",
+    [WH_COMMAND_RELOAD]     = "reload",
+    [WH_COMMAND_KEYMAP]     = "keymap",
+    [WH_COMMAND_SAVE]       = "save",
+    [WH_COMMAND_RESTORE]    = "restore",
 };
 
 #define WH_DIRECTION_WORKSPACE (WH_DIRECTION_CHILD+1)
 #define WH_DIRECTION_OUTPUT (WH_DIRECTION_CHILD+2)
+#define WH_DIRECTION_MARK (WH_DIRECTION_CHILD+3)
+#define WH_DIRECTION_GROUP (WH_DIRECTION_CHILD+4)
 static const gchar * const _wh_commands_directions[] = {
     [WH_DIRECTION_LEFT]   = "left",
     [WH_DIRECTION_RIGHT]  = "right",
@@ -89,6 +109,8 @@ static const gchar * const _wh_commands_directions[] = {
     [WH_DIRECTION_CHILD]  = "child",
     [WH_DIRECTION_WORKSPACE] = "workspace",
     [WH_DIRECTION_OUTPUT] = "output",
+    [WH_DIRECTION_MARK] = "mark",
+    [WH_DIRECTION_GROUP] = "group",
 };
 
 static const gchar * const _wh_commands_cross_directions[] = {
@@ -120,14 +142,29 @@ static const gchar * const _wh_commands_state_changes[] = {
     [WH_STATE_TOGGLE] = "toggle",
 };
 
+typedef enum {
+    WH_CRITERIA_APP_ID,
+    WH_CRITERIA_TITLE,
+    WH_CRITERIA_MARK,
+} WhCriteriaKey;
+
+static const gchar * const _wh_commands_criteria[] = {
+    [WH_CRITERIA_APP_ID] = "app_id",
+    [WH_CRITERIA_TITLE] = "title",
+    [WH_CRITERIA_MARK] = "con_mark",
+};
+
 typedef enum {
     WH_COMMAND_TARGET_TYPE_ERROR,
+    WH_COMMAND_TARGET_TYPE_NONE,
     WH_COMMAND_TARGET_TYPE_DIRECTION,
     WH_COMMAND_TARGET_TYPE_WORKSPACE_DIRECTION,
     WH_COMMAND_TARGET_TYPE_WORKSPACE_NAME,
     WH_COMMAND_TARGET_TYPE_WORKSPACE_NUMBER,
     WH_COMMAND_TARGET_TYPE_OUTPUT_DIRECTION,
     WH_COMMAND_TARGET_TYPE_OUTPUT_NAME,
+    WH_COMMAND_TARGET_TYPE_MARK,
+    WH_COMMAND_TARGET_TYPE_GROUP,
 } WhCommandTargetType;
 
 typedef gpointer (*WhCoreGetter)(WhCore *core);
@@ -136,6 +173,8 @@ typedef gpointer (*WhCoreGetter)(WhCore *core);
 struct _WhCommand {
     WhCommands *commands;
     gchar *string;
+    WhCriteria criteria;
+    gboolean has_criteria;
     WhCoreGetter getter;
     GClosure *closure;
     guint n_params;
@@ -146,8 +185,15 @@ static WhCommandTargetType
 _wh_command_parse_target(GScanner *scanner, WhCommand *self)
 {
     g_scanner_set_scope(scanner, WH_COMMAND_SCOPE_DIRECTION);
-    if ( g_scanner_get_next_token(scanner) != G_TOKEN_SYMBOL )
+    switch ( g_scanner_get_next_token(scanner) )
+    {
+    case G_TOKEN_SYMBOL:
+    break;
+    case G_TOKEN_EOF:
+        return WH_COMMAND_TARGET_TYPE_NONE;
+    default:
         return WH_COMMAND_TARGET_TYPE_ERROR;
+    }
 
     switch ( scanner->value.v_int64 )
     {
@@ -179,6 +225,14 @@ _wh_command_parse_target(GScanner *scanner, WhCommand *self)
         break;
         }
     break;
+    case WH_DIRECTION_MARK:
+        if ( g_scanner_get_next_token(scanner) == G_TOKEN_STRING )
+            return WH_COMMAND_TARGET_TYPE_MARK;
+    break;
+    case WH_DIRECTION_GROUP:
+        if ( g_scanner_get_next_token(scanner) == G_TOKEN_STRING )
+            return WH_COMMAND_TARGET_TYPE_GROUP;
+    break;
     default:
         return WH_COMMAND_TARGET_TYPE_DIRECTION;
     }
@@ -218,6 +272,50 @@ _wh_command_parse_state_change(GScanner *scanner, WhCommand *self)
     return ( g_scanner_get_next_token(scanner) == G_TOKEN_SYMBOL );
 }
 
+static gboolean
+_wh_command_parse_criteria(GScanner *scanner, WhCommand *self)
+{
+    if ( g_scanner_peek_next_token(scanner) != G_TOKEN_LEFT_BRACE )
+        return TRUE;
+    g_scanner_get_next_token(scanner);
+
+    g_scanner_set_scope(scanner, WH_COMMAND_SCOPE_CRITERIA);
+    do
+    {
+        gchar **value;
+
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_SYMBOL )
+            return FALSE;
+
+        switch ( scanner->value.v_int64 )
+        {
+        case WH_CRITERIA_APP_ID:
+            value = &self->criteria.app_id;
+        break;
+        case WH_CRITERIA_TITLE:
+            value = &self->criteria.title;
+        break;
+        case WH_CRITERIA_MARK:
+            value = &self->criteria.mark;
+        break;
+        default:
+            g_return_val_if_reached(FALSE);
+        }
+
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_EQUAL_SIGN )
+            return FALSE;
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_STRING )
+            return FALSE;
+
+        g_free(*value);
+        *value = g_strdup(scanner->value.v_string);
+        self->has_criteria = TRUE;
+    } while ( g_scanner_peek_next_token(scanner) != G_TOKEN_RIGHT_BRACE );
+    g_scanner_get_next_token(scanner);
+
+    return self->has_criteria;
+}
+
 static gboolean
 _wh_command_parse_command(GScanner *scanner, WhCommand *self)
 {
@@ -240,6 +338,13 @@ _wh_command_parse_command(GScanner *scanner, WhCommand *self)
         {
         case WH_COMMAND_TARGET_TYPE_ERROR:
             return FALSE;
+        case WH_COMMAND_TARGET_TYPE_NONE:
+            self->closure = g_cclosure_new(G_CALLBACK(wh_surface_focus), NULL, NULL);
+            self->getter = WH_CORE_GETTER(wh_core_get_focus);
+            return TRUE;
+        case WH_COMMAND_TARGET_TYPE_MARK:
+            self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_focus_mark), NULL, NULL);
+        break;
         case WH_COMMAND_TARGET_TYPE_DIRECTION:
             self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_focus_container), NULL, NULL);
         break;
@@ -258,6 +363,9 @@ _wh_command_parse_command(GScanner *scanner, WhCommand *self)
         case WH_COMMAND_TARGET_TYPE_OUTPUT_NAME:
             self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_focus_output_name), NULL, NULL);
         break;
+        case WH_COMMAND_TARGET_TYPE_GROUP:
+            self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_focus_group), NULL, NULL);
+        break;
         }
         self->getter = WH_CORE_GETTER(wh_core_get_workspaces);
         return TRUE;
@@ -265,6 +373,9 @@ _wh_command_parse_command(GScanner *scanner, WhCommand *self)
         switch ( _wh_command_parse_target(scanner, self) )
         {
         case WH_COMMAND_TARGET_TYPE_ERROR:
+        case WH_COMMAND_TARGET_TYPE_NONE:
+        case WH_COMMAND_TARGET_TYPE_MARK:
+        case WH_COMMAND_TARGET_TYPE_GROUP:
             return FALSE;
         case WH_COMMAND_TARGET_TYPE_DIRECTION:
             self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_move_container), NULL, NULL);
@@ -310,6 +421,50 @@ _wh_command_parse_command(GScanner *scanner, WhCommand *self)
         self->closure = g_cclosure_new(G_CALLBACK(wh_outputs_control), NULL, NULL);
         self->getter = WH_CORE_GETTER(wh_core_get_outputs);
         return TRUE;
+    case WH_COMMAND_MARK:
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_STRING )
+            return FALSE;
+        self->closure = g_cclosure_new(G_CALLBACK(wh_surface_mark), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_focus);
+        return TRUE;
+    case WH_COMMAND_UNMARK:
+        switch ( g_scanner_get_next_token(scanner) )
+        {
+        case G_TOKEN_EOF:
+            self->closure = g_cclosure_new(G_CALLBACK(wh_surface_unmark_all), NULL, NULL);
+        break;
+        case G_TOKEN_STRING:
+            self->closure = g_cclosure_new(G_CALLBACK(wh_surface_unmark), NULL, NULL);
+        break;
+        default:
+            return FALSE;
+        }
+        self->getter = WH_CORE_GETTER(wh_core_get_focus);
+        return TRUE;
+    case WH_COMMAND_MODE:
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_STRING )
+            return FALSE;
+        self->closure = g_cclosure_new(G_CALLBACK(wh_bindings_switch_mode), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_bindings);
+        return TRUE;
+    case WH_COMMAND_RELOAD:
+        self->closure = g_cclosure_new(G_CALLBACK(wh_config_reload), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_config);
+        return TRUE;
+    case WH_COMMAND_KEYMAP:
+        if ( g_scanner_get_next_token(scanner) != G_TOKEN_STRING )
+            return FALSE;
+        self->closure = g_cclosure_new(G_CALLBACK(wh_keymaps_switch), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_keymaps);
+        return TRUE;
+    case WH_COMMAND_SAVE:
+        self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_save_layout), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_workspaces);
+        return TRUE;
+    case WH_COMMAND_RESTORE:
+        self->closure = g_cclosure_new(G_CALLBACK(wh_workspaces_restore_layout), NULL, NULL);
+        self->getter = WH_CORE_GETTER(wh_core_get_workspaces);
+        return TRUE;
     }
 
     return FALSE;
@@ -330,7 +485,7 @@ wh_command_parse(WhCommands *commands, gchar *string)
     g_value_init(&self->params[0], G_TYPE_POINTER);
     g_value_init(&self->params[1], G_TYPE_POINTER);
 
-    if ( ! _wh_command_parse_command(scanner, self) )
+    if ( ( ! _wh_command_parse_criteria(scanner, self) ) || ( ! _wh_command_parse_command(scanner, self) ) )
     {
         wh_command_free(self);
         return NULL;
@@ -373,16 +528,52 @@ wh_command_free(WhCommand *self)
         g_value_unset(&self->params[i]);
     if ( self->closure != NULL )
         g_closure_unref(self->closure);
+    g_free(self->criteria.mark);
+    g_free(self->criteria.title);
+    g_free(self->criteria.app_id);
     g_free(self->string);
 
     g_slice_free(WhCommand, self);
 }
 
+static void
+_wh_command_call_criteria(WhCommand *self, WhSeat *seat)
+{
+    WhCore *core = self->commands->core;
+    GList *surfaces, *surface;
+
+    surfaces = wh_workspaces_get_surfaces(wh_core_get_workspaces(core), &self->criteria);
+    for ( surface = surfaces ; surface != NULL ; surface = g_list_next(surface) )
+    {
+        gpointer target = surface->data;
+
+        /*
+         * Commands working on the current container
+         * need the matching surface to be focused first
+         */
+        if ( self->getter != WH_CORE_GETTER(wh_core_get_focus) )
+        {
+            wh_surface_focus(surface->data, seat);
+            target = ( self->getter != NULL ) ? self->getter(core) : core;
+        }
+        g_value_set_pointer(&self->params[0], target);
+        g_value_set_pointer(&self->params[1], seat);
+        g_closure_invoke(self->closure, NULL, self->n_params, self->params, NULL);
+    }
+    g_list_free(surfaces);
+}
+
 void
 wh_command_call(WhCommand *self, WhSeat *seat)
 {
     gpointer target;
 
+    if ( self->has_criteria )
+    {
+        _wh_command_call_criteria(self, seat);
+        return;
+    }
+
     if ( self->getter != NULL )
         target = self->getter(self->commands->core);
     else
@@ -425,6 +616,7 @@ wh_commands_new(WhCore *core)
     _wh_commands_add_symbols(self->scanner, WH_COMMAND_SCOPE_LAYOUT, _wh_commands_layout_types);
     _wh_commands_add_symbols(self->scanner, WH_COMMAND_SCOPE_ORIENTATION, _wh_commands_layout_orientations);
     _wh_commands_add_symbols(self->scanner, WH_COMMAND_SCOPE_STATE_CHANGE, _wh_commands_state_changes);
+    _wh_commands_add_symbols(self->scanner, WH_COMMAND_SCOPE_CRITERIA, _wh_commands_criteria);
 
     return self;
 }
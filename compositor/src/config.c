@@ -24,35 +24,52 @@
 
 #include <string.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <nkutils-enum.h>
 
+#include <xkbcommon/xkbcommon.h>
+
 #include <wayland-server.h>
 #include <libgwater-wayland-server.h>
 
 #include <compositor-wayland.h>
 #include <compositor-x11.h>
 #include <compositor-drm.h>
+#include <compositor-headless.h>
 #include <windowed-output-api.h>
 #include <libinput.h>
 
 #include "types.h"
 #include "wayhouse.h"
 #include "commands.h"
-#include "seats.h"
+#include "bindings.h"
+#include "keymaps.h"
+#include "outputs.h"
+#include "containers.h"
+#include "assigns.h"
+#include "autostart.h"
+#include "background.h"
+#include "repaint.h"
+#include "xwayland.h"
 #include "config_.h"
 
 struct _WhConfig {
     WhCore *core;
     struct xkb_rule_names xkb_names;
+    gchar **keymap_alternatives;
     struct wl_listener output_pending_listener;
+    gboolean (*output_configure)(WhConfig *self, struct weston_output *output);
     enum weston_compositor_backend backend;
     union {
         struct weston_drm_backend_config drm;
         struct weston_wayland_backend_config wayland;
         struct weston_x11_backend_config x11;
+        struct weston_headless_backend_config headless;
     } backend_config;
     union {
         const struct weston_windowed_output_api *windowed;
@@ -65,10 +82,48 @@ struct _WhConfig {
     GHashTable *outputs;
     GHashTable *output_aliases;
     gboolean xwayland;
+    gboolean restore_layout;
+    gboolean focus_follows_mouse;
+    gchar *background;
+    gchar **background_client;
     gchar **common_plugins;
-    GHashTable *assigns;
+    WhAssigns *assigns;
+    struct {
+        gchar *dir;
+        GHashTable *global;
+        GHashTable *outputs;
+    } sections;
+    struct {
+        GCancellable *cancellable;
+        gboolean running;
+        gboolean pending;
+        gboolean watch;
+        GFileMonitor *monitor;
+    } reload;
+    gint binding_timeout;
+    gint hotplug_delay;
+    gint repaint_margin;
+    gint focus_dwell;
+    gint xwayland_policy;
+    gint xwayland_idle_timeout;
+    struct {
+        gboolean recording;
+        GVariantBuilder keys;
+        GVariantBuilder buttons;
+        GVariantBuilder assigns;
+        GVariantBuilder autostart;
+        GVariantBuilder groups;
+    } cache;
 };
 
+typedef struct {
+    gchar *dir;
+    GKeyFile *global;
+    GHashTable *global_sections;
+    GKeyFile *outputs;
+    GHashTable *output_sections;
+} WhConfigFiles;
+
 typedef struct {
     gchar *name;
     gchar *modeline;
@@ -82,18 +137,6 @@ typedef struct {
     gint scale;
 } WhConfigOutputVirtual;
 
-typedef struct {
-    WhConfig *config;
-    enum {
-        WH_ACTION_COMMAND,
-        WH_ACTION_EXEC,
-    } type;
-    union {
-        WhCommand *command;
-        gchar **argv;
-    };
-} WhAction;
-
 typedef enum {
     WH_MODIFIER_CTRL,
     WH_MODIFIER_ALT,
@@ -108,18 +151,14 @@ static const gchar * const _wh_config_modifiers[] = {
     [WH_MODIFIER_SHIFT] = "shift",
 };
 
-static void
-_wh_config_workspace_config_free(gpointer data)
-{
-    WhWorkspaceConfig *self = data;
-    g_free(self->name);
-    g_slice_free(WhWorkspaceConfig, self);
-}
-
 static void
 _wh_config_output_drm_free(gpointer data)
 {
-    g_slice_free(WhConfigOutputDrm, data);
+    WhConfigOutputDrm *self = data;
+
+    g_free(self->modeline);
+
+    g_slice_free(WhConfigOutputDrm, self);
 }
 
 static void
@@ -128,11 +167,9 @@ _wh_config_output_virtual_free(gpointer data)
     g_slice_free(WhConfigOutputVirtual, data);
 }
 
-static void
-_wh_config_output_pending_drm(struct wl_listener *listener, void *data)
+static gboolean
+_wh_config_output_configure_drm(WhConfig *self, struct weston_output *woutput)
 {
-    WhConfig *self = wl_container_of(listener, self, output_pending_listener);
-    struct weston_output *woutput = data;
     const gchar *name = woutput->name;
     const gchar *alias;
     WhConfigOutputDrm *output;
@@ -145,21 +182,19 @@ _wh_config_output_pending_drm(struct wl_listener *listener, void *data)
     if ( output == NULL )
         output = g_hash_table_lookup(self->outputs, "default");
     if ( output == NULL )
-        return;
+        return FALSE;
 
     self->api.drm->set_mode(woutput, WESTON_DRM_BACKEND_OUTPUT_PREFERRED, output->modeline);
     self->api.drm->set_gbm_format(woutput, NULL);
     self->api.drm->set_seat(woutput, NULL);
     weston_output_set_scale(woutput, output->scale);
     weston_output_set_transform(woutput, WL_OUTPUT_TRANSFORM_NORMAL);
-    weston_output_enable(woutput);
+    return TRUE;
 }
 
-static void
-_wh_config_output_pending_virtual(struct wl_listener *listener, void *data)
+static gboolean
+_wh_config_output_configure_virtual(WhConfig *self, struct weston_output *woutput)
 {
-    WhConfig *self = wl_container_of(listener, self, output_pending_listener);
-    struct weston_output *woutput = data;
     const gchar *name = woutput->name;
     const gchar *alias;
     WhConfigOutputVirtual *output;
@@ -169,12 +204,23 @@ _wh_config_output_pending_virtual(struct wl_listener *listener, void *data)
         name = alias;
 
     output = g_hash_table_lookup(self->outputs, name);
-    g_return_if_fail(output != NULL);
+    if ( output == NULL )
+        return FALSE;
 
     weston_output_set_scale(woutput, output->scale);
     weston_output_set_transform(woutput, WL_OUTPUT_TRANSFORM_NORMAL);
     self->api.windowed->output_set_size(woutput, output->width, output->height);
-    weston_output_enable(woutput);
+    return TRUE;
+}
+
+static void
+_wh_config_output_pending(struct wl_listener *listener, void *data)
+{
+    WhConfig *self = wl_container_of(listener, self, output_pending_listener);
+    struct weston_output *woutput = data;
+
+    if ( self->output_configure(self, woutput) )
+        weston_output_enable(woutput);
 }
 
 static void
@@ -192,10 +238,53 @@ _wh_config_drm_input_configure(struct weston_compositor *compositor, struct libi
     }
 }
 
+static const gchar * const _wh_config_backend_names[] = {
+    "drm",
+    "wayland",
+    "x11",
+    "headless",
+};
+
+static const gchar * const _wh_config_xwayland_policies[_WH_XWAYLAND_POLICY_SIZE] = {
+    [WH_XWAYLAND_POLICY_ON_DEMAND] = "on-demand",
+    [WH_XWAYLAND_POLICY_PREWARM]   = "prewarm",
+};
+
+static const enum weston_compositor_backend _wh_config_backends[] = {
+    WESTON_BACKEND_DRM,
+    WESTON_BACKEND_WAYLAND,
+    WESTON_BACKEND_X11,
+    WESTON_BACKEND_HEADLESS,
+};
+
+static void
+_wh_config_global_reset(WhConfig *self)
+{
+    self->xwayland = FALSE;
+    self->reload.watch = FALSE;
+    self->restore_layout = FALSE;
+    self->focus_follows_mouse = FALSE;
+    /* Unset values let each module use its own default */
+    self->binding_timeout = 0;
+    self->hotplug_delay = -1;
+    self->repaint_margin = G_MININT;
+    self->focus_dwell = -1;
+    self->xwayland_policy = WH_XWAYLAND_POLICY_ON_DEMAND;
+    self->xwayland_idle_timeout = 0;
+
+    g_strfreev(self->common_plugins);
+    self->common_plugins = NULL;
+    g_free(self->background);
+    self->background = NULL;
+    g_strfreev(self->background_client);
+    self->background_client = NULL;
+}
+
 static void
-_wh_config_init(WhConfig *self, gboolean use_pixman)
+_wh_config_init(WhConfig *self, const gchar *backend, gboolean use_pixman)
 {
-    self->assigns = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_config_workspace_config_free);
+    self->assigns = wh_assigns_new();
+    _wh_config_global_reset(self);
 
     self->backend = WESTON_BACKEND_DRM;
     if ( g_getenv("WAYLAND_DISPLAY") != NULL )
@@ -203,6 +292,20 @@ _wh_config_init(WhConfig *self, gboolean use_pixman)
     else if ( g_getenv("DISPLAY") != NULL )
         self->backend = WESTON_BACKEND_X11;
 
+    if ( backend != NULL )
+    {
+        guint64 value;
+        if ( ! nk_enum_parse(backend, _wh_config_backend_names, G_N_ELEMENTS(_wh_config_backend_names), TRUE, FALSE, &value) )
+            g_warning("Unknown backend '%s', falling back to auto-detection", backend);
+#if LIBWESTON_MAJOR < 3
+        /* libweston 2 headless has no windowed output API to create outputs with */
+        else if ( _wh_config_backends[value] == WESTON_BACKEND_HEADLESS )
+            g_warning("Backend '%s' needs libweston 3, falling back to auto-detection", backend);
+#endif /* LIBWESTON_MAJOR < 3 */
+        else
+            self->backend = _wh_config_backends[value];
+    }
+
     struct weston_backend_config *base = &self->backend_config.drm.base;
     GDestroyNotify output_free = NULL;
     switch ( self->backend )
@@ -226,6 +329,12 @@ _wh_config_init(WhConfig *self, gboolean use_pixman)
         self->backend_config.x11.use_pixman = use_pixman;
         output_free = _wh_config_output_virtual_free;
     break;
+    case WESTON_BACKEND_HEADLESS:
+        base->struct_version = WESTON_HEADLESS_BACKEND_CONFIG_VERSION;
+        base->struct_size = sizeof(struct weston_headless_backend_config);
+        self->backend_config.headless.use_pixman = use_pixman;
+        output_free = _wh_config_output_virtual_free;
+    break;
     default:
         /* Not supported */
         g_return_if_reached();
@@ -233,6 +342,10 @@ _wh_config_init(WhConfig *self, gboolean use_pixman)
 
     self->output_aliases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
     self->outputs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, output_free);
+
+    self->sections.global = g_hash_table_new(g_str_hash, g_str_equal);
+    self->sections.outputs = g_hash_table_new(g_str_hash, g_str_equal);
+    self->reload.cancellable = g_cancellable_new();
 }
 
 #define _wh_config_define_getter(name, type, ...) static gint \
@@ -336,71 +449,20 @@ _wh_config_binding_parse_common(WhConfig *config, GKeyFile *file, const gchar *s
          && ( _wh_config_get_argv(file, section, "exec", &argv) != 0 ) )
         goto error;
 
-    WhAction *self;
-    self = g_new0(WhAction, 1);
-    self->config = config;
-
-    self->type = ( command != NULL ) ? WH_ACTION_COMMAND : WH_ACTION_EXEC;
-    switch ( self->type )
+    if ( command != NULL )
     {
-    case WH_ACTION_COMMAND:
-        self->command = command;
         g_debug("%s -> command %s", section, wh_command_get_string(command));
-    break;
-    case WH_ACTION_EXEC:
-        self->argv = argv;
-        g_debug("%s -> exec %s", section, argv[0]);
-        argv = NULL;
-    break;
+        return wh_action_new_command(config->core, command);
     }
 
-    return self;
+    g_debug("%s -> exec %s", section, argv[0]);
+    return wh_action_new_exec(config->core, argv);
 
 error:
     g_strfreev(argv);
     return NULL;
 }
 
-static void
-_wh_config_action_free(WhAction *self)
-{
-    switch ( self->type )
-    {
-    case WH_ACTION_COMMAND:
-        wh_command_free(self->command);
-    break;
-    case WH_ACTION_EXEC:
-        g_strfreev(self->argv);
-    break;
-    }
-
-    g_free(self);
-}
-
-static void
-_wh_config_action_trigger(WhAction *self, WhSeat *seat)
-{
-    switch ( self->type )
-    {
-    case WH_ACTION_COMMAND:
-        g_debug("command %s", wh_command_get_string(self->command));
-        wh_command_call(self->command, seat);
-    break;
-    case WH_ACTION_EXEC:
-        g_debug("exec %s", self->argv[0]);
-        g_spawn_async(NULL, self->argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL);
-    break;
-    }
-}
-
-static void
-_wh_config_keybind_callback(struct weston_keyboard *keyboard, uint32_t time, uint32_t key, void *user_data)
-{
-    WhAction *self = user_data;
-    WhSeat *seat = wh_seats_get_from_weston_seat(wh_core_get_seats(self->config->core), keyboard->seat);
-    _wh_config_action_trigger(self, seat);
-}
-
 static const gchar *
 _wh_config_binding_parse_key(const gchar *binding, enum weston_keyboard_modifier *modifiers)
 {
@@ -428,82 +490,217 @@ _wh_config_binding_parse_key(const gchar *binding, enum weston_keyboard_modifier
     return s;
 }
 
-static void
-_wh_config_binding_parse_keycode(WhConfig *self, GKeyFile *file, const gchar *section)
+static gboolean
+_wh_config_binding_parse_keycode(const gchar *binding, WhBindingKey *key)
+{
+    gchar *e;
+    guint64 code;
+
+    errno = 0;
+    code = g_ascii_strtoull(binding, &e, 10);
+    if ( ( errno != 0 ) || ( e == binding ) || ( *e != '\0' ) || ( code > G_MAXUINT32 ) )
+        return FALSE;
+
+    key->code = code;
+    key->keysym = FALSE;
+    return TRUE;
+}
+
+static gboolean
+_wh_config_binding_parse_keysym(const gchar *binding, WhBindingKey *key)
+{
+    xkb_keysym_t keysym;
+
+    keysym = xkb_keysym_from_name(binding, XKB_KEYSYM_NO_FLAGS);
+    if ( keysym == XKB_KEY_NoSymbol )
+        keysym = xkb_keysym_from_name(binding, XKB_KEYSYM_CASE_INSENSITIVE);
+    if ( keysym == XKB_KEY_NoSymbol )
+        return FALSE;
+
+    key->code = keysym;
+    key->keysym = TRUE;
+    return TRUE;
+}
+
+/*
+ * A key binding is a space-separated sequence of modifiers+key steps,
+ * e.g. [keysym super+w 3]
+ */
+static WhBindingKey *
+_wh_config_binding_parse_keys(const gchar *section, const gchar *binding, gboolean (*parse_key)(const gchar *binding, WhBindingKey *key), gsize *length)
 {
-    const gchar *binding = section + strlen("keycode ");
+    gchar **steps;
+    gsize i;
+    WhBindingKey *keys;
+
+    steps = g_strsplit(binding, " ", -1);
+    *length = g_strv_length(steps);
+    keys = g_new(WhBindingKey, MAX(*length, 1));
+
+    for ( i = 0 ; i < *length ; ++i )
+    {
+        enum weston_keyboard_modifier modifiers;
+        const gchar *key;
+
+        key = _wh_config_binding_parse_key(steps[i], &modifiers);
+        if ( ( key == NULL ) || ( ! parse_key(key, &keys[i]) ) )
+        {
+            g_warning("Invalid key %s in %s", steps[i], section);
+            g_strfreev(steps);
+            g_free(keys);
+            return NULL;
+        }
+        keys[i].modifiers = modifiers;
+    }
+    g_strfreev(steps);
+
+    return keys;
+}
 
-    enum weston_keyboard_modifier modifiers;
-    binding = _wh_config_binding_parse_key(binding, &modifiers);
+static gboolean
+_wh_config_binding_parse_button(const gchar *binding, enum weston_keyboard_modifier *modifiers, guint32 *button)
+{
+    binding = _wh_config_binding_parse_key(binding, modifiers);
 
     if ( binding == NULL )
-        return;
+        return FALSE;
 
     gchar *e;
-    guint64 key;
+    guint64 value;
 
     errno = 0;
-    key = g_ascii_strtoull(binding, &e, 10);
-    if ( ( errno != 0 ) || ( e == binding ) || ( *e != '\0' ) || ( key > G_MAXUINT32 ) )
-        return;
+    value = g_ascii_strtoull(binding, &e, 10);
+    if ( ( errno != 0 ) || ( e == binding ) || ( *e != '\0' ) || ( value > G_MAXUINT32 ) )
+        return FALSE;
 
-    WhAction *action;
-
-    action = _wh_config_binding_parse_common(self, file, section);
-    if ( action == NULL )
-        return;
-
-    weston_compositor_add_key_binding(wh_core_get_compositor(self->core), key, modifiers, _wh_config_keybind_callback, action);
+    *button = value;
+    return TRUE;
 }
 
-static void
-_wh_config_binding_parse_keysym(WhConfig *self, GKeyFile *file, const gchar *section)
+/*
+ * The cache stores what the binding parsing produced,
+ * so that a warm start only has to parse the commands
+ */
+static GVariant *
+_wh_config_cache_keys(const WhBindingKey *keys, gsize length)
 {
-    const gchar *binding = section + strlen("keysym ");
-    WhAction *action;
+    GVariantBuilder builder;
+    gsize i;
 
-    action = _wh_config_binding_parse_common(self, file, section);
-    if ( action == NULL )
-        return;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(uub)"));
+    for ( i = 0 ; i < length ; ++i )
+        g_variant_builder_add(&builder, "(uub)", keys[i].modifiers, keys[i].code, keys[i].keysym);
 
-    (void)binding;
-    _wh_config_action_free(action);
+    return g_variant_builder_end(&builder);
 }
 
-static void
-_wh_config_binding_mouse_callback(struct weston_pointer *pointer, uint32_t time, uint32_t key, void *user_data)
+static GVariant *
+_wh_config_cache_action(GKeyFile *file, const gchar *section)
 {
-    WhAction *self = user_data;
-    WhSeat *seat = wh_seats_get_from_weston_seat(wh_core_get_seats(self->config->core), pointer->seat);
-    _wh_config_action_trigger(self, seat);
+    static const gchar * const empty[] = { NULL };
+    gchar *command;
+    gchar **argv = NULL;
+    GVariant *action;
+
+    command = g_key_file_get_string(file, section, "command", NULL);
+    if ( command == NULL )
+        _wh_config_get_argv(file, section, "exec", &argv);
+
+    action = g_variant_new("(s^as)", ( command != NULL ) ? command : "", ( argv != NULL ) ? (const gchar * const *) argv : empty);
+
+    g_strfreev(argv);
+    g_free(command);
+
+    return action;
 }
 
+/*
+ * With a NULL file, the binding is removed
+ */
 static void
-_wh_config_binding_parse_mouse(WhConfig *self, GKeyFile *file, const gchar *section)
+_wh_config_binding_parse(WhConfig *self, GKeyFile *file, const gchar *section, const gchar *mode, const gchar *binding)
 {
-    const gchar *binding = section + strlen("mouse ");
-
-    enum weston_keyboard_modifier modifiers;
-    binding = _wh_config_binding_parse_key(binding, &modifiers);
+    WhBindings *bindings = wh_core_get_bindings(self->core);
+    gboolean (*parse_key)(const gchar *binding, WhBindingKey *key) = NULL;
+    gsize l = strlen(binding);
 
-    if ( binding == NULL )
+    if ( g_str_has_prefix(binding, "keycode ") && ( l > strlen("keycode ") ) )
+    {
+        binding += strlen("keycode ");
+        parse_key = _wh_config_binding_parse_keycode;
+    }
+    else if ( g_str_has_prefix(binding, "keysym ") && ( l > strlen("keysym ") ) )
+    {
+        binding += strlen("keysym ");
+        parse_key = _wh_config_binding_parse_keysym;
+    }
+    else if ( g_str_has_prefix(binding, "mouse ") && ( l > strlen("mouse ") ) )
+        binding += strlen("mouse ");
+    else
         return;
 
-    gchar *e;
-    guint64 button;
+    WhAction *action = NULL;
 
-    errno = 0;
-    button = g_ascii_strtoull(binding, &e, 10);
-    if ( ( errno != 0 ) || ( e == binding ) || ( *e != '\0' ) || ( button > G_MAXUINT32 ) )
-        return;
+    if ( parse_key != NULL )
+    {
+        WhBindingKey *keys;
+        gsize length;
+
+        keys = _wh_config_binding_parse_keys(section, binding, parse_key, &length);
+        if ( keys == NULL )
+            return;
+
+        if ( file == NULL )
+            wh_bindings_remove_keys(bindings, mode, keys, length);
+        else if ( ( action = _wh_config_binding_parse_common(self, file, section) ) != NULL )
+        {
+            if ( ! wh_bindings_add_keys(bindings, mode, keys, length, action) )
+            {
+                g_warning("Invalid key binding %s", section);
+                wh_action_free(action);
+            }
+            else if ( self->cache.recording )
+                g_variant_builder_add(&self->cache.keys, "(s@a(uub)@(sas))", mode, _wh_config_cache_keys(keys, length), _wh_config_cache_action(file, section));
+        }
+        g_free(keys);
+    }
+    else
+    {
+        enum weston_keyboard_modifier modifiers;
+        guint32 button;
+
+        if ( ! _wh_config_binding_parse_button(binding, &modifiers, &button) )
+            return;
 
-    WhAction *action;
+        if ( file == NULL )
+            wh_bindings_remove_button(bindings, mode, modifiers, button);
+        else if ( ( action = _wh_config_binding_parse_common(self, file, section) ) != NULL )
+        {
+            if ( ! wh_bindings_add_button(bindings, mode, modifiers, button, action) )
+            {
+                g_warning("Invalid mouse binding %s", section);
+                wh_action_free(action);
+            }
+            else if ( self->cache.recording )
+                g_variant_builder_add(&self->cache.buttons, "(suu@(sas))", mode, modifiers, button, _wh_config_cache_action(file, section));
+        }
+    }
+}
+
+static void
+_wh_config_mode_parse(WhConfig *self, GKeyFile *file, const gchar *section)
+{
+    const gchar *name = section + strlen("mode ");
+    const gchar *binding;
 
-    action = _wh_config_binding_parse_common(self, file, section);
-    if ( action == NULL )
+    binding = strchr(name, ' ');
+    if ( ( binding == NULL ) || ( binding == name ) )
         return;
 
-    weston_compositor_add_button_binding(wh_core_get_compositor(self->core), button, modifiers, _wh_config_binding_mouse_callback, action);
+    gchar *mode;
+    mode = g_strndup(name, binding - name);
+    _wh_config_binding_parse(self, file, section, mode, binding + 1);
+    g_free(mode);
 }
 
 static void
@@ -523,67 +720,293 @@ _wh_config_workspace_parse(WhConfig *self, GKeyFile *file, const gchar *section)
     }
 }
 
+/*
+ * [assign NAME] matches app-id and/or title patterns,
+ * with neither NAME is the literal app_id
+ */
 static void
 _wh_config_assign_parse(WhConfig *self, GKeyFile *file, const gchar *section)
 {
-    const gchar *app_id = section + strlen("assign ");
+    const gchar *name = section + strlen("assign ");
+
+    if ( file == NULL )
+    {
+        wh_assigns_remove(self->assigns, name);
+        return;
+    }
 
     guint64 number = WH_WORKSPACE_NO_NUMBER;
-    gchar *name = NULL;
+    gchar *workspace = NULL;
+    gchar *app_id = NULL;
+    gchar *title = NULL;
 
     if ( _wh_config_get_uint64(file, section, "number", &number) < 0 )
-        return;
-    if ( _wh_config_get_string(file, section, "name", &name) < 0 )
-        return;
+        goto end;
+    if ( _wh_config_get_string(file, section, "name", &workspace) < 0 )
+        goto end;
+    if ( _wh_config_get_string(file, section, "app-id", &app_id) < 0 )
+        goto end;
+    if ( _wh_config_get_string(file, section, "title", &title) < 0 )
+        goto end;
+
+    if ( ( number == WH_WORKSPACE_NO_NUMBER ) && ( workspace == NULL ) )
+        goto end;
+
+    if ( ( app_id == NULL ) && ( title == NULL ) )
+        app_id = g_strdup(name);
+
+    if ( ! wh_assigns_add(self->assigns, name, app_id, title, number, workspace) )
+        g_warning("Invalid assign %s", section);
+    else if ( self->cache.recording )
+        g_variant_builder_add(&self->cache.assigns, "(smsmstms)", name, app_id, title, number, workspace);
+
+end:
+    g_free(title);
+    g_free(app_id);
+    g_free(workspace);
+}
 
-    if ( ( number == WH_WORKSPACE_NO_NUMBER ) && ( name == NULL ) )
+static void
+_wh_config_autostart_parse(WhConfig *self, GKeyFile *file, const gchar *section)
+{
+    WhAutostart *autostart = wh_core_get_autostart(self->core);
+    const gchar *name = section + strlen("autostart ");
+
+    if ( file == NULL )
+    {
+        wh_autostart_remove(autostart, name);
         return;
+    }
+
+    gchar **argv = NULL;
+    gint stage = 0;
+    guint64 number = WH_WORKSPACE_NO_NUMBER;
+    gchar *workspace = NULL;
 
-    WhWorkspaceConfig *config;
+    if ( _wh_config_get_argv(file, section, "exec", &argv) != 0 )
+        goto end;
+    if ( _wh_config_get_integer(file, section, "stage", &stage) < 0 )
+        goto end;
+    if ( _wh_config_get_uint64(file, section, "number", &number) < 0 )
+        goto end;
+    if ( _wh_config_get_string(file, section, "name", &workspace) < 0 )
+        goto end;
 
-    config = g_slice_new(WhWorkspaceConfig);
-    config->number = number;
-    config->name = name;
+    if ( self->cache.recording )
+        g_variant_builder_add(&self->cache.autostart, "(s^asitms)", name, argv, stage, number, workspace);
+    wh_autostart_add(autostart, name, argv, stage, number, workspace);
+    argv = NULL;
 
-    g_hash_table_insert(self->assigns, g_strdup(app_id), config);
+end:
+    g_free(workspace);
+    g_strfreev(argv);
 }
 
 static void
-_wh_config_global_parse(WhConfig *self, GKeyFile *file)
+_wh_config_apply_sections(WhConfig *self, GKeyFile *file, GHashTable *sections, GHashTable **current, void (*apply)(WhConfig *self, GKeyFile *file, const gchar *section), GHashTable *changed)
 {
-    if ( g_key_file_has_group(file, "wayhouse") )
+    GHashTableIter iter;
+    const gchar *section, *content;
+
+    /* Gone or changed sections are removed first */
+    g_hash_table_iter_init(&iter, *current);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &section, (gpointer *) &content) )
     {
-        _wh_config_get_boolean(file, "wayhouse", "xwayland", &self->xwayland);
-        _wh_config_get_string_list(file, "wayhouse", "common-plugins", &self->common_plugins);
+        if ( g_strcmp0(content, g_hash_table_lookup(sections, section)) == 0 )
+            continue;
+        apply(self, NULL, section);
+        if ( changed != NULL )
+            g_hash_table_add(changed, g_strdup(section));
     }
-    if ( g_key_file_has_group(file, "keymap") )
+
+    if ( file != NULL )
     {
-        _wh_config_get_string(file, "keymap", "layout", (gchar **) &self->xkb_names.layout);
-        _wh_config_get_string(file, "keymap", "variant", (gchar **) &self->xkb_names.variant);
+        gchar **groups, **group;
+        groups = g_key_file_get_groups(file, NULL);
+        for ( group = groups ; *group != NULL ; ++group )
+        {
+            if ( g_strcmp0(g_hash_table_lookup(*current, *group), g_hash_table_lookup(sections, *group)) == 0 )
+                continue;
+            apply(self, file, *group);
+            if ( changed != NULL )
+                g_hash_table_add(changed, g_strdup(*group));
+        }
+        g_strfreev(groups);
     }
 
-    gchar **groups;
-    groups = g_key_file_get_groups(file, NULL);
-    if ( groups == NULL )
+    g_hash_table_unref(*current);
+    *current = g_hash_table_ref(sections);
+}
+
+static void
+_wh_config_keymap_parse(WhConfig *self, GKeyFile *file)
+{
+    gchar *layout = NULL;
+    gchar *variant = NULL;
+
+    g_strfreev(self->keymap_alternatives);
+    self->keymap_alternatives = NULL;
+    if ( ( file != NULL ) && g_key_file_has_group(file, "keymap") )
+    {
+        _wh_config_get_string(file, "keymap", "layout", &layout);
+        _wh_config_get_string(file, "keymap", "variant", &variant);
+        _wh_config_get_string_list(file, "keymap", "alternatives", &self->keymap_alternatives);
+    }
+
+    if ( ( g_strcmp0(layout, self->xkb_names.layout) == 0 ) && ( g_strcmp0(variant, self->xkb_names.variant) == 0 ) )
+    {
+        g_free(variant);
+        g_free(layout);
         return;
+    }
 
-    gchar **group;
-    for ( group = groups ; *group != NULL ; ++group )
+    if ( self->output_configure == NULL )
+    {
+        /* Not yet given to weston */
+        g_free((gchar *) self->xkb_names.layout);
+        g_free((gchar *) self->xkb_names.variant);
+        self->xkb_names.layout = layout;
+        self->xkb_names.variant = variant;
+        return;
+    }
+
+    /*
+     * weston owns the names we gave it (and the defaults it filled in),
+     * so we free its copy before handing the new ones
+     */
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    g_free((gchar *) compositor->xkb_names.rules);
+    g_free((gchar *) compositor->xkb_names.model);
+    g_free((gchar *) compositor->xkb_names.layout);
+    g_free((gchar *) compositor->xkb_names.variant);
+    g_free((gchar *) compositor->xkb_names.options);
+    self->xkb_names.layout = layout;
+    self->xkb_names.variant = variant;
+    weston_compositor_set_xkb_rule_names(compositor, &self->xkb_names);
+
+    struct xkb_keymap *keymap;
+    keymap = wh_keymaps_get(wh_core_get_keymaps(self->core), &compositor->xkb_names);
+    if ( keymap == NULL )
+        return;
+
+    struct weston_seat *seat;
+    wl_list_for_each(seat, &compositor->seat_list, link)
     {
-        gsize l = strlen(*group);
-        if ( g_str_has_prefix(*group, "keycode ") && ( l > strlen("keycode ") ) )
-            _wh_config_binding_parse_keycode(self, file, *group);
-        else if ( g_str_has_prefix(*group, "keysym ") && ( l > strlen("keysym ") ) )
-            _wh_config_binding_parse_keysym(self, file, *group);
-        else if ( g_str_has_prefix(*group, "mouse ") && ( l > strlen("mouse ") ) )
-            _wh_config_binding_parse_mouse(self, file, *group);
-        else if ( g_str_has_prefix(*group, "workspace ") && ( l > strlen("workspace ") ) )
-            _wh_config_workspace_parse(self, file, *group);
-        else if ( g_str_has_prefix(*group, "assign ") && ( l > strlen("assign ") ) )
-            _wh_config_assign_parse(self, file, *group);
-        g_free(*group);
+        if ( weston_seat_get_keyboard(seat) != NULL )
+            weston_seat_update_keymap(seat, keymap);
     }
-    g_free(groups);
+}
+
+/*
+ * [group NAME] lists workspaces to show together,
+ * optionally with the output to create each of them on
+ */
+static void
+_wh_config_group_parse(WhConfig *self, GKeyFile *file, const gchar *section)
+{
+    static const gchar * const empty[] = { NULL };
+    WhWorkspaces *workspaces = wh_core_get_workspaces(self->core);
+    const gchar *name = section + strlen("group ");
+
+    if ( file == NULL )
+    {
+        wh_workspaces_remove_group(workspaces, name);
+        return;
+    }
+
+    gchar **members = NULL;
+    gchar **outputs = NULL;
+
+    if ( _wh_config_get_string_list(file, section, "workspaces", &members) != 0 )
+        goto end;
+    if ( _wh_config_get_string_list(file, section, "outputs", &outputs) < 0 )
+        goto end;
+
+    if ( self->cache.recording )
+        g_variant_builder_add(&self->cache.groups, "(s^as^as)", name, members, ( outputs != NULL ) ? (const gchar * const *) outputs : empty);
+    wh_workspaces_add_group(workspaces, name, members, outputs);
+    members = outputs = NULL;
+
+end:
+    g_strfreev(outputs);
+    g_strfreev(members);
+}
+
+static void
+_wh_config_global_section(WhConfig *self, GKeyFile *file, const gchar *section)
+{
+    gsize l = strlen(section);
+    if ( g_str_has_prefix(section, "mode ") && ( l > strlen("mode ") ) )
+        _wh_config_mode_parse(self, file, section);
+    else if ( g_str_has_prefix(section, "workspace ") && ( l > strlen("workspace ") ) )
+    {
+        if ( file != NULL )
+            _wh_config_workspace_parse(self, file, section);
+    }
+    else if ( g_str_has_prefix(section, "assign ") && ( l > strlen("assign ") ) )
+        _wh_config_assign_parse(self, file, section);
+    else if ( g_str_has_prefix(section, "autostart ") && ( l > strlen("autostart ") ) )
+        _wh_config_autostart_parse(self, file, section);
+    else if ( g_str_has_prefix(section, "group ") && ( l > strlen("group ") ) )
+        _wh_config_group_parse(self, file, section);
+    else
+        _wh_config_binding_parse(self, file, section, WH_BINDINGS_DEFAULT_MODE, section);
+}
+
+static void
+_wh_config_global_parse(WhConfig *self, GKeyFile *file, GHashTable *sections)
+{
+    /* Keys removed on reload go back to their defaults */
+    _wh_config_global_reset(self);
+
+    if ( ( file != NULL ) && g_key_file_has_group(file, "wayhouse") )
+    {
+        _wh_config_get_boolean(file, "wayhouse", "xwayland", &self->xwayland);
+        _wh_config_get_string_list(file, "wayhouse", "common-plugins", &self->common_plugins);
+        _wh_config_get_boolean(file, "wayhouse", "watch-config", &self->reload.watch);
+        _wh_config_get_boolean(file, "wayhouse", "restore-layout", &self->restore_layout);
+        _wh_config_get_boolean(file, "wayhouse", "focus-follows-mouse", &self->focus_follows_mouse);
+        _wh_config_get_string(file, "wayhouse", "background", &self->background);
+        _wh_config_get_argv(file, "wayhouse", "background-client", &self->background_client);
+
+        gint timeout;
+        if ( ( _wh_config_get_integer(file, "wayhouse", "binding-timeout", &timeout) == 0 ) && ( timeout > 0 ) )
+            self->binding_timeout = timeout;
+
+        gint delay;
+        if ( ( _wh_config_get_integer(file, "wayhouse", "hotplug-delay", &delay) == 0 ) && ( delay >= 0 ) )
+            self->hotplug_delay = delay;
+
+        gint margin;
+        if ( _wh_config_get_integer(file, "wayhouse", "repaint-margin", &margin) == 0 )
+            self->repaint_margin = margin;
+
+        gint dwell;
+        if ( ( _wh_config_get_integer(file, "wayhouse", "focus-dwell", &dwell) == 0 ) && ( dwell >= 0 ) )
+            self->focus_dwell = dwell;
+
+        guint64 policy;
+        if ( _wh_config_get_enum(file, "wayhouse", "xwayland-policy", _wh_config_xwayland_policies, G_N_ELEMENTS(_wh_config_xwayland_policies), &policy) == 0 )
+            self->xwayland_policy = policy;
+
+        gint idle;
+        if ( ( _wh_config_get_integer(file, "wayhouse", "xwayland-idle-timeout", &idle) == 0 ) && ( idle >= 0 ) )
+            self->xwayland_idle_timeout = idle;
+    }
+
+    if ( wh_core_get_background(self->core) != NULL )
+        wh_background_set_colour(wh_core_get_background(self->core), self->background);
+    wh_bindings_set_timeout(wh_core_get_bindings(self->core), self->binding_timeout);
+    wh_outputs_set_hotplug_delay(wh_core_get_outputs(self->core), self->hotplug_delay);
+    if ( wh_core_get_repaint(self->core) != NULL )
+        wh_repaint_set_margin(wh_core_get_repaint(self->core), self->repaint_margin);
+    wh_xwayland_set_idle_timeout(wh_core_get_xwayland(self->core), self->xwayland_idle_timeout);
+
+    _wh_config_keymap_parse(self, file);
+    if ( wh_core_get_keymaps(self->core) != NULL )
+        wh_keymaps_set_alternatives(wh_core_get_keymaps(self->core), (const gchar * const *) self->keymap_alternatives);
+
+    _wh_config_apply_sections(self, file, sections, &self->sections.global, _wh_config_global_section, NULL);
 }
 
 static void
@@ -660,112 +1083,730 @@ _wh_config_output_parse_virtual(WhConfig *self, GKeyFile *file, const gchar *sec
     g_hash_table_insert(self->outputs, output->name, output);
 }
 
-static void
-_wh_config_output_parse_all(WhConfig *self, GKeyFile *file)
+static const gchar *
+_wh_config_output_prefix(WhConfig *self)
 {
-    gchar **groups;
-    groups = g_key_file_get_groups(file, NULL);
-    if ( groups == NULL )
-        return;
-
-    const gchar *prefix;
-    gsize l;
-    void (*parse)(WhConfig *self, GKeyFile *file, const gchar *section);
     switch ( self->backend )
     {
     case WESTON_BACKEND_DRM:
-        prefix = "drm ";
-        l = strlen("drm ");
-        parse = _wh_config_output_parse_drm;
-    break;
+        return "drm ";
     case WESTON_BACKEND_WAYLAND:
     case WESTON_BACKEND_X11:
-        prefix = "virtual ";
-        l = strlen("virtual ");
-        parse = _wh_config_output_parse_virtual;
-    break;
+    case WESTON_BACKEND_HEADLESS:
+        return "virtual ";
     default:
-        g_return_if_reached();
+        g_return_val_if_reached(NULL);
     }
+}
 
-    gchar **group;
-    for ( group = groups ; *group != NULL ; ++group )
-    {
-        if ( g_str_has_prefix(*group, prefix) && ( strlen(*group) > l ) )
-            parse(self, file, *group);
-        g_free(*group);
+static void
+_wh_config_output_section(WhConfig *self, GKeyFile *file, const gchar *section)
+{
+    const gchar *prefix = _wh_config_output_prefix(self);
+    gsize l = strlen(prefix);
+
+    if ( ( ! g_str_has_prefix(section, prefix) ) || ( strlen(section) <= l ) )
+        return;
+
+    if ( file == NULL )
+    {
+        g_hash_table_remove(self->outputs, section + l);
+        g_hash_table_remove(self->output_aliases, section + l);
+        return;
+    }
+
+    switch ( self->backend )
+    {
+    case WESTON_BACKEND_DRM:
+        _wh_config_output_parse_drm(self, file, section);
+    break;
+    case WESTON_BACKEND_WAYLAND:
+    case WESTON_BACKEND_X11:
+    case WESTON_BACKEND_HEADLESS:
+        _wh_config_output_parse_virtual(self, file, section);
+    break;
+    default:
+        g_return_if_reached();
+    }
+}
+
+static gboolean
+_wh_config_output_changed(WhConfig *self, GHashTable *changed, const gchar *name)
+{
+    gchar *section;
+    gboolean ret;
+
+    section = g_strconcat(_wh_config_output_prefix(self), name, NULL);
+    ret = g_hash_table_contains(changed, section);
+    g_free(section);
+
+    return ret;
+}
+
+static gboolean
+_wh_config_output_exists(struct weston_compositor *compositor, const gchar *name)
+{
+    struct weston_output *woutput;
+
+    wl_list_for_each(woutput, &compositor->output_list, link)
+    {
+        if ( g_strcmp0(woutput->name, name) == 0 )
+            return TRUE;
+    }
+    wl_list_for_each(woutput, &compositor->pending_output_list, link)
+    {
+        if ( g_strcmp0(woutput->name, name) == 0 )
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Only the enabled outputs whose section (or alias, or the default one
+ * they fall back to) changed are cycled through a disable/enable
+ */
+static void
+_wh_config_output_reconfigure(WhConfig *self, GHashTable *changed)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    WhOutputs *outputs = wh_core_get_outputs(self->core);
+    gboolean default_changed = _wh_config_output_changed(self, changed, "default");
+    struct weston_output *woutput;
+    GList *affected = NULL, *link;
+
+    wl_list_for_each(woutput, &compositor->output_list, link)
+    {
+        const gchar *name = woutput->name;
+        const gchar *alias;
+        gboolean affect;
+
+        affect = _wh_config_output_changed(self, changed, name);
+        alias = g_hash_table_lookup(self->output_aliases, name);
+        if ( alias != NULL )
+        {
+            affect = affect || _wh_config_output_changed(self, changed, alias);
+            name = alias;
+        }
+        if ( default_changed && ( ! g_hash_table_contains(self->outputs, name) ) )
+            affect = TRUE;
+
+        if ( affect )
+            affected = g_list_prepend(affected, woutput);
+    }
+
+    for ( link = affected ; link != NULL ; link = g_list_next(link) )
+    {
+        woutput = link->data;
+        g_debug("Reconfigure output %s", woutput->name);
+        wh_outputs_control(outputs, NULL, WH_STATE_DISABLE, woutput->name);
+        if ( self->output_configure(self, woutput) )
+            wh_outputs_control(outputs, NULL, WH_STATE_ENABLE, woutput->name);
+    }
+    g_list_free(affected);
+
+    if ( self->backend == WESTON_BACKEND_DRM )
+        return;
+
+    GHashTableIter iter;
+    const gchar *name;
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &name, NULL) )
+    {
+        if ( _wh_config_output_changed(self, changed, name) && ( ! _wh_config_output_exists(compositor, name) ) )
+            self->api.windowed->output_create(compositor, name);
     }
-    g_free(groups);
 }
 
 static void
-_wh_config_load_file(WhConfig *self, const gchar *dir, const gchar *filename, void (*parse)(WhConfig *self, GKeyFile *file))
+_wh_config_output_parse_all(WhConfig *self, GKeyFile *file, GHashTable *sections)
+{
+    GHashTable *changed;
+
+    changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    _wh_config_apply_sections(self, file, sections, &self->sections.outputs, _wh_config_output_section, changed);
+
+    if ( ( self->output_configure != NULL ) && ( g_hash_table_size(changed) > 0 ) )
+        _wh_config_output_reconfigure(self, changed);
+    g_hash_table_unref(changed);
+}
+
+/*
+ * Everything down to _wh_config_files_load() may run in a thread,
+ * so it must not touch the WhConfig
+ */
+static GHashTable *
+_wh_config_files_sections(GKeyFile *file)
+{
+    GHashTable *sections;
+
+    sections = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    if ( file == NULL )
+        return sections;
+
+    gchar **groups, **group;
+    groups = g_key_file_get_groups(file, NULL);
+    for ( group = groups ; *group != NULL ; ++group )
+    {
+        GString *content;
+        gchar **keys, **key;
+
+        content = g_string_new("");
+        keys = g_key_file_get_keys(file, *group, NULL, NULL);
+        for ( key = keys ; ( key != NULL ) && ( *key != NULL ) ; ++key )
+        {
+            gchar *value;
+            value = g_key_file_get_value(file, *group, *key, NULL);
+            g_string_append_printf(content, "%s=%s\n", *key, value);
+            g_free(value);
+        }
+        g_strfreev(keys);
+
+        g_hash_table_insert(sections, *group, g_string_free(content, FALSE));
+    }
+    g_free(groups);
+
+    return sections;
+}
+
+static GKeyFile *
+_wh_config_files_load_file(const gchar *dir, const gchar *filename, GHashTable **sections)
 {
+    GKeyFile *file = NULL;
     gchar *path;
     GError *error = NULL;
 
-    path = g_build_filename(dir, filename, NULL);
-    if ( ! g_file_test(path, G_FILE_TEST_IS_REGULAR) )
+    if ( dir == NULL )
         goto end;
 
-    GKeyFile *file;
-
-    file = g_key_file_new();
-    if ( g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, &error) )
-        parse(self, file);
-    else
-        g_warning("Could not load '%s': %s", path, error->message);
-    g_key_file_unref(file);
+    path = g_build_filename(dir, filename, NULL);
+    if ( g_file_test(path, G_FILE_TEST_IS_REGULAR) )
+    {
+        file = g_key_file_new();
+        if ( ! g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, &error) )
+        {
+            g_warning("Could not load '%s': %s", path, error->message);
+            g_clear_error(&error);
+            g_key_file_unref(file);
+            file = NULL;
+        }
+    }
+    g_free(path);
 
 end:
-    g_clear_error(&error);
-    g_free(path);
+    *sections = _wh_config_files_sections(file);
+    return file;
 }
 
-static gboolean
-_wh_config_load_dir(WhConfig *self, const gchar *dirbase)
+static void
+_wh_config_files_free(gpointer data)
+{
+    WhConfigFiles *self = data;
+
+    g_hash_table_unref(self->output_sections);
+    if ( self->outputs != NULL )
+        g_key_file_unref(self->outputs);
+    g_hash_table_unref(self->global_sections);
+    if ( self->global != NULL )
+        g_key_file_unref(self->global);
+    g_free(self->dir);
+
+    g_slice_free(WhConfigFiles, self);
+}
+
+static gchar *
+_wh_config_files_find_dir(const gchar *dirbase)
 {
-    gboolean found = FALSE;
     gchar *dir;
 
     dir = g_build_filename(dirbase, PACKAGE_NAME, NULL);
-    if ( ! g_file_test(dir, G_FILE_TEST_IS_DIR) )
-        goto end;
+    if ( g_file_test(dir, G_FILE_TEST_IS_DIR) )
+        return dir;
+
+    g_free(dir);
+    return NULL;
+}
 
-    _wh_config_load_file(self, dir, PACKAGE_NAME ".conf", _wh_config_global_parse);
-    _wh_config_load_file(self, dir, "outputs.conf", _wh_config_output_parse_all);
+static gchar *
+_wh_config_files_get_dir(void)
+{
+    gchar *dir;
 
-    found = TRUE;
+    dir = _wh_config_files_find_dir(g_get_user_config_dir());
 
-end:
-    g_free(dir);
-    return found;
+    const gchar * const *system_dir;
+    for ( system_dir = g_get_system_config_dirs() ; ( dir == NULL ) && ( *system_dir != NULL ) ; ++system_dir )
+        dir = _wh_config_files_find_dir(*system_dir);
+
+    return dir;
+}
+
+static WhConfigFiles *
+_wh_config_files_load(void)
+{
+    WhConfigFiles *self;
+
+    self = g_slice_new0(WhConfigFiles);
+
+    self->dir = _wh_config_files_get_dir();
+    self->global = _wh_config_files_load_file(self->dir, PACKAGE_NAME ".conf", &self->global_sections);
+    self->outputs = _wh_config_files_load_file(self->dir, "outputs.conf", &self->output_sections);
+
+    return self;
+}
+
+static void
+_wh_config_monitor_changed(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event, gpointer user_data)
+{
+    WhConfig *self = user_data;
+
+    switch ( event )
+    {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    break;
+    default:
+        return;
+    }
+
+    gchar *name;
+    name = g_file_get_basename(file);
+    if ( ( g_strcmp0(name, PACKAGE_NAME ".conf") == 0 ) || ( g_strcmp0(name, "outputs.conf") == 0 ) )
+        wh_config_reload(self, NULL);
+    g_free(name);
 }
 
 static void
-_wh_config_load(WhConfig *self)
+_wh_config_watch(WhConfig *self, gboolean dir_changed)
 {
-    if ( _wh_config_load_dir(self, g_get_user_config_dir()) )
+    if ( ( self->reload.monitor != NULL ) && ( dir_changed || ( ! self->reload.watch ) ) )
+    {
+        g_file_monitor_cancel(self->reload.monitor);
+        g_clear_object(&self->reload.monitor);
+    }
+
+    if ( ( self->reload.monitor != NULL ) || ( ! self->reload.watch ) || ( self->sections.dir == NULL ) )
         return;
 
-    const gchar * const *system_dir;
-    for ( system_dir = g_get_system_config_dirs() ; *system_dir != NULL ; ++system_dir )
+    GFile *dir;
+    GError *error = NULL;
+
+    dir = g_file_new_for_path(self->sections.dir);
+    self->reload.monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, &error);
+    g_object_unref(dir);
+
+    if ( self->reload.monitor == NULL )
     {
-        if ( _wh_config_load_dir(self, *system_dir) )
-            return;
+        g_warning("Could not watch '%s': %s", self->sections.dir, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_signal_connect(self->reload.monitor, "changed", G_CALLBACK(_wh_config_monitor_changed), self);
+}
+
+static void
+_wh_config_apply(WhConfig *self, WhConfigFiles *files)
+{
+    gboolean dir_changed = ( g_strcmp0(self->sections.dir, files->dir) != 0 );
+
+    g_free(self->sections.dir);
+    self->sections.dir = g_strdup(files->dir);
+
+    _wh_config_global_parse(self, files->global, files->global_sections);
+    _wh_config_output_parse_all(self, files->outputs, files->output_sections);
+
+    _wh_config_watch(self, dir_changed);
+}
+
+static void
+_wh_config_reload_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+    g_task_return_pointer(task, _wh_config_files_load(), _wh_config_files_free);
+}
+
+static void
+_wh_config_reload_callback(GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+    WhConfig *self = user_data;
+    WhConfigFiles *files;
+    GError *error = NULL;
+
+    files = g_task_propagate_pointer(G_TASK(result), &error);
+    if ( files == NULL )
+    {
+        /* Cancelled by wh_config_free(), so self is gone */
+        g_error_free(error);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    _wh_config_apply(self, files);
+    _wh_config_files_free(files);
+    g_debug("Configuration reloaded in %" G_GINT64_FORMAT "µs", g_get_monotonic_time() - start);
+
+    self->reload.running = FALSE;
+    if ( self->reload.pending )
+        wh_config_reload(self, NULL);
+}
+
+void
+wh_config_reload(WhConfig *self, WhSeat *seat)
+{
+    if ( self->reload.running )
+    {
+        self->reload.pending = TRUE;
+        return;
+    }
+    self->reload.running = TRUE;
+    self->reload.pending = FALSE;
+
+    GTask *task;
+
+    task = g_task_new(NULL, self->reload.cancellable, _wh_config_reload_callback, self);
+    g_task_run_in_thread(task, _wh_config_reload_thread);
+    g_object_unref(task);
+}
+
+/*
+ * The cache is a GVariant of everything the text configuration produced,
+ * keyed on the files identity so that any edit invalidates it
+ */
+#define WH_CONFIG_CACHE_VERSION 11
+#define WH_CONFIG_CACHE_TYPE "(ssmsa{ss}a{ss}(bbbbiiiiiiasmsmsasmsas)a(sa(uub)(sas))a(suu(sas))a(smsmstms)a(smsi)a(ss)a(siii)a(sasitms)a(sasas))"
+
+static gchar *
+_wh_config_cache_key(WhConfig *self, const gchar *dir)
+{
+    static const gchar * const filenames[] = { PACKAGE_NAME ".conf", "outputs.conf" };
+    GString *key;
+    gsize i;
+
+    key = g_string_new(NULL);
+    g_string_append_printf(key, "%d\n%d\n%s\n", WH_CONFIG_CACHE_VERSION, self->backend, ( dir != NULL ) ? dir : "");
+
+    for ( i = 0 ; ( dir != NULL ) && ( i < G_N_ELEMENTS(filenames) ) ; ++i )
+    {
+        gchar *path;
+        GStatBuf st;
+
+        /* Editors can save twice in the same second, seconds alone would miss the second one */
+        path = g_build_filename(dir, filenames[i], NULL);
+        if ( g_stat(path, &st) == 0 )
+            g_string_append_printf(key, "%s %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT ".%09ld %" G_GINT64_FORMAT "\n", filenames[i], (guint64) st.st_ino, (gint64) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec, (gint64) st.st_size);
+        g_free(path);
+    }
+
+    gchar *checksum;
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key->str, key->len);
+    g_string_free(key, TRUE);
+
+    return checksum;
+}
+
+static GHashTable *
+_wh_config_cache_get_sections(GVariant *cache, gsize index)
+{
+    GHashTable *sections;
+    GVariantIter *iter;
+    gchar *section, *content;
+
+    sections = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_variant_get_child(cache, index, "a{ss}", &iter);
+    while ( g_variant_iter_next(iter, "{ss}", &section, &content) )
+        g_hash_table_insert(sections, section, content);
+    g_variant_iter_free(iter);
+
+    return sections;
+}
+
+static GVariant *
+_wh_config_cache_sections(GHashTable *sections)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    const gchar *section, *content;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+    g_hash_table_iter_init(&iter, sections);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &section, (gpointer *) &content) )
+        g_variant_builder_add(&builder, "{ss}", section, content);
+
+    return g_variant_builder_end(&builder);
+}
+
+static WhAction *
+_wh_config_cache_get_action(WhConfig *self, GVariant *data)
+{
+    const gchar *string;
+    gchar **argv;
+
+    g_variant_get(data, "(&s^as)", &string, &argv);
+    g_variant_unref(data);
+
+    if ( *string != '\0' )
+    {
+        WhCommand *command;
+
+        g_strfreev(argv);
+        command = wh_command_parse(wh_core_get_commands(self->core), g_strdup(string));
+        if ( command == NULL )
+            return NULL;
+        return wh_action_new_command(self->core, command);
+    }
+
+    if ( argv[0] == NULL )
+    {
+        g_strfreev(argv);
+        return NULL;
+    }
+    return wh_action_new_exec(self->core, argv);
+}
+
+static void
+_wh_config_cache_apply(WhConfig *self, GVariant *cache)
+{
+    WhBindings *bindings = wh_core_get_bindings(self->core);
+    GVariantIter *iter;
+    const gchar *mode, *name;
+    GVariant *data;
+
+    g_variant_get_child(cache, 2, "ms", &self->sections.dir);
+    g_hash_table_unref(self->sections.global);
+    self->sections.global = _wh_config_cache_get_sections(cache, 3);
+    g_hash_table_unref(self->sections.outputs);
+    self->sections.outputs = _wh_config_cache_get_sections(cache, 4);
+
+    g_variant_get_child(cache, 5, "(bbbbiiiiii^asmsms^asms^as)", &self->xwayland, &self->reload.watch, &self->restore_layout, &self->focus_follows_mouse, &self->binding_timeout, &self->hotplug_delay, &self->repaint_margin, &self->focus_dwell, &self->xwayland_policy, &self->xwayland_idle_timeout, &self->common_plugins, (gchar **) &self->xkb_names.layout, (gchar **) &self->xkb_names.variant, &self->keymap_alternatives, &self->background, &self->background_client);
+    if ( self->binding_timeout > 0 )
+        wh_bindings_set_timeout(bindings, self->binding_timeout);
+    if ( self->hotplug_delay >= 0 )
+        wh_outputs_set_hotplug_delay(wh_core_get_outputs(self->core), self->hotplug_delay);
+
+    GVariant *steps;
+    g_variant_get_child(cache, 6, "a(sa(uub)(sas))", &iter);
+    while ( g_variant_iter_next(iter, "(&s@a(uub)@(sas))", &mode, &steps, &data) )
+    {
+        gsize length = g_variant_n_children(steps), i;
+        WhBindingKey *keys;
+        WhAction *action;
+
+        keys = g_new(WhBindingKey, MAX(length, 1));
+        for ( i = 0 ; i < length ; ++i )
+            g_variant_get_child(steps, i, "(uub)", &keys[i].modifiers, &keys[i].code, &keys[i].keysym);
+        g_variant_unref(steps);
+
+        action = _wh_config_cache_get_action(self, data);
+        if ( ( action != NULL ) && ( ! wh_bindings_add_keys(bindings, mode, keys, length, action) ) )
+            wh_action_free(action);
+        g_free(keys);
+    }
+    g_variant_iter_free(iter);
+
+    guint32 modifiers, button;
+    g_variant_get_child(cache, 7, "a(suu(sas))", &iter);
+    while ( g_variant_iter_next(iter, "(&suu@(sas))", &mode, &modifiers, &button, &data) )
+    {
+        WhAction *action;
+
+        action = _wh_config_cache_get_action(self, data);
+        if ( ( action != NULL ) && ( ! wh_bindings_add_button(bindings, mode, modifiers, button, action) ) )
+            wh_action_free(action);
+    }
+    g_variant_iter_free(iter);
+
+    const gchar *app_id, *title, *workspace;
+    guint64 number;
+    g_variant_get_child(cache, 8, "a(smsmstms)", &iter);
+    while ( g_variant_iter_next(iter, "(&sm&sm&stm&s)", &name, &app_id, &title, &number, &workspace) )
+        wh_assigns_add(self->assigns, name, app_id, title, number, workspace);
+    g_variant_iter_free(iter);
+
+    gchar *modeline;
+    gint width, height, scale;
+    g_variant_get_child(cache, 9, "a(smsi)", &iter);
+    while ( g_variant_iter_next(iter, "(&smsi)", &name, &modeline, &scale) )
+    {
+        WhConfigOutputDrm *output;
+        output = g_slice_new(WhConfigOutputDrm);
+        output->name = g_strdup(name);
+        output->modeline = modeline;
+        output->scale = scale;
+        g_hash_table_insert(self->outputs, output->name, output);
+    }
+    g_variant_iter_free(iter);
+
+    gchar *alias, *target;
+    g_variant_get_child(cache, 10, "a(ss)", &iter);
+    while ( g_variant_iter_next(iter, "(ss)", &alias, &target) )
+        g_hash_table_insert(self->output_aliases, alias, target);
+    g_variant_iter_free(iter);
+
+    g_variant_get_child(cache, 11, "a(siii)", &iter);
+    while ( g_variant_iter_next(iter, "(&siii)", &name, &width, &height, &scale) )
+    {
+        WhConfigOutputVirtual *output;
+        output = g_slice_new(WhConfigOutputVirtual);
+        output->name = g_strdup(name);
+        output->width = width;
+        output->height = height;
+        output->scale = scale;
+        g_hash_table_insert(self->outputs, output->name, output);
     }
+    g_variant_iter_free(iter);
+
+    WhAutostart *autostart = wh_core_get_autostart(self->core);
+    gchar **argv;
+    gint stage;
+    g_variant_get_child(cache, 12, "a(sasitms)", &iter);
+    while ( g_variant_iter_next(iter, "(&s^asitm&s)", &name, &argv, &stage, &number, &workspace) )
+        wh_autostart_add(autostart, name, argv, stage, number, workspace);
+    g_variant_iter_free(iter);
+
+    WhWorkspaces *workspaces = wh_core_get_workspaces(self->core);
+    gchar **members, **outputs;
+    g_variant_get_child(cache, 13, "a(sasas)", &iter);
+    while ( g_variant_iter_next(iter, "(&s^as^as)", &name, &members, &outputs) )
+        wh_workspaces_add_group(workspaces, name, members, outputs);
+    g_variant_iter_free(iter);
+}
+
+static gboolean
+_wh_config_cache_load(WhConfig *self, const gchar *path, const gchar *key)
+{
+    GMappedFile *file;
+    GBytes *bytes;
+    GVariant *cache;
+
+    file = g_mapped_file_new(path, FALSE, NULL);
+    if ( file == NULL )
+        return FALSE;
+
+    bytes = g_mapped_file_get_bytes(file);
+    g_mapped_file_unref(file);
+    cache = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(WH_CONFIG_CACHE_TYPE), bytes, FALSE));
+    g_bytes_unref(bytes);
+
+    const gchar *version, *cache_key;
+    gboolean valid;
+
+    g_variant_get_child(cache, 0, "&s", &version);
+    g_variant_get_child(cache, 1, "&s", &cache_key);
+    valid = ( g_strcmp0(version, WAYHOUSE_VERSION) == 0 ) && ( g_strcmp0(cache_key, key) == 0 );
+    if ( valid )
+        _wh_config_cache_apply(self, cache);
+    else
+        g_debug("Configuration cache '%s' is stale", path);
+
+    g_variant_unref(cache);
+
+    return valid;
+}
+
+static void
+_wh_config_cache_save(WhConfig *self, const gchar *path, const gchar *key)
+{
+    static const gchar * const empty[] = { NULL };
+    GVariantBuilder drm, aliases, virtual;
+    GHashTableIter iter;
+    const gchar *name;
+    gpointer value;
+
+    g_variant_builder_init(&drm, G_VARIANT_TYPE("a(smsi)"));
+    g_variant_builder_init(&aliases, G_VARIANT_TYPE("a(ss)"));
+    g_variant_builder_init(&virtual, G_VARIANT_TYPE("a(siii)"));
+
+    g_hash_table_iter_init(&iter, self->output_aliases);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &name, &value) )
+        g_variant_builder_add(&aliases, "(ss)", name, value);
+
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &name, &value) )
+    {
+        if ( self->backend == WESTON_BACKEND_DRM )
+        {
+            WhConfigOutputDrm *output = value;
+            g_variant_builder_add(&drm, "(smsi)", name, output->modeline, output->scale);
+        }
+        else
+        {
+            WhConfigOutputVirtual *output = value;
+            g_variant_builder_add(&virtual, "(siii)", name, output->width, output->height, output->scale);
+        }
+    }
+
+    GVariant *cache;
+    cache = g_variant_ref_sink(g_variant_new("(ssms@a{ss}@a{ss}(bbbbiiiiii^asmsms^asms^as)@a(sa(uub)(sas))@a(suu(sas))@a(smsmstms)@a(smsi)@a(ss)@a(siii)@a(sasitms)@a(sasas))",
+        WAYHOUSE_VERSION, key, self->sections.dir,
+        _wh_config_cache_sections(self->sections.global), _wh_config_cache_sections(self->sections.outputs),
+        self->xwayland, self->reload.watch, self->restore_layout, self->focus_follows_mouse, self->binding_timeout, self->hotplug_delay, self->repaint_margin, self->focus_dwell, self->xwayland_policy, self->xwayland_idle_timeout, ( self->common_plugins != NULL ) ? (const gchar * const *) self->common_plugins : empty, self->xkb_names.layout, self->xkb_names.variant, ( self->keymap_alternatives != NULL ) ? (const gchar * const *) self->keymap_alternatives : empty,
+        self->background, ( self->background_client != NULL ) ? (const gchar * const *) self->background_client : empty,
+        g_variant_builder_end(&self->cache.keys), g_variant_builder_end(&self->cache.buttons),
+        g_variant_builder_end(&self->cache.assigns), g_variant_builder_end(&drm), g_variant_builder_end(&aliases), g_variant_builder_end(&virtual),
+        g_variant_builder_end(&self->cache.autostart), g_variant_builder_end(&self->cache.groups)));
+
+    gchar *dir;
+    GError *error = NULL;
+
+    dir = g_path_get_dirname(path);
+    if ( g_mkdir_with_parents(dir, 0700) < 0 )
+        g_warning("Could not create the cache directory '%s': %s", dir, g_strerror(errno));
+    else if ( ! g_file_set_contents(path, g_variant_get_data(cache), g_variant_get_size(cache), &error) )
+    {
+        g_warning("Could not write the configuration cache '%s': %s", path, error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+
+    g_variant_unref(cache);
 }
 
 WhConfig *
-wh_config_new(WhCore *core, gboolean use_pixman)
+wh_config_new(WhCore *core, const gchar *backend, gboolean use_pixman, gboolean recompile)
 {
     WhConfig *self;
 
     self = g_new0(WhConfig, 1);
     self->core = core;
 
-    _wh_config_init(self, use_pixman);
-    _wh_config_load(self);
+    _wh_config_init(self, backend, use_pixman);
+
+    gint64 start = g_get_monotonic_time();
+    gchar *dir, *key, *path;
+
+    dir = _wh_config_files_get_dir();
+    key = _wh_config_cache_key(self, dir);
+    path = g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, "config.cache", NULL);
+
+    if ( ( ! recompile ) && _wh_config_cache_load(self, path, key) )
+    {
+        _wh_config_watch(self, TRUE);
+        g_debug("Configuration loaded from cache in %" G_GINT64_FORMAT "µs", g_get_monotonic_time() - start);
+    }
+    else
+    {
+        WhConfigFiles *files;
+
+        g_variant_builder_init(&self->cache.keys, G_VARIANT_TYPE("a(sa(uub)(sas))"));
+        g_variant_builder_init(&self->cache.buttons, G_VARIANT_TYPE("a(suu(sas))"));
+        g_variant_builder_init(&self->cache.assigns, G_VARIANT_TYPE("a(smsmstms)"));
+        g_variant_builder_init(&self->cache.autostart, G_VARIANT_TYPE("a(sasitms)"));
+        g_variant_builder_init(&self->cache.groups, G_VARIANT_TYPE("a(sasas)"));
+        self->cache.recording = TRUE;
+
+        files = _wh_config_files_load();
+        _wh_config_apply(self, files);
+        _wh_config_files_free(files);
+
+        self->cache.recording = FALSE;
+        g_debug("Configuration parsed in %" G_GINT64_FORMAT "µs", g_get_monotonic_time() - start);
+
+        _wh_config_cache_save(self, path, key);
+    }
+
+    g_free(path);
+    g_free(key);
+    g_free(dir);
 
     return self;
 }
@@ -773,7 +1814,23 @@ wh_config_new(WhCore *core, gboolean use_pixman)
 void
 wh_config_free(WhConfig *self)
 {
-    g_hash_table_unref(self->assigns);
+    g_cancellable_cancel(self->reload.cancellable);
+    g_object_unref(self->reload.cancellable);
+    if ( self->reload.monitor != NULL )
+    {
+        g_file_monitor_cancel(self->reload.monitor);
+        g_object_unref(self->reload.monitor);
+    }
+
+    g_hash_table_unref(self->sections.outputs);
+    g_hash_table_unref(self->sections.global);
+    g_free(self->sections.dir);
+
+    g_strfreev(self->keymap_alternatives);
+    g_strfreev(self->background_client);
+    g_free(self->background);
+    g_strfreev(self->common_plugins);
+    wh_assigns_free(self->assigns);
 
     g_hash_table_unref(self->outputs);
     g_hash_table_unref(self->output_aliases);
@@ -795,10 +1852,11 @@ wh_config_load_backend(WhConfig *self)
         if ( self->api.drm == NULL )
             return FALSE;
 
-        self->output_pending_listener.notify = _wh_config_output_pending_drm;
+        self->output_configure = _wh_config_output_configure_drm;
     break;
     case WESTON_BACKEND_X11:
     case WESTON_BACKEND_WAYLAND:
+    case WESTON_BACKEND_HEADLESS:
     {
         self->api.windowed = weston_windowed_output_get_api(compositor);
         if ( self->api.windowed == NULL )
@@ -810,13 +1868,14 @@ wh_config_load_backend(WhConfig *self)
         while ( g_hash_table_iter_next(&iter, (gpointer *) &name, NULL) )
             self->api.windowed->output_create(compositor, name);
 
-        self->output_pending_listener.notify = _wh_config_output_pending_virtual;
+        self->output_configure = _wh_config_output_configure_virtual;
     }
     break;
     default:
         g_return_val_if_reached(FALSE);
     }
 
+    self->output_pending_listener.notify = _wh_config_output_pending;
     wl_signal_add(&compositor->output_pending_signal, &self->output_pending_listener);
     weston_pending_output_coldplug(compositor);
 
@@ -835,14 +1894,68 @@ wh_config_get_xwayland(WhConfig *self)
     return self->xwayland;
 }
 
+const gchar *
+wh_config_get_background(WhConfig *self)
+{
+    return self->background;
+}
+
+gchar **
+wh_config_get_background_client(WhConfig *self)
+{
+    return self->background_client;
+}
+
+gboolean
+wh_config_get_restore_layout(WhConfig *self)
+{
+    return self->restore_layout;
+}
+
+gint
+wh_config_get_repaint_margin(WhConfig *self)
+{
+    return self->repaint_margin;
+}
+
+gboolean
+wh_config_get_focus_follows_mouse(WhConfig *self)
+{
+    return self->focus_follows_mouse;
+}
+
+gint
+wh_config_get_focus_dwell(WhConfig *self)
+{
+    return self->focus_dwell;
+}
+
+WhXwaylandPolicy
+wh_config_get_xwayland_policy(WhConfig *self)
+{
+    return self->xwayland_policy;
+}
+
+guint
+wh_config_get_xwayland_idle_timeout(WhConfig *self)
+{
+    return self->xwayland_idle_timeout;
+}
+
 const gchar * const *
 wh_config_get_common_plugins(WhConfig *self)
 {
     return (const gchar * const *) self->common_plugins;
 }
 
-const WhWorkspaceConfig *
-wh_config_get_assign(WhConfig *self, const gchar *app_id)
+const gchar * const *
+wh_config_get_keymap_alternatives(WhConfig *self)
+{
+    return (const gchar * const *) self->keymap_alternatives;
+}
+
+WhAssigns *
+wh_config_get_assigns(WhConfig *self)
 {
-    return g_hash_table_lookup(self->assigns, app_id);
+    return self->assigns;
 }
@@ -25,18 +25,28 @@
 
 #include "types.h"
 
-WhConfig *wh_config_new(WhCore *core, gboolean use_pixman);
+WhConfig *wh_config_new(WhCore *core, const gchar *backend, gboolean use_pixman, gboolean recompile);
 void wh_config_free(WhConfig *config);
 gboolean wh_config_load_backend(WhConfig *config);
+void wh_config_reload(WhConfig *config, WhSeat *seat);
 
 struct xkb_rule_names *wh_config_get_xkb_names(WhConfig *config);
 struct weston_backend_config *wh_config_get_drm_config(WhConfig *config);
 struct weston_backend_config *wh_config_get_wayland_config(WhConfig *config);
 struct weston_backend_config *wh_config_get_x11_config(WhConfig *config);
 gboolean wh_config_get_xwayland(WhConfig *config);
+gboolean wh_config_get_restore_layout(WhConfig *config);
+gint wh_config_get_repaint_margin(WhConfig *config);
+gboolean wh_config_get_focus_follows_mouse(WhConfig *config);
+gint wh_config_get_focus_dwell(WhConfig *config);
+WhXwaylandPolicy wh_config_get_xwayland_policy(WhConfig *config);
+guint wh_config_get_xwayland_idle_timeout(WhConfig *config);
+const gchar *wh_config_get_background(WhConfig *config);
+gchar **wh_config_get_background_client(WhConfig *config);
 const gchar * const *wh_config_get_common_plugins(WhConfig *config);
+const gchar * const *wh_config_get_keymap_alternatives(WhConfig *config);
 
 const WhWorkspaceConfig *wh_config_get_first_workspace(void);
-const WhWorkspaceConfig *wh_config_get_assign(WhConfig *config, const gchar *app_id);
+WhAssigns *wh_config_get_assigns(WhConfig *config);
 
 #endif /* __WAYHOUSE_CONFIG_H__ */
@@ -32,10 +32,19 @@
 #include "types.h"
 #include "wayhouse.h"
 #include "config_.h"
+#include "assigns.h"
 #include "seats.h"
 #include "outputs.h"
+#include "snapshot.h"
+#include "ipc.h"
+#include "autostart.h"
+#include "latency.h"
+#include "xwayland.h"
 #include "containers.h"
 
+/* Arrivals this close to each other share a single layout pass */
+#define WH_WORKSPACES_BATCH_DELAY 100
+
 struct _WhWorkspaces {
     WhCore *core;
     GHashTable *workspaces;
@@ -45,18 +54,43 @@ struct _WhWorkspaces {
     struct weston_layer layer;
     struct weston_layer fullscreen_layer;
     GQueue *history;
+    GHashTable *surfaces_by_app_id;
+    GHashTable *surfaces_by_title;
+    GHashTable *surfaces_by_mark;
+    GHashTable *placeholders_by_app_id;
+    GHashTable *placeholders_by_title;
+    GHashTable *groups;
+    guint64 next_id;
+    guint64 version;
+    gchar *serialised;
+    guint64 serialised_version;
+    struct {
+        gboolean enabled;
+        GHashTable *pending;
+        guint source;
+    } batch;
 };
 
 typedef enum {
     WH_CONTAINER_TYPE_CONTAINER = 0,
     WH_CONTAINER_TYPE_WORKSPACE,
     WH_CONTAINER_TYPE_SURFACE,
+    WH_CONTAINER_TYPE_PLACEHOLDER,
 } WhContainerType;
 
 #define WH_CONTAINER_IS_SURFACE(c) ((c)->type == WH_CONTAINER_TYPE_SURFACE)
 #define WH_CONTAINER_SURFACE(c) ((WhSurface *) (c))
 #define WH_CONTAINER_IS_WORKSPACE(c) ((c)->type == WH_CONTAINER_TYPE_WORKSPACE)
 #define WH_CONTAINER_WORKSPACE(c) ((WhWorkspace *) (c))
+#define WH_CONTAINER_IS_PLACEHOLDER(c) ((c)->type == WH_CONTAINER_TYPE_PLACEHOLDER)
+#define WH_CONTAINER_PLACEHOLDER(c) ((WhPlaceholder *) (c))
+
+static const gchar * const _wh_container_types[] = {
+    [WH_CONTAINER_TYPE_CONTAINER] = "con",
+    [WH_CONTAINER_TYPE_WORKSPACE] = "workspace",
+    [WH_CONTAINER_TYPE_SURFACE]   = "surface",
+    [WH_CONTAINER_TYPE_PLACEHOLDER] = "placeholder",
+};
 
 typedef enum {
     WH_CONTAINER_LAYOUT_TABBED_HORIZONTAL = ( WH_CONTAINER_LAYOUT_TABBED | ( WH_ORIENTATION_HORIZONTAL << 1 ) ),
@@ -69,12 +103,25 @@ typedef enum {
 #define  WH_CONTAINER_LAYOUT_IS_HORIZONTAL(l) (WH_CONTAINER_LAYOUT_GET_ORIENTATION(l) == WH_ORIENTATION_HORIZONTAL)
 #define  WH_CONTAINER_LAYOUT_IS_VERTICAL(l) (WH_CONTAINER_LAYOUT_GET_ORIENTATION(l) == WH_ORIENTATION_VERTICAL)
 
+static const gchar * const _wh_container_layouts[] = {
+    [WH_CONTAINER_LAYOUT_TABBED_HORIZONTAL] = "tabbedh",
+    [WH_CONTAINER_LAYOUT_TABBED_VERTICAL]   = "tabbedv",
+    [WH_CONTAINER_LAYOUT_SPLIT_HORIZONTAL]  = "splith",
+    [WH_CONTAINER_LAYOUT_SPLIT_VERTICAL]    = "splitv",
+};
+
 #define WH_DIRECTION_GET_TARGET(d) ((d >> 1) & 1)
 #define WH_DIRECTION_GET_ORIENTATION(d) ((d) & 1)
 
 struct _WhContainer {
     WhWorkspaces *workspaces;
     WhContainerType type;
+    guint64 id;
+
+    /* Bumped on any change in the subtree */
+    guint64 version;
+    gchar *serialised;
+    guint64 serialised_version;
 
     gboolean current;
     GQueue *children;
@@ -88,11 +135,25 @@ struct _WhContainer {
     struct weston_geometry geometry;
 };
 
+/*
+ * Hit-test grid
+ *
+ * The workspace area cut in a fixed number of cells, each listing the
+ * leaves overlapping it. Rebuilt lazily when the workspace version
+ * moved, so pointer lookups only look at a handful of leaves.
+ */
+#define WH_WORKSPACE_GRID_SIZE 16
+
 struct _WhWorkspace {
     WhContainer container;
     WhOutput *output;
     gchar *name;
     guint64 number;
+    gboolean resize_pending;
+    struct {
+        guint64 version;
+        GPtrArray *cells[WH_WORKSPACE_GRID_SIZE * WH_WORKSPACE_GRID_SIZE];
+    } grid;
 };
 
 
@@ -101,8 +162,74 @@ struct _WhSurface {
     struct weston_desktop_surface *desktop_surface;
     struct weston_surface *surface;
     struct weston_view *view;
+    gchar *app_id;
+    GList *app_id_link;
+    gchar *title;
+    GList *title_link;
+    GSList *marks;
 };
 
+/*
+ * Workspaces shown together, one per output,
+ * with an optional output to create each on
+ */
+typedef struct {
+    gchar **members;
+    gchar **outputs;
+} WhWorkspaceGroup;
+
+/*
+ * A reserved slot from a restored layout,
+ * waiting for a matching surface to take its place
+ */
+typedef struct {
+    WhContainer container;
+    gchar *app_id;
+    gchar *title;
+    GList *index_link;
+} WhPlaceholder;
+
+static void _wh_workspaces_tree_event(WhWorkspaces *self, const gchar *format, ...) G_GNUC_PRINTF(2, 3);
+static void
+_wh_workspaces_tree_event(WhWorkspaces *self, const gchar *format, ...)
+{
+    WhIpc *ipc = wh_core_get_ipc(self->core);
+    gchar *message;
+    va_list args;
+
+    if ( ! wh_ipc_has_subscribers(ipc, "tree") )
+        return;
+
+    va_start(args, format);
+    message = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    wh_ipc_broadcast(ipc, "tree", message);
+    g_free(message);
+}
+
+static void
+_wh_container_touch(WhContainer *self)
+{
+    WhContainer *con;
+    for ( con = self ; con != NULL ; con = con->parent )
+        ++con->version;
+    ++self->workspaces->version;
+}
+
+static gboolean
+_wh_container_set_geometry(WhContainer *self, struct weston_geometry geometry)
+{
+    if ( ( self->geometry.x == geometry.x ) && ( self->geometry.y == geometry.y ) && ( self->geometry.width == geometry.width ) && ( self->geometry.height == geometry.height ) )
+        return FALSE;
+
+    self->geometry = geometry;
+    _wh_container_touch(self);
+    _wh_workspaces_tree_event(self->workspaces, "{\"change\":\"geometry\",\"id\":%" G_GUINT64_FORMAT ",\"geometry\":[%d,%d,%d,%d]}", self->id, geometry.x, geometry.y, geometry.width, geometry.height);
+
+    return TRUE;
+}
+
 static void
 _wh_container_resize(WhContainer *self)
 {
@@ -147,11 +274,14 @@ _wh_container_resize(WhContainer *self)
     for ( child_ = g_queue_peek_head_link(self->children) ; child_ != NULL ; child_ = g_list_next(child_) )
     {
         WhContainer *child = child_->data;
-
-        child->geometry.x = x;
-        child->geometry.y = y;
-        child->geometry.width = width;
-        child->geometry.height = height;
+        struct weston_geometry geometry = {
+            .x = x,
+            .y = y,
+            .width = width,
+            .height = height,
+        };
+
+        _wh_container_set_geometry(child, geometry);
         _wh_container_resize(child);
 
         switch ( self->layout )
@@ -169,6 +299,66 @@ _wh_container_resize(WhContainer *self)
     }
 }
 
+static void
+_wh_workspaces_batch_flush(WhWorkspaces *self)
+{
+    GHashTableIter iter;
+    WhWorkspace *workspace;
+
+    if ( self->batch.source > 0 )
+        g_source_remove(self->batch.source);
+    self->batch.source = 0;
+
+    g_hash_table_iter_init(&iter, self->batch.pending);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &workspace, NULL) )
+    {
+        _wh_container_resize(&workspace->container);
+        g_hash_table_iter_remove(&iter);
+    }
+}
+
+static gboolean
+_wh_workspaces_batch_timeout(gpointer user_data)
+{
+    WhWorkspaces *self = user_data;
+
+    self->batch.source = 0;
+    _wh_workspaces_batch_flush(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static WhWorkspace *_wh_container_get_workspace(WhContainer *self);
+static gboolean
+_wh_workspaces_batch_add(WhWorkspaces *self, WhContainer *parent)
+{
+    if ( ! self->batch.enabled )
+        return FALSE;
+
+    g_hash_table_add(self->batch.pending, _wh_container_get_workspace(parent));
+    if ( self->batch.source > 0 )
+        g_source_remove(self->batch.source);
+    self->batch.source = g_timeout_add(WH_WORKSPACES_BATCH_DELAY, _wh_workspaces_batch_timeout, self);
+
+    return TRUE;
+}
+
+static gboolean
+_wh_workspaces_batch_pending(WhWorkspaces *self, WhContainer *con)
+{
+    if ( ! self->batch.enabled )
+        return FALSE;
+    return g_hash_table_contains(self->batch.pending, _wh_container_get_workspace(con));
+}
+
+void
+wh_workspaces_set_batching(WhWorkspaces *self, gboolean batching)
+{
+    self->batch.enabled = batching;
+    if ( ! batching )
+        _wh_workspaces_batch_flush(self);
+}
+
 static void _wh_container_free(WhContainer *self);
 static void _wh_container_show(WhContainer *self);
 static void _wh_container_hide(WhContainer *self);
@@ -181,8 +371,11 @@ _wh_container_reparent(WhContainer *self, WhContainer *parent)
     if ( old_parent == NULL )
         goto set;
 
-    g_queue_unlink(old_parent->history, self->history_link);
+    /* Placeholders are never focused, they stay out of history */
+    if ( ! WH_CONTAINER_IS_PLACEHOLDER(self) )
+        g_queue_unlink(old_parent->history, self->history_link);
     g_queue_unlink(old_parent->children, self->link);
+    _wh_container_touch(old_parent);
     length = g_queue_get_length(old_parent->children);
     if ( length > 0 )
         _wh_container_resize(old_parent);
@@ -199,14 +392,27 @@ _wh_container_reparent(WhContainer *self, WhContainer *parent)
 set:
     self->parent = parent;
     if ( self->parent == NULL )
+    {
+        if ( old_parent != NULL )
+            _wh_workspaces_tree_event(self->workspaces, "{\"change\":\"removed\",\"id\":%" G_GUINT64_FORMAT "}", self->id);
         return;
+    }
 
     length = g_queue_get_length(parent->children);
 
     g_queue_push_tail_link(parent->children, self->link);
-    g_queue_push_tail_link(parent->history, self->history_link);
+    if ( ! WH_CONTAINER_IS_PLACEHOLDER(self) )
+        g_queue_push_tail_link(parent->history, self->history_link);
+    _wh_container_touch(self);
 
-    _wh_container_resize(parent);
+    if ( old_parent == NULL )
+        _wh_workspaces_tree_event(self->workspaces, "{\"change\":\"added\",\"id\":%" G_GUINT64_FORMAT ",\"parent\":%" G_GUINT64_FORMAT ",\"type\":\"%s\"}", self->id, parent->id, _wh_container_types[self->type]);
+    else
+        _wh_workspaces_tree_event(self->workspaces, "{\"change\":\"moved\",\"id\":%" G_GUINT64_FORMAT ",\"parent\":%" G_GUINT64_FORMAT "}", self->id, parent->id);
+
+    /* New surfaces get laid out together when they arrive in a burst */
+    if ( ( old_parent != NULL ) || ( ! _wh_workspaces_batch_add(self->workspaces, parent) ) )
+        _wh_container_resize(parent);
     if ( parent->visible )
         _wh_container_show(parent);
 }
@@ -216,6 +422,8 @@ _wh_container_init(WhContainer *self, WhWorkspaces *workspaces, WhContainerType
 {
     self->workspaces = workspaces;
     self->type = type;
+    self->id = ++workspaces->next_id;
+    self->version = 1;
 
     self->children = g_queue_new();
     self->link = g_list_alloc();
@@ -241,6 +449,8 @@ _wh_container_uninit(WhContainer *self)
 
     g_list_free_1(self->history_link);
     g_list_free_1(self->link);
+
+    g_free(self->serialised);
 }
 
 static WhContainer *
@@ -274,8 +484,14 @@ _wh_workspace_set_output(WhWorkspace *self, WhOutput *output)
         output = last->output;
     }
     self->output = output;
-    self->container.geometry = wh_output_get_geometry(self->output);
-    _wh_container_resize(&self->container);
+    if ( ! _wh_container_set_geometry(&self->container, wh_output_get_geometry(self->output)) )
+        return;
+
+    /* Hidden workspaces may move several times in a row, lay them out when shown */
+    if ( self->container.visible )
+        _wh_container_resize(&self->container);
+    else
+        self->resize_pending = TRUE;
 }
 
 static guint64
@@ -340,10 +556,15 @@ _wh_workspace_new(WhWorkspaces *workspaces, guint64 number, const gchar *name)
         self->container.current = TRUE;
 
     g_hash_table_insert(workspaces->workspaces, self->name, self);
+    if ( self->number != WH_WORKSPACE_NO_NUMBER )
+        g_hash_table_insert(workspaces->workspaces_by_number, GUINT_TO_POINTER(self->number), self);
     workspaces->workspaces_sorted = g_list_concat(self->container.link, workspaces->workspaces_sorted);
     workspaces->workspaces_sorted = g_list_sort(workspaces->workspaces_sorted, _wh_workspace_compare);
     g_queue_push_tail_link(workspaces->history, self->container.history_link);
 
+    _wh_container_touch(&self->container);
+    _wh_workspaces_tree_event(workspaces, "{\"change\":\"added\",\"id\":%" G_GUINT64_FORMAT ",\"parent\":0,\"type\":\"%s\"}", self->container.id, _wh_container_types[self->container.type]);
+
     return self;
 }
 
@@ -356,6 +577,13 @@ _wh_workspace_free(gpointer data)
 
     WhWorkspaces *workspaces = self->container.workspaces;
 
+    g_hash_table_remove(workspaces->batch.pending, self);
+    ++workspaces->version;
+    _wh_workspaces_tree_event(workspaces, "{\"change\":\"removed\",\"id\":%" G_GUINT64_FORMAT "}", self->container.id);
+
+    if ( ( self->number != WH_WORKSPACE_NO_NUMBER ) && ( g_hash_table_lookup(workspaces->workspaces_by_number, GUINT_TO_POINTER(self->number)) == self ) )
+        g_hash_table_remove(workspaces->workspaces_by_number, GUINT_TO_POINTER(self->number));
+
     if ( ( self->number != WH_WORKSPACE_NO_NUMBER ) && ( self->number == workspaces->workspace_biggest ) )
     {
         workspaces->workspace_biggest = 0;
@@ -369,6 +597,13 @@ _wh_workspace_free(gpointer data)
         }
     }
 
+    guint i;
+    for ( i = 0 ; i < G_N_ELEMENTS(self->grid.cells) ; ++i )
+    {
+        if ( self->grid.cells[i] != NULL )
+            g_ptr_array_unref(self->grid.cells[i]);
+    }
+
     g_free(self->name);
 
     g_free(self);
@@ -456,6 +691,12 @@ _wh_container_show(WhContainer *self)
     }
 }
 
+const gchar *
+wh_workspace_get_name(WhWorkspace *self)
+{
+    return self->name;
+}
+
 void
 wh_workspace_show(WhWorkspace *workspace)
 {
@@ -465,6 +706,11 @@ wh_workspace_show(WhWorkspace *workspace)
     g_queue_unlink(self->workspaces->history, self->history_link);
     g_queue_push_head_link(self->workspaces->history, self->history_link);
 
+    if ( workspace->resize_pending )
+    {
+        workspace->resize_pending = FALSE;
+        _wh_container_resize(self);
+    }
     _wh_container_show(self);
 }
 
@@ -480,6 +726,17 @@ wh_workspace_hide(WhWorkspace *workspace)
         g_hash_table_remove(self->workspaces->workspaces, workspace->name);
 }
 
+static void
+_wh_workspace_group_free(gpointer data)
+{
+    WhWorkspaceGroup *self = data;
+
+    g_strfreev(self->outputs);
+    g_strfreev(self->members);
+
+    g_slice_free(WhWorkspaceGroup, self);
+}
+
 WhWorkspaces *
 wh_workspaces_new(WhCore *core)
 {
@@ -492,6 +749,14 @@ wh_workspaces_new(WhCore *core)
     self->workspaces = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _wh_workspace_free);
     self->workspaces_by_number = g_hash_table_new(NULL, NULL);
 
+    self->surfaces_by_app_id = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_queue_free);
+    self->surfaces_by_title = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_queue_free);
+    self->surfaces_by_mark = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self->placeholders_by_app_id = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_queue_free);
+    self->placeholders_by_title = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_queue_free);
+    self->batch.pending = g_hash_table_new(NULL, NULL);
+    self->groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_workspace_group_free);
+
     self->history = g_queue_new();
     weston_layer_init(&self->fullscreen_layer, compositor);
     weston_layer_set_position(&self->fullscreen_layer, WESTON_LAYER_POSITION_FULLSCREEN);
@@ -507,11 +772,24 @@ wh_workspaces_free(WhWorkspaces *self)
     if ( self == NULL )
         return;
 
+    g_hash_table_unref(self->surfaces_by_mark);
+    g_hash_table_unref(self->surfaces_by_title);
+    g_hash_table_unref(self->surfaces_by_app_id);
+
+    if ( self->batch.source > 0 )
+        g_source_remove(self->batch.source);
+
     g_hash_table_unref(self->workspaces_by_number);
     g_hash_table_unref(self->workspaces);
+    g_hash_table_unref(self->batch.pending);
+    g_hash_table_unref(self->placeholders_by_title);
+    g_hash_table_unref(self->placeholders_by_app_id);
+    g_hash_table_unref(self->groups);
 
     g_queue_free(self->history);
 
+    g_free(self->serialised);
+
     g_free(self);
 }
 
@@ -554,6 +832,63 @@ wh_workspaces_remove_output(WhWorkspaces *self, WhOutput *output)
     wh_output_set_current_workspace(last->output, last);
 }
 
+void
+wh_workspaces_update_output(WhWorkspaces *self, WhOutput *output)
+{
+    GHashTableIter iter;
+    WhWorkspace *workspace;
+
+    g_hash_table_iter_init(&iter, self->workspaces);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &workspace) )
+    {
+        if ( workspace->output == output )
+            _wh_workspace_set_output(workspace, output);
+    }
+}
+
+gchar **
+wh_workspaces_get_output_workspaces(WhWorkspaces *self, WhOutput *output)
+{
+    GPtrArray *names;
+    GList *workspace_;
+
+    names = g_ptr_array_new();
+    for ( workspace_ = self->workspaces_sorted ; workspace_ != NULL ; workspace_ = g_list_next(workspace_) )
+    {
+        WhWorkspace *workspace = workspace_->data;
+        if ( workspace->output == output )
+            g_ptr_array_add(names, g_strdup(workspace->name));
+    }
+    g_ptr_array_add(names, NULL);
+
+    return (gchar **) g_ptr_array_free(names, FALSE);
+}
+
+gboolean
+wh_workspaces_restore_output(WhWorkspaces *self, WhOutput *output, const gchar * const *names, const gchar *current)
+{
+    WhWorkspace *workspace, *shown = NULL;
+    const gchar * const *name;
+
+    for ( name = names ; *name != NULL ; ++name )
+    {
+        workspace = g_hash_table_lookup(self->workspaces, *name);
+        /* Do not take away a workspace another output is showing */
+        if ( ( workspace == NULL ) || ( wh_output_get_current_workspace(workspace->output) == workspace ) )
+            continue;
+
+        _wh_workspace_set_output(workspace, output);
+        if ( ( shown == NULL ) || ( g_strcmp0(*name, current) == 0 ) )
+            shown = workspace;
+    }
+
+    if ( shown == NULL )
+        return FALSE;
+
+    wh_output_set_current_workspace(output, shown);
+    return TRUE;
+}
+
 static WhContainer *
 _wh_workspace_get_last(WhContainer *self)
 {
@@ -609,8 +944,12 @@ _wh_workspaces_set_current(WhWorkspaces *self, WhContainer *next)
     if ( current == next )
         return;
 
+    /* Placeholders have no history link in their parent */
+    g_return_if_fail(! WH_CONTAINER_IS_PLACEHOLDER(next));
+
     _wh_workspaces_set_current_recurse(current, FALSE);
     _wh_workspaces_set_current_recurse(next, TRUE);
+    wh_seats_set_workspace(wh_core_get_seats(self->core), _wh_container_get_workspace(next)->name);
 
     if ( WH_CONTAINER_IS_SURFACE(next) )
         wh_core_set_focus(self->core, WH_CONTAINER_SURFACE(next));
@@ -657,28 +996,39 @@ _wh_container_get(WhContainer *self, WhDirection direction)
     {
         if ( WH_CONTAINER_LAYOUT_GET_ORIENTATION(self->parent->layout) == WH_DIRECTION_GET_ORIENTATION(direction) )
         {
-            gpointer (*getter)(GQueue *queue);
+            gboolean previous;
+            GList *link;
             switch ( WH_DIRECTION_GET_TARGET(direction) )
             {
             case WH_TARGET_PREVIOUS:
-                if ( self->link->prev != NULL )
-                    return self->link->prev->data;
-                getter = g_queue_peek_tail;
+                previous = TRUE;
             break;
             case WH_TARGET_NEXT:
-                if ( self->link->next != NULL )
-                    return self->link->next->data;
-                getter = g_queue_peek_head;
+                previous = FALSE;
             break;
             default:
                 g_return_val_if_reached(NULL);
             }
+
+            /* Placeholders cannot take focus, step over them */
+            link = self->link;
+            do
+                link = previous ? link->prev : link->next;
+            while ( ( link != NULL ) && WH_CONTAINER_IS_PLACEHOLDER((WhContainer *) link->data) );
+            if ( link != NULL )
+                return link->data;
+
             WhContainer *target;
             target = _wh_container_get(self->parent, direction);
             if ( target != self->parent )
                 return _wh_workspace_get_last(target);
             if ( output == NULL )
-                return getter(self->parent->children);
+            {
+                link = previous ? self->parent->children->tail : self->parent->children->head;
+                while ( WH_CONTAINER_IS_PLACEHOLDER((WhContainer *) link->data) )
+                    link = previous ? link->prev : link->next;
+                return link->data;
+            }
         }
     }
 
@@ -763,6 +1113,212 @@ wh_workspaces_focus_workspace_number(WhWorkspaces *self, WhSeat *seat, guint64 t
     wh_output_set_current_workspace(workspace->output, workspace);
 }
 
+void
+wh_workspaces_add_group(WhWorkspaces *self, const gchar *name, gchar **members, gchar **outputs)
+{
+    WhWorkspaceGroup *group;
+
+    group = g_slice_new0(WhWorkspaceGroup);
+    group->members = members;
+    group->outputs = outputs;
+
+    g_hash_table_replace(self->groups, g_strdup(name), group);
+}
+
+void
+wh_workspaces_remove_group(WhWorkspaces *self, const gchar *name)
+{
+    g_hash_table_remove(self->groups, name);
+}
+
+void
+wh_workspaces_focus_group(WhWorkspaces *self, WhSeat *seat, const gchar *target)
+{
+    WhOutputs *outputs = wh_core_get_outputs(self->core);
+    WhWorkspaceGroup *group;
+    WhWorkspace *current, *focus = NULL;
+    GPtrArray *workspaces;
+    GHashTable *claimed;
+    gsize i, n_outputs;
+
+    group = g_hash_table_lookup(self->groups, target);
+    if ( group == NULL )
+        return;
+
+    current = g_queue_peek_head(self->history);
+    n_outputs = ( group->outputs != NULL ) ? g_strv_length(group->outputs) : 0;
+    workspaces = g_ptr_array_new();
+    claimed = g_hash_table_new(NULL, NULL);
+
+    for ( i = 0 ; group->members[i] != NULL ; ++i )
+    {
+        WhWorkspace *workspace;
+        gboolean created = FALSE;
+
+        workspace = g_hash_table_lookup(self->workspaces, group->members[i]);
+        if ( workspace == NULL )
+        {
+            WhOutput *output = NULL;
+            if ( i < n_outputs )
+                output = wh_outputs_get_by_name(outputs, group->outputs[i]);
+            workspace = _wh_workspace_new(self, WH_WORKSPACE_NO_NUMBER, group->members[i]);
+            _wh_workspace_set_output(workspace, output);
+            created = TRUE;
+        }
+
+        /*
+         * With some outputs missing, several members can land on the same
+         * output; showing one would hide, and maybe free, the other
+         */
+        if ( ! g_hash_table_add(claimed, workspace->output) )
+        {
+            if ( created )
+                g_hash_table_remove(self->workspaces, workspace->name);
+            continue;
+        }
+
+        /* Focus stays on the output we were on */
+        if ( ( focus == NULL ) || ( workspace->output == current->output ) )
+            focus = workspace;
+        g_ptr_array_add(workspaces, workspace);
+    }
+
+    /*
+     * Every output is switched in this single pass, so the views
+     * all change before the next repaint; the focused workspace goes
+     * last to end up on top of the history
+     */
+    for ( i = 0 ; i < workspaces->len ; ++i )
+    {
+        WhWorkspace *workspace = g_ptr_array_index(workspaces, i);
+        if ( workspace != focus )
+            wh_output_set_current_workspace(workspace->output, workspace);
+    }
+    if ( focus != NULL )
+    {
+        wh_output_set_current_workspace(focus->output, focus);
+        _wh_workspaces_set_current(self, _wh_workspace_get_last(&focus->container));
+    }
+
+    g_hash_table_unref(claimed);
+    g_ptr_array_free(workspaces, TRUE);
+}
+
+static void
+_wh_workspace_grid_cell_range(WhWorkspace *self, gint32 start, gint32 length, gboolean vertical, guint *first, guint *last)
+{
+    gint32 origin = vertical ? self->container.geometry.y : self->container.geometry.x;
+    gint32 size = vertical ? self->container.geometry.height : self->container.geometry.width;
+    gint32 cell = MAX(1, ( size + WH_WORKSPACE_GRID_SIZE - 1 ) / WH_WORKSPACE_GRID_SIZE);
+
+    *first = CLAMP(( start - origin ) / cell, 0, WH_WORKSPACE_GRID_SIZE - 1);
+    *last = CLAMP(( start + length - 1 - origin ) / cell, 0, WH_WORKSPACE_GRID_SIZE - 1);
+}
+
+static void
+_wh_workspace_grid_add(WhWorkspace *self, WhContainer *con)
+{
+    if ( ! WH_CONTAINER_IS_SURFACE(con) )
+    {
+        GList *child;
+        for ( child = g_queue_peek_head_link(con->children) ; child != NULL ; child = g_list_next(child) )
+            _wh_workspace_grid_add(self, child->data);
+        return;
+    }
+
+    if ( ( con->geometry.width < 1 ) || ( con->geometry.height < 1 ) )
+        return;
+
+    guint x1, x2, y1, y2, x, y;
+    _wh_workspace_grid_cell_range(self, con->geometry.x, con->geometry.width, FALSE, &x1, &x2);
+    _wh_workspace_grid_cell_range(self, con->geometry.y, con->geometry.height, TRUE, &y1, &y2);
+    for ( y = y1 ; y <= y2 ; ++y )
+    {
+        for ( x = x1 ; x <= x2 ; ++x )
+            g_ptr_array_add(self->grid.cells[y * WH_WORKSPACE_GRID_SIZE + x], con);
+    }
+}
+
+static void
+_wh_workspace_grid_update(WhWorkspace *self)
+{
+    guint i;
+
+    if ( self->grid.version == self->container.version )
+        return;
+    self->grid.version = self->container.version;
+
+    for ( i = 0 ; i < G_N_ELEMENTS(self->grid.cells) ; ++i )
+    {
+        if ( self->grid.cells[i] == NULL )
+            self->grid.cells[i] = g_ptr_array_new();
+        else
+            g_ptr_array_set_size(self->grid.cells[i], 0);
+    }
+
+    _wh_workspace_grid_add(self, &self->container);
+}
+
+WhSurface *
+wh_workspaces_get_surface_at(WhWorkspaces *self, WhOutput *output, gint32 x, gint32 y)
+{
+    WhWorkspace *workspace;
+    WhSurface *focus;
+
+    workspace = wh_output_get_current_workspace(output);
+    if ( workspace == NULL )
+        return NULL;
+
+    /* A fullscreen surface covers the whole workspace, whatever the tree says */
+    focus = wh_core_get_focus(self->core);
+    if ( ( focus != NULL ) && weston_desktop_surface_get_fullscreen(focus->desktop_surface) && ( _wh_container_get_workspace(&focus->container) == workspace ) )
+        return focus;
+
+    struct weston_geometry *geometry = &workspace->container.geometry;
+    if ( ( x < geometry->x ) || ( y < geometry->y ) || ( x >= geometry->x + geometry->width ) || ( y >= geometry->y + geometry->height ) )
+        return NULL;
+
+    _wh_workspace_grid_update(workspace);
+
+    guint column, row, i;
+    _wh_workspace_grid_cell_range(workspace, x, 1, FALSE, &column, &column);
+    _wh_workspace_grid_cell_range(workspace, y, 1, TRUE, &row, &row);
+
+    GPtrArray *cell = workspace->grid.cells[row * WH_WORKSPACE_GRID_SIZE + column];
+    for ( i = 0 ; i < cell->len ; ++i )
+    {
+        WhContainer *con = g_ptr_array_index(cell, i);
+        if ( ! con->visible )
+            continue;
+        if ( ( x >= con->geometry.x ) && ( y >= con->geometry.y ) && ( x < con->geometry.x + con->geometry.width ) && ( y < con->geometry.y + con->geometry.height ) )
+            return WH_CONTAINER_SURFACE(con);
+    }
+
+    return NULL;
+}
+
+void
+wh_workspaces_restore_seat(WhWorkspaces *self, WhSeat *seat, WhSurface *focus, const gchar *name)
+{
+    WhWorkspace *workspace;
+
+    if ( focus != NULL )
+    {
+        wh_surface_focus(focus, seat);
+        return;
+    }
+
+    if ( name == NULL )
+        return;
+    workspace = g_hash_table_lookup(self->workspaces, name);
+    if ( workspace == NULL )
+        return;
+
+    if ( ! workspace->container.visible )
+        wh_output_set_current_workspace(workspace->output, workspace);
+    _wh_workspaces_set_current(self, _wh_workspace_get_last(&workspace->container));
+}
+
 void
 wh_workspaces_focus_output(WhWorkspaces *self, WhSeat *seat, WhDirection direction)
 {
@@ -798,38 +1354,91 @@ wh_workspaces_move_container_to_workspace(WhWorkspaces *self, WhSeat *seat, WhTa
 {
 }
 
-void
-wh_workspaces_move_container_to_workspace_name(WhWorkspaces *self, WhSeat *seat, const gchar *target)
+static void _wh_workspaces_refocus(WhWorkspaces *self);
+static void
+_wh_workspaces_move_container_to(WhWorkspaces *self, WhContainer *con, WhWorkspace *workspace)
 {
-}
+    if ( _wh_container_get_workspace(con) == workspace )
+        return;
 
-void
-wh_workspaces_move_container_to_workspace_number(WhWorkspaces *self, WhSeat *seat, guint64 target)
-{
-}
+    WhContainer *parent;
+    parent = _wh_workspace_get_current(workspace);
+    if ( WH_CONTAINER_IS_SURFACE(parent) )
+        parent = parent->parent;
 
-void
-wh_workspaces_move_workspace_to_output(WhWorkspaces *self, WhSeat *seat, WhDirection target)
-{
-}
+    gboolean refocus = ( wh_core_get_focus(self->core) == WH_CONTAINER_SURFACE(con) );
 
-void
-wh_workspaces_move_workspace_to_output_name(WhWorkspaces *self, WhSeat *seat, const gchar *target)
-{
-}
+    _wh_workspaces_set_current_recurse(con, FALSE);
+    if ( refocus )
+        wh_core_set_focus(self->core, NULL);
+
+    _wh_container_reparent(con, parent);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->core));
 
+    if ( refocus )
+        _wh_workspaces_refocus(self);
+}
 
 void
-wh_workspaces_layout_switch(WhWorkspaces *self, WhSeat *seat, WhContainerLayoutType type, WhOrientation orientation)
+wh_workspaces_move_container_to_workspace_name(WhWorkspaces *self, WhSeat *seat, const gchar *target)
 {
     WhContainer *con;
+    WhWorkspace *workspace;
 
     con = _wh_workspaces_get_current(self);
+    if ( WH_CONTAINER_IS_WORKSPACE(con) )
+        return;
 
-    if ( WH_CONTAINER_IS_SURFACE(con) )
-        con = con->parent;
-
-    if ( orientation == WH_ORIENTATION_TOGGLE )
+    workspace = g_hash_table_lookup(self->workspaces, target);
+    if ( workspace == NULL )
+    {
+        workspace = _wh_workspace_new(self, WH_WORKSPACE_NO_NUMBER, target);
+        _wh_workspace_set_output(workspace, NULL);
+    }
+    _wh_workspaces_move_container_to(self, con, workspace);
+}
+
+void
+wh_workspaces_move_container_to_workspace_number(WhWorkspaces *self, WhSeat *seat, guint64 target)
+{
+    WhContainer *con;
+    WhWorkspace *workspace;
+
+    con = _wh_workspaces_get_current(self);
+    if ( WH_CONTAINER_IS_WORKSPACE(con) )
+        return;
+
+    workspace = g_hash_table_lookup(self->workspaces_by_number, GUINT_TO_POINTER(target));
+    if ( workspace == NULL )
+    {
+        workspace = _wh_workspace_new(self, target, NULL);
+        _wh_workspace_set_output(workspace, NULL);
+    }
+    _wh_workspaces_move_container_to(self, con, workspace);
+}
+
+void
+wh_workspaces_move_workspace_to_output(WhWorkspaces *self, WhSeat *seat, WhDirection target)
+{
+}
+
+void
+wh_workspaces_move_workspace_to_output_name(WhWorkspaces *self, WhSeat *seat, const gchar *target)
+{
+}
+
+
+void
+wh_workspaces_layout_switch(WhWorkspaces *self, WhSeat *seat, WhContainerLayoutType type, WhOrientation orientation)
+{
+    WhContainer *con;
+
+    con = _wh_workspaces_get_current(self);
+
+    if ( WH_CONTAINER_IS_SURFACE(con) )
+        con = con->parent;
+
+    if ( orientation == WH_ORIENTATION_TOGGLE )
     {
         if ( ( con->layout & 1 ) != type )
             orientation = WH_ORIENTATION_HORIZONTAL;
@@ -843,6 +1452,8 @@ wh_workspaces_layout_switch(WhWorkspaces *self, WhSeat *seat, WhContainerLayoutT
         return;
 
     con->layout = layout;
+    _wh_container_touch(con);
+    _wh_workspaces_tree_event(self, "{\"change\":\"layout\",\"id\":%" G_GUINT64_FORMAT ",\"layout\":\"%s\"}", con->id, _wh_container_layouts[con->layout]);
     _wh_container_resize(con);
     if ( con->visible )
         _wh_container_show(con);
@@ -876,6 +1487,7 @@ void
 wh_surface_set_size(WhSurface *self, gint32 width, gint32 height)
 {
     weston_desktop_surface_set_size(self->desktop_surface, width, height);
+    wh_latency_configure(wh_core_get_latency(self->container.workspaces->core), self->app_id);
     weston_view_set_mask(self->view, 0, 0, width, height);
     weston_view_update_transform(self->view);
 }
@@ -915,6 +1527,7 @@ wh_surface_fullscreen(WhSurface *self, WhStateChange change)
         wh_surface_set_size(self, workspace->container.geometry.width, workspace->container.geometry.height);
     }
     weston_desktop_surface_set_fullscreen(self->desktop_surface, fullscreen);
+    wh_latency_configure(wh_core_get_latency(self->container.workspaces->core), self->app_id);
 }
 
 void
@@ -925,6 +1538,728 @@ wh_surface_close(WhSurface *self)
     weston_desktop_surface_close(self->desktop_surface);
 }
 
+void
+wh_surface_focus(WhSurface *self, WhSeat *seat)
+{
+    if ( self == NULL )
+        return;
+
+    WhWorkspace *workspace;
+    workspace = _wh_container_get_workspace(&self->container);
+    if ( ! workspace->container.visible )
+        wh_output_set_current_workspace(workspace->output, workspace);
+    _wh_workspaces_set_current(self->container.workspaces, &self->container);
+}
+
+static void
+_wh_surface_index_add(GHashTable *index, const gchar *key, WhSurface *self, GList **link)
+{
+    GQueue *queue;
+
+    queue = g_hash_table_lookup(index, key);
+    if ( queue == NULL )
+    {
+        queue = g_queue_new();
+        g_hash_table_insert(index, g_strdup(key), queue);
+    }
+
+    *link = g_list_alloc();
+    (*link)->data = self;
+    g_queue_push_tail_link(queue, *link);
+}
+
+static void
+_wh_surface_index_remove(GHashTable *index, const gchar *key, GList **link)
+{
+    GQueue *queue;
+
+    queue = g_hash_table_lookup(index, key);
+    g_queue_delete_link(queue, *link);
+    *link = NULL;
+
+    if ( g_queue_is_empty(queue) )
+        g_hash_table_remove(index, key);
+}
+
+static gboolean
+_wh_surface_index_update(GHashTable *index, const gchar *value, WhSurface *self, gchar **key, GList **link)
+{
+    if ( g_strcmp0(*key, value) == 0 )
+        return FALSE;
+
+    if ( *key != NULL )
+        _wh_surface_index_remove(index, *key, link);
+    g_free(*key);
+
+    *key = g_strdup(value);
+    if ( *key != NULL )
+        _wh_surface_index_add(index, *key, self, link);
+
+    return TRUE;
+}
+
+static WhWorkspace *
+_wh_workspaces_get_assign_workspace(WhWorkspaces *self, const WhWorkspaceConfig *config)
+{
+    WhWorkspace *workspace;
+
+    if ( config->name != NULL )
+        workspace = g_hash_table_lookup(self->workspaces, config->name);
+    else
+        workspace = g_hash_table_lookup(self->workspaces_by_number, GUINT_TO_POINTER(config->number));
+    if ( workspace == NULL )
+    {
+        workspace = _wh_workspace_new(self, config->number, config->name);
+        _wh_workspace_set_output(workspace, NULL);
+    }
+
+    return workspace;
+}
+
+static const WhWorkspaceConfig *
+_wh_surface_get_assign(WhSurface *self, WhAssignProperty properties)
+{
+    WhAssigns *assigns = wh_config_get_assigns(wh_core_get_config(self->container.workspaces->core));
+
+    return wh_assigns_match(assigns, self->app_id, self->title, properties);
+}
+
+static GHashTable *
+_wh_placeholder_get_index(WhPlaceholder *self, const gchar **key)
+{
+    WhWorkspaces *workspaces = self->container.workspaces;
+
+    if ( self->app_id != NULL )
+    {
+        *key = self->app_id;
+        return workspaces->placeholders_by_app_id;
+    }
+    *key = self->title;
+    return workspaces->placeholders_by_title;
+}
+
+static WhPlaceholder *
+_wh_placeholder_new(WhWorkspaces *workspaces, const gchar *app_id, const gchar *title)
+{
+    WhPlaceholder *self;
+
+    self = g_new0(WhPlaceholder, 1);
+    _wh_container_init(&self->container, workspaces, WH_CONTAINER_TYPE_PLACEHOLDER);
+    self->app_id = g_strdup(app_id);
+    self->title = g_strdup(title);
+
+    GHashTable *index;
+    const gchar *key;
+    GQueue *queue;
+
+    index = _wh_placeholder_get_index(self, &key);
+    queue = g_hash_table_lookup(index, key);
+    if ( queue == NULL )
+    {
+        queue = g_queue_new();
+        g_hash_table_insert(index, g_strdup(key), queue);
+    }
+    self->index_link = g_list_alloc();
+    self->index_link->data = self;
+    g_queue_push_tail_link(queue, self->index_link);
+
+    return self;
+}
+
+static void
+_wh_placeholder_free(WhPlaceholder *self)
+{
+    GHashTable *index;
+    const gchar *key;
+    GQueue *queue;
+
+    index = _wh_placeholder_get_index(self, &key);
+    queue = g_hash_table_lookup(index, key);
+    g_queue_delete_link(queue, self->index_link);
+    if ( g_queue_is_empty(queue) )
+        g_hash_table_remove(index, key);
+
+    _wh_container_uninit(&self->container);
+
+    g_free(self->title);
+    g_free(self->app_id);
+
+    g_free(self);
+}
+
+static WhPlaceholder *
+_wh_workspaces_get_placeholder(WhWorkspaces *self, const gchar *app_id, const gchar *title)
+{
+    GQueue *queue;
+    GList *link;
+
+    if ( ( app_id != NULL ) && ( ( queue = g_hash_table_lookup(self->placeholders_by_app_id, app_id) ) != NULL ) )
+    {
+        for ( link = g_queue_peek_head_link(queue) ; link != NULL ; link = g_list_next(link) )
+        {
+            WhPlaceholder *placeholder = link->data;
+            if ( ( placeholder->title == NULL ) || ( g_strcmp0(placeholder->title, title) == 0 ) )
+                return placeholder;
+        }
+    }
+
+    /* Title-only placeholders are for surfaces without an app_id */
+    if ( ( title != NULL ) && ( ( queue = g_hash_table_lookup(self->placeholders_by_title, title) ) != NULL ) )
+        return g_queue_peek_head(queue);
+
+    return NULL;
+}
+
+static gboolean
+_wh_surface_swallow(WhSurface *self)
+{
+    WhWorkspaces *workspaces = self->container.workspaces;
+    WhContainer *con = &self->container;
+    WhPlaceholder *placeholder;
+
+    placeholder = _wh_workspaces_get_placeholder(workspaces, self->app_id, self->title);
+    if ( placeholder == NULL )
+        return FALSE;
+
+    WhContainer *old_parent = con->parent;
+    WhContainer *parent = placeholder->container.parent;
+    gboolean refocus = FALSE;
+
+    if ( old_parent != NULL )
+    {
+        refocus = ( wh_core_get_focus(workspaces->core) == self );
+        _wh_workspaces_set_current_recurse(con, FALSE);
+        if ( refocus )
+            wh_core_set_focus(workspaces->core, NULL);
+        _wh_container_reparent(con, NULL);
+    }
+
+    /* Take the exact slot, and size, of the placeholder */
+    con->parent = parent;
+    g_queue_insert_before(parent->children, placeholder->container.link, con);
+    g_list_free_1(con->link);
+    con->link = placeholder->container.link->prev;
+    g_queue_push_tail_link(parent->history, con->history_link);
+    _wh_container_set_geometry(con, placeholder->container.geometry);
+    _wh_container_touch(con);
+
+    if ( old_parent == NULL )
+        _wh_workspaces_tree_event(workspaces, "{\"change\":\"added\",\"id\":%" G_GUINT64_FORMAT ",\"parent\":%" G_GUINT64_FORMAT ",\"type\":\"%s\"}", con->id, parent->id, _wh_container_types[con->type]);
+    else
+        _wh_workspaces_tree_event(workspaces, "{\"change\":\"moved\",\"id\":%" G_GUINT64_FORMAT ",\"parent\":%" G_GUINT64_FORMAT "}", con->id, parent->id);
+
+    _wh_placeholder_free(placeholder);
+    if ( parent->visible )
+        _wh_container_show(parent);
+    wh_snapshot_invalidate(wh_core_get_snapshot(workspaces->core));
+
+    if ( refocus )
+        _wh_workspaces_refocus(workspaces);
+
+    return TRUE;
+}
+
+static void
+_wh_surface_update_properties(WhSurface *self)
+{
+    WhWorkspaces *workspaces = self->container.workspaces;
+    WhAssignProperty changed = 0;
+
+    if ( _wh_surface_index_update(workspaces->surfaces_by_app_id, weston_desktop_surface_get_app_id(self->desktop_surface), self, &self->app_id, &self->app_id_link) )
+        changed |= WH_ASSIGN_PROPERTY_APP_ID;
+    if ( _wh_surface_index_update(workspaces->surfaces_by_title, weston_desktop_surface_get_title(self->desktop_surface), self, &self->title, &self->title_link) )
+        changed |= WH_ASSIGN_PROPERTY_TITLE;
+
+    if ( changed == 0 )
+        return;
+
+    _wh_container_touch(&self->container);
+    _wh_workspaces_tree_event(workspaces, "{\"change\":\"properties\",\"id\":%" G_GUINT64_FORMAT "}", self->container.id);
+
+    if ( wh_core_get_focus(workspaces->core) == self )
+        wh_snapshot_invalidate(wh_core_get_snapshot(workspaces->core));
+
+    /* Many toolkits set these after mapping, only rules about what changed can move us */
+    if ( self->container.parent != NULL )
+    {
+        const WhWorkspaceConfig *config;
+
+        /*
+         * A placed surface only looks for its saved slot once its app_id
+         * is known, saved nodes without a title would match any retitle
+         */
+        if ( ( changed & WH_ASSIGN_PROPERTY_APP_ID ) && _wh_surface_swallow(self) )
+            return;
+
+        config = _wh_surface_get_assign(self, changed);
+        if ( config != NULL )
+            _wh_workspaces_move_container_to(workspaces, &self->container, _wh_workspaces_get_assign_workspace(workspaces, config));
+    }
+}
+
+void
+wh_surface_unmark(WhSurface *self, WhSeat *seat, const gchar *mark)
+{
+    if ( self == NULL )
+        return;
+
+    GSList *link;
+    link = g_slist_find_custom(self->marks, mark, (GCompareFunc) g_strcmp0);
+    if ( link == NULL )
+        return;
+
+    g_hash_table_remove(self->container.workspaces->surfaces_by_mark, mark);
+    g_free(link->data);
+    self->marks = g_slist_delete_link(self->marks, link);
+}
+
+void
+wh_surface_unmark_all(WhSurface *self, WhSeat *seat)
+{
+    if ( self == NULL )
+        return;
+
+    GSList *mark;
+    for ( mark = self->marks ; mark != NULL ; mark = g_slist_next(mark) )
+        g_hash_table_remove(self->container.workspaces->surfaces_by_mark, mark->data);
+    g_slist_free_full(self->marks, g_free);
+    self->marks = NULL;
+}
+
+void
+wh_surface_mark(WhSurface *self, WhSeat *seat, const gchar *mark)
+{
+    if ( self == NULL )
+        return;
+
+    WhSurface *owner;
+    owner = g_hash_table_lookup(self->container.workspaces->surfaces_by_mark, mark);
+    if ( owner == self )
+        return;
+    /* Marks are unique, steal it */
+    wh_surface_unmark(owner, seat, mark);
+
+    self->marks = g_slist_prepend(self->marks, g_strdup(mark));
+    g_hash_table_insert(self->container.workspaces->surfaces_by_mark, g_strdup(mark), self);
+}
+
+static gboolean
+_wh_surface_match(WhSurface *self, const WhCriteria *criteria)
+{
+    if ( ( criteria->app_id != NULL ) && ( g_strcmp0(self->app_id, criteria->app_id) != 0 ) )
+        return FALSE;
+    if ( ( criteria->title != NULL ) && ( g_strcmp0(self->title, criteria->title) != 0 ) )
+        return FALSE;
+    if ( ( criteria->mark != NULL ) && ( g_slist_find_custom(self->marks, criteria->mark, (GCompareFunc) g_strcmp0) == NULL ) )
+        return FALSE;
+    return TRUE;
+}
+
+GList *
+wh_workspaces_get_surfaces(WhWorkspaces *self, const WhCriteria *criteria)
+{
+    if ( criteria->mark != NULL )
+    {
+        WhSurface *surface;
+        surface = g_hash_table_lookup(self->surfaces_by_mark, criteria->mark);
+        if ( ( surface == NULL ) || ( ! _wh_surface_match(surface, criteria) ) )
+            return NULL;
+        return g_list_prepend(NULL, surface);
+    }
+
+    GQueue *queue = NULL;
+    if ( criteria->app_id != NULL )
+        queue = g_hash_table_lookup(self->surfaces_by_app_id, criteria->app_id);
+    else if ( criteria->title != NULL )
+        queue = g_hash_table_lookup(self->surfaces_by_title, criteria->title);
+    if ( queue == NULL )
+        return NULL;
+
+    GList *surfaces = NULL, *surface;
+    for ( surface = g_queue_peek_head_link(queue) ; surface != NULL ; surface = g_list_next(surface) )
+    {
+        if ( _wh_surface_match(surface->data, criteria) )
+            surfaces = g_list_prepend(surfaces, surface->data);
+    }
+    return g_list_reverse(surfaces);
+}
+
+static guint32
+_wh_container_count_surfaces(WhContainer *self)
+{
+    if ( WH_CONTAINER_IS_SURFACE(self) )
+        return 1;
+
+    guint32 count = 0;
+    GList *child;
+    for ( child = g_queue_peek_head_link(self->children) ; child != NULL ; child = g_list_next(child) )
+        count += _wh_container_count_surfaces(child->data);
+    return count;
+}
+
+void
+wh_workspaces_fill_snapshot(WhWorkspaces *self, WhStateSnapshotData *data)
+{
+    WhWorkspace *focused = g_queue_peek_head(self->history);
+    WhSurface *focus = wh_core_get_focus(self->core);
+    WhWorkspace *focus_workspace = ( focus != NULL ) ? _wh_container_get_workspace(&focus->container) : NULL;
+
+    data->focus.workspace = WH_STATE_SNAPSHOT_NONE;
+    if ( focus != NULL )
+    {
+        g_strlcpy(data->focus.app_id, ( focus->app_id != NULL ) ? focus->app_id : "", sizeof(data->focus.app_id));
+        g_strlcpy(data->focus.title, ( focus->title != NULL ) ? focus->title : "", sizeof(data->focus.title));
+    }
+
+    GList *workspace_;
+    for ( workspace_ = self->workspaces_sorted ; ( workspace_ != NULL ) && ( data->n_workspaces < WH_STATE_SNAPSHOT_MAX_WORKSPACES ) ; workspace_ = g_list_next(workspace_) )
+    {
+        WhWorkspace *workspace = workspace_->data;
+        guint32 index = data->n_workspaces++;
+        WhStateSnapshotWorkspace *sworkspace = &data->workspaces[index];
+
+        g_strlcpy(sworkspace->name, workspace->name, sizeof(sworkspace->name));
+        sworkspace->number = workspace->number;
+        sworkspace->output = WH_STATE_SNAPSHOT_NONE;
+        sworkspace->windows = _wh_container_count_surfaces(&workspace->container);
+        if ( workspace == focused )
+            sworkspace->flags |= WH_STATE_SNAPSHOT_WORKSPACE_FOCUSED;
+        if ( workspace->container.visible )
+            sworkspace->flags |= WH_STATE_SNAPSHOT_WORKSPACE_VISIBLE;
+        if ( workspace == focus_workspace )
+            data->focus.workspace = index;
+
+        if ( workspace->output == NULL )
+            continue;
+
+        const gchar *output = wh_output_get_name(workspace->output);
+        guint32 i;
+        for ( i = 0 ; i < data->n_outputs ; ++i )
+        {
+            if ( g_strcmp0(data->outputs[i].name, output) != 0 )
+                continue;
+            sworkspace->output = i;
+            if ( wh_output_get_current_workspace(workspace->output) == workspace )
+                data->outputs[i].workspace = index;
+            break;
+        }
+    }
+}
+
+static const gchar *
+_wh_container_serialise(WhContainer *self)
+{
+    if ( ( self->serialised != NULL ) && ( self->serialised_version == self->version ) )
+        return self->serialised;
+
+    GString *string;
+    string = g_string_new("");
+    g_string_append_printf(string, "{\"id\":%" G_GUINT64_FORMAT ",\"type\":\"%s\",\"layout\":\"%s\",\"geometry\":[%d,%d,%d,%d]", self->id, _wh_container_types[self->type], _wh_container_layouts[self->layout], self->geometry.x, self->geometry.y, self->geometry.width, self->geometry.height);
+
+    switch ( self->type )
+    {
+    case WH_CONTAINER_TYPE_WORKSPACE:
+    {
+        WhWorkspace *workspace = WH_CONTAINER_WORKSPACE(self);
+        g_string_append(string, ",\"name\":");
+        wh_ipc_json_append_string(string, workspace->name);
+        if ( workspace->number != WH_WORKSPACE_NO_NUMBER )
+            g_string_append_printf(string, ",\"number\":%" G_GUINT64_FORMAT, workspace->number);
+        g_string_append(string, ",\"output\":");
+        wh_ipc_json_append_string(string, ( workspace->output != NULL ) ? wh_output_get_name(workspace->output) : NULL);
+    }
+    break;
+    case WH_CONTAINER_TYPE_SURFACE:
+    {
+        WhSurface *surface = WH_CONTAINER_SURFACE(self);
+        g_string_append(string, ",\"app_id\":");
+        wh_ipc_json_append_string(string, surface->app_id);
+        g_string_append(string, ",\"title\":");
+        wh_ipc_json_append_string(string, surface->title);
+    }
+    break;
+    case WH_CONTAINER_TYPE_PLACEHOLDER:
+    {
+        WhPlaceholder *placeholder = WH_CONTAINER_PLACEHOLDER(self);
+        g_string_append(string, ",\"app_id\":");
+        wh_ipc_json_append_string(string, placeholder->app_id);
+        g_string_append(string, ",\"title\":");
+        wh_ipc_json_append_string(string, placeholder->title);
+    }
+    break;
+    case WH_CONTAINER_TYPE_CONTAINER:
+    break;
+    }
+
+    g_string_append(string, ",\"nodes\":[");
+    GList *child;
+    for ( child = g_queue_peek_head_link(self->children) ; child != NULL ; child = g_list_next(child) )
+    {
+        if ( child != g_queue_peek_head_link(self->children) )
+            g_string_append_c(string, ',');
+        g_string_append(string, _wh_container_serialise(child->data));
+    }
+    g_string_append(string, "]}");
+
+    g_free(self->serialised);
+    self->serialised = g_string_free(string, FALSE);
+    self->serialised_version = self->version;
+
+    return self->serialised;
+}
+
+static const gchar *
+_wh_workspaces_serialise(WhWorkspaces *self)
+{
+    if ( ( self->serialised != NULL ) && ( self->serialised_version == self->version ) )
+        return self->serialised;
+
+    GString *string;
+    string = g_string_new("[");
+
+    GList *workspace;
+    for ( workspace = self->workspaces_sorted ; workspace != NULL ; workspace = g_list_next(workspace) )
+    {
+        if ( workspace != self->workspaces_sorted )
+            g_string_append_c(string, ',');
+        g_string_append(string, _wh_container_serialise(workspace->data));
+    }
+    g_string_append_c(string, ']');
+
+    g_free(self->serialised);
+    self->serialised = g_string_free(string, FALSE);
+    self->serialised_version = self->version;
+
+    return self->serialised;
+}
+
+void
+wh_workspaces_ipc_tree(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhWorkspaces *self = user_data;
+
+    wh_ipc_client_send(client, _wh_workspaces_serialise(self));
+}
+
+void
+wh_workspaces_focus_mark(WhWorkspaces *self, WhSeat *seat, const gchar *target)
+{
+    wh_surface_focus(g_hash_table_lookup(self->surfaces_by_mark, target), seat);
+}
+
+#define WH_WORKSPACES_LAYOUT_VERSION 1
+#define WH_WORKSPACES_LAYOUT_NODE_TYPE "(umsmsav)"
+#define WH_WORKSPACES_LAYOUT_TYPE "(ua(suav))"
+
+static gchar *
+_wh_workspaces_get_layout_path(void)
+{
+    return g_build_filename(g_get_user_data_dir(), PACKAGE_NAME, "layout", NULL);
+}
+
+static GVariant *
+_wh_container_save(WhContainer *self)
+{
+    const gchar *app_id = NULL, *title = NULL;
+    GVariantBuilder children;
+    gboolean empty = TRUE;
+
+    if ( WH_CONTAINER_IS_SURFACE(self) && ( WH_CONTAINER_SURFACE(self)->app_id == NULL ) && ( WH_CONTAINER_SURFACE(self)->title == NULL ) )
+        return NULL;
+
+    g_variant_builder_init(&children, G_VARIANT_TYPE("av"));
+
+    switch ( self->type )
+    {
+    case WH_CONTAINER_TYPE_SURFACE:
+        app_id = WH_CONTAINER_SURFACE(self)->app_id;
+        /* Titles change all the time, only use them when there is nothing better */
+        if ( app_id == NULL )
+            title = WH_CONTAINER_SURFACE(self)->title;
+    break;
+    case WH_CONTAINER_TYPE_PLACEHOLDER:
+        app_id = WH_CONTAINER_PLACEHOLDER(self)->app_id;
+        title = WH_CONTAINER_PLACEHOLDER(self)->title;
+    break;
+    case WH_CONTAINER_TYPE_WORKSPACE:
+    case WH_CONTAINER_TYPE_CONTAINER:
+    {
+        GList *child;
+        for ( child = g_queue_peek_head_link(self->children) ; child != NULL ; child = g_list_next(child) )
+        {
+            GVariant *node;
+
+            node = _wh_container_save(child->data);
+            if ( node == NULL )
+                continue;
+            g_variant_builder_add(&children, "v", node);
+            empty = FALSE;
+        }
+        if ( empty )
+        {
+            g_variant_builder_clear(&children);
+            return NULL;
+        }
+    }
+    break;
+    }
+
+    return g_variant_new(WH_WORKSPACES_LAYOUT_NODE_TYPE, self->layout, app_id, title, &children);
+}
+
+void
+wh_workspaces_save_layout(WhWorkspaces *self, WhSeat *seat)
+{
+    GVariantBuilder workspaces;
+    GList *workspace_;
+
+    g_variant_builder_init(&workspaces, G_VARIANT_TYPE("a(suav)"));
+    for ( workspace_ = self->workspaces_sorted ; workspace_ != NULL ; workspace_ = g_list_next(workspace_) )
+    {
+        WhWorkspace *workspace = workspace_->data;
+        GVariant *node;
+        GVariant *children;
+
+        node = _wh_container_save(&workspace->container);
+        if ( node == NULL )
+            continue;
+
+        g_variant_ref_sink(node);
+        children = g_variant_get_child_value(node, 3);
+        g_variant_builder_add(&workspaces, "(su@av)", workspace->name, workspace->container.layout, children);
+        g_variant_unref(children);
+        g_variant_unref(node);
+    }
+
+    GVariant *layout;
+    gchar *path, *dir;
+    GError *error = NULL;
+
+    layout = g_variant_ref_sink(g_variant_new(WH_WORKSPACES_LAYOUT_TYPE, WH_WORKSPACES_LAYOUT_VERSION, &workspaces));
+    path = _wh_workspaces_get_layout_path();
+    dir = g_path_get_dirname(path);
+
+    if ( g_mkdir_with_parents(dir, 0700) < 0 )
+        g_warning("Could not create the data directory '%s': %s", dir, g_strerror(errno));
+    else if ( ! g_file_set_contents(path, g_variant_get_data(layout), g_variant_get_size(layout), &error) )
+    {
+        g_warning("Could not save the layout to '%s': %s", path, error->message);
+        g_error_free(error);
+    }
+    else
+        g_debug("Layout saved to '%s'", path);
+
+    g_free(dir);
+    g_free(path);
+    g_variant_unref(layout);
+}
+
+static void
+_wh_container_restore_children(WhWorkspaces *self, WhContainer *parent, GVariantIter *iter)
+{
+    GVariant *node;
+
+    while ( g_variant_iter_next(iter, "v", &node) )
+    {
+        guint32 layout;
+        const gchar *app_id, *title;
+        GVariantIter *children;
+
+        if ( ! g_variant_is_of_type(node, G_VARIANT_TYPE(WH_WORKSPACES_LAYOUT_NODE_TYPE)) )
+        {
+            g_variant_unref(node);
+            continue;
+        }
+
+        g_variant_get(node, "(um&sm&sav)", &layout, &app_id, &title, &children);
+        if ( g_variant_iter_n_children(children) > 0 )
+        {
+            WhContainer *con;
+
+            con = _wh_container_new(self);
+            if ( layout <= WH_CONTAINER_LAYOUT_SPLIT_VERTICAL )
+                con->layout = layout;
+            _wh_container_reparent(con, parent);
+            _wh_container_restore_children(self, con, children);
+        }
+        else if ( ( app_id != NULL ) || ( title != NULL ) )
+        {
+            WhPlaceholder *placeholder;
+
+            placeholder = _wh_placeholder_new(self, app_id, title);
+            _wh_container_reparent(&placeholder->container, parent);
+        }
+        g_variant_iter_free(children);
+        g_variant_unref(node);
+    }
+}
+
+void
+wh_workspaces_restore_layout(WhWorkspaces *self, WhSeat *seat)
+{
+    GMappedFile *file;
+    GBytes *bytes;
+    GVariant *layout;
+    gchar *path;
+
+    /* We need an output to put new workspaces on */
+    if ( g_queue_is_empty(self->history) )
+        return;
+
+    path = _wh_workspaces_get_layout_path();
+    file = g_mapped_file_new(path, FALSE, NULL);
+    g_free(path);
+    if ( file == NULL )
+        return;
+
+    bytes = g_mapped_file_get_bytes(file);
+    g_mapped_file_unref(file);
+    layout = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(WH_WORKSPACES_LAYOUT_TYPE), bytes, FALSE));
+    g_bytes_unref(bytes);
+
+    guint32 version;
+    GVariantIter *iter;
+    const gchar *name;
+    guint32 layout_type;
+    GVariantIter *children;
+
+    g_variant_get(layout, "(ua(suav))", &version, &iter);
+    if ( version != WH_WORKSPACES_LAYOUT_VERSION )
+    {
+        g_variant_iter_free(iter);
+        g_variant_unref(layout);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+
+    /* All the placeholders get a single layout pass */
+    gboolean batching = self->batch.enabled;
+    self->batch.enabled = TRUE;
+
+    while ( g_variant_iter_next(iter, "(&suav)", &name, &layout_type, &children) )
+    {
+        WhWorkspace *workspace;
+
+        workspace = g_hash_table_lookup(self->workspaces, name);
+        if ( workspace == NULL )
+        {
+            workspace = _wh_workspace_new(self, WH_WORKSPACE_NO_NUMBER, name);
+            _wh_workspace_set_output(workspace, NULL);
+        }
+        if ( layout_type <= WH_CONTAINER_LAYOUT_SPLIT_VERTICAL )
+            workspace->container.layout = layout_type;
+
+        _wh_container_restore_children(self, &workspace->container, children);
+        g_variant_iter_free(children);
+    }
+    g_variant_iter_free(iter);
+    g_variant_unref(layout);
+
+    wh_workspaces_set_batching(self, batching);
+    g_debug("Layout restored in %" G_GINT64_FORMAT "µs", g_get_monotonic_time() - start);
+}
+
 static void
 _wh_desktop_ping_timeout(struct weston_desktop_client *client, void *user_data)
 {
@@ -949,29 +2284,24 @@ _wh_desktop_surface_added(struct weston_desktop_surface *surface, void *user_dat
 
     self->surface = weston_desktop_surface_get_surface(self->desktop_surface);
     self->view = weston_desktop_surface_create_view(self->desktop_surface);
+    /* Xwayland surfaces have no desktop client, the wl_surface knows who made it */
+    wh_xwayland_client_surface_added(wh_core_get_xwayland(workspaces->core), wl_resource_get_client(self->surface->resource));
     weston_desktop_surface_set_maximized(self->desktop_surface, true);
 
-    const gchar *app_id;
-    const WhWorkspaceConfig *config = NULL;
+    _wh_surface_update_properties(self);
+
+    if ( _wh_surface_swallow(self) )
+        goto placed;
+
+    const WhWorkspaceConfig *config;
     WhContainer *parent = NULL;
 
-    app_id = weston_desktop_surface_get_app_id(surface);
-    if ( app_id != NULL )
-        config = wh_config_get_assign(wh_core_get_config(workspaces->core), app_id);
+    /* An explicit autostart placement wins over assign rules */
+    config = wh_autostart_match(wh_core_get_autostart(workspaces->core), weston_desktop_client_get_client(weston_desktop_surface_get_client(surface)));
+    if ( config == NULL )
+        config = _wh_surface_get_assign(self, WH_ASSIGN_PROPERTY_ALL);
     if ( config != NULL )
-    {
-        if ( config->name != NULL )
-            parent = g_hash_table_lookup(workspaces->workspaces, config->name);
-        else
-            parent = g_hash_table_lookup(workspaces->workspaces_by_number, GUINT_TO_POINTER(config->number));
-        if ( parent == NULL )
-        {
-            WhWorkspace *workspace;
-            workspace = _wh_workspace_new(workspaces, config->number, config->name);
-            _wh_workspace_set_output(workspace, NULL);
-            parent = &workspace->container;
-        }
-    }
+        parent = &_wh_workspaces_get_assign_workspace(workspaces, config)->container;
 
     if ( parent == NULL )
         parent = _wh_workspaces_get_current(workspaces);
@@ -988,6 +2318,9 @@ _wh_desktop_surface_added(struct weston_desktop_surface *surface, void *user_dat
         _wh_container_show(parent);
     }
 
+placed:
+    wh_snapshot_invalidate(wh_core_get_snapshot(workspaces->core));
+
     /* TODO: some focus stealing prevention */
     if ( wh_core_get_focus(workspaces->core) == NULL )
     {
@@ -1009,11 +2342,19 @@ _wh_desktop_surface_removed(struct weston_desktop_surface *surface, void *user_d
 
     if ( refocus )
         wh_core_set_focus(workspaces->core, NULL);
+    wh_seats_remove_surface(wh_core_get_seats(workspaces->core), self);
+    wh_xwayland_client_surface_removed(wh_core_get_xwayland(workspaces->core), wl_resource_get_client(self->surface->resource));
+
+    wh_surface_unmark_all(self, NULL);
+    _wh_surface_index_update(workspaces->surfaces_by_title, NULL, self, &self->title, &self->title_link);
+    _wh_surface_index_update(workspaces->surfaces_by_app_id, NULL, self, &self->app_id, &self->app_id_link);
 
     _wh_container_uninit(&self->container);
     weston_desktop_surface_set_user_data(surface, NULL);
     g_free(self);
 
+    wh_snapshot_invalidate(wh_core_get_snapshot(workspaces->core));
+
     if ( refocus )
         _wh_workspaces_refocus(workspaces);
 }
@@ -1024,6 +2365,10 @@ _wh_desktop_committed(struct weston_desktop_surface *surface, int32_t sx, int32_
     WhSurface *self = weston_desktop_surface_get_user_data(surface);
     struct weston_geometry geometry = weston_desktop_surface_get_geometry(self->desktop_surface);
 
+    /* libweston-desktop has no signal for these, catch changes here */
+    _wh_surface_update_properties(self);
+    wh_latency_commit(wh_core_get_latency(self->container.workspaces->core), self->app_id);
+
     int32_t x, y;
     if ( weston_desktop_surface_get_fullscreen(self->desktop_surface) )
     {
@@ -1034,7 +2379,8 @@ _wh_desktop_committed(struct weston_desktop_surface *surface, int32_t sx, int32_
     }
     else
     {
-        _wh_container_resize(self->container.parent);
+        if ( ! _wh_workspaces_batch_pending(self->container.workspaces, self->container.parent) )
+            _wh_container_resize(self->container.parent);
         x = self->container.geometry.x;
         y = self->container.geometry.y;
     }
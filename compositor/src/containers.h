@@ -25,6 +25,7 @@
 
 #include "types.h"
 #include <libweston-desktop.h>
+#include <wayhouse-snapshot.h>
 
 WhWorkspaces *wh_workspaces_new(WhCore *core);
 void wh_workspaces_free(WhWorkspaces *workspaces);
@@ -32,12 +33,21 @@ void wh_workspaces_free(WhWorkspaces *workspaces);
 void wh_workspaces_add_surface(WhWorkspaces *workspaces, WhSurface *surface);
 void wh_workspaces_add_output(WhWorkspaces *workspaces, WhOutput *output);
 void wh_workspaces_remove_output(WhWorkspaces *workspaces, WhOutput *output);
+void wh_workspaces_update_output(WhWorkspaces *workspaces, WhOutput *output);
+gchar **wh_workspaces_get_output_workspaces(WhWorkspaces *workspaces, WhOutput *output);
+gboolean wh_workspaces_restore_output(WhWorkspaces *workspaces, WhOutput *output, const gchar * const *names, const gchar *current);
+void wh_workspaces_add_group(WhWorkspaces *workspaces, const gchar *name, gchar **members, gchar **outputs);
+void wh_workspaces_remove_group(WhWorkspaces *workspaces, const gchar *name);
+void wh_workspaces_set_batching(WhWorkspaces *workspaces, gboolean batching);
 void wh_workspaces_focus_container(WhWorkspaces *workspaces, WhSeat *seat, WhDirection direction);
 void wh_workspaces_focus_workspace(WhWorkspaces *workspaces, WhSeat *seat, WhTarget target);
 void wh_workspaces_focus_workspace_name(WhWorkspaces *workspaces, WhSeat *seat, const gchar *target);
 void wh_workspaces_focus_workspace_number(WhWorkspaces *workspaces, WhSeat *seat, guint64 target);
 void wh_workspaces_focus_output(WhWorkspaces *workspaces, WhSeat *seat, WhDirection direction);
 void wh_workspaces_focus_output_name(WhWorkspaces *workspaces, WhSeat *seat, const gchar *target);
+void wh_workspaces_focus_group(WhWorkspaces *workspaces, WhSeat *seat, const gchar *target);
+WhSurface *wh_workspaces_get_surface_at(WhWorkspaces *workspaces, WhOutput *output, gint32 x, gint32 y);
+void wh_workspaces_restore_seat(WhWorkspaces *workspaces, WhSeat *seat, WhSurface *focus, const gchar *workspace);
 void wh_workspaces_move_container(WhWorkspaces *workspaces, WhSeat *seat, WhDirection direction);
 void wh_workspaces_move_container_to_workspace(WhWorkspaces *workspaces, WhSeat *seat, WhTarget target);
 void wh_workspaces_move_container_to_workspace_name(WhWorkspaces *workspaces, WhSeat *seat, const gchar *target);
@@ -45,7 +55,15 @@ void wh_workspaces_move_container_to_workspace_number(WhWorkspaces *workspaces,
 void wh_workspaces_move_workspace_to_output(WhWorkspaces *workspaces, WhSeat *seat, WhDirection direction);
 void wh_workspaces_move_workspace_to_output_name(WhWorkspaces *workspaces, WhSeat *seat, const gchar *target);
 void wh_workspaces_layout_switch(WhWorkspaces *workspaces, WhSeat *seat, WhContainerLayoutType type, WhOrientation orientation);
+void wh_workspaces_focus_mark(WhWorkspaces *workspaces, WhSeat *seat, const gchar *mark);
+void wh_workspaces_save_layout(WhWorkspaces *workspaces, WhSeat *seat);
+void wh_workspaces_restore_layout(WhWorkspaces *workspaces, WhSeat *seat);
 
+GList *wh_workspaces_get_surfaces(WhWorkspaces *workspaces, const WhCriteria *criteria);
+void wh_workspaces_fill_snapshot(WhWorkspaces *workspaces, WhStateSnapshotData *data);
+void wh_workspaces_ipc_tree(gpointer user_data, WhIpcClient *client, const gchar *args);
+
+const gchar *wh_workspace_get_name(WhWorkspace *workspace);
 void wh_workspace_show(WhWorkspace *workspace);
 void wh_workspace_hide(WhWorkspace *workspace);
 
@@ -60,5 +78,9 @@ void wh_surface_set_activated(WhSurface *surface, gboolean activated);
 
 void wh_surface_fullscreen(WhSurface *surface, WhStateChange change);
 void wh_surface_close(WhSurface *surface);
+void wh_surface_focus(WhSurface *surface, WhSeat *seat);
+void wh_surface_mark(WhSurface *surface, WhSeat *seat, const gchar *mark);
+void wh_surface_unmark(WhSurface *surface, WhSeat *seat, const gchar *mark);
+void wh_surface_unmark_all(WhSurface *surface, WhSeat *seat);
 
 #endif /* __WAYHOUSE_CONTAINERS_H__ */
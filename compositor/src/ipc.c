@@ -0,0 +1,536 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <gio/gunixfdmessage.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "commands.h"
+#include "latency.h"
+#include "seats.h"
+#include "ipc.h"
+
+/* Clients sending longer lines are cut off */
+#define WH_IPC_MAX_LINE (64 * 1024)
+
+struct _WhIpc {
+    WhCore *core;
+    gchar *path;
+    GSocketService *service;
+    GHashTable *handlers;
+    GHashTable *subscribers;
+    GList *clients;
+};
+
+typedef struct {
+    WhIpcHandler handler;
+    gpointer user_data;
+} WhIpcHandlerData;
+
+struct _WhIpcClient {
+    WhIpc *ipc;
+    GList *link;
+    GSocketConnection *connection;
+    GSocket *socket;
+    GSource *in_source;
+    GSource *out_source;
+    GString *in;
+    GString *out;
+    GQueue *fds;
+    GHashTable *topics;
+    gboolean closed;
+};
+
+/* A file descriptor going along the reply starting at offset in out */
+typedef struct {
+    gsize offset;
+    int fd;
+} WhIpcClientFd;
+
+void
+wh_ipc_json_append_string(GString *string, const gchar *value)
+{
+    g_string_append_c(string, '"');
+    for ( ; ( value != NULL ) && ( *value != '\0' ) ; ++value )
+    {
+        switch ( *value )
+        {
+        case '"':
+        case '\\':
+            g_string_append_c(string, '\\');
+            g_string_append_c(string, *value);
+        break;
+        case '\n':
+            g_string_append(string, "\\n");
+        break;
+        case '\t':
+            g_string_append(string, "\\t");
+        break;
+        default:
+            if ( (guchar) *value < 0x20 )
+                g_string_append_printf(string, "\\u%04x", (guint) *value);
+            else
+                g_string_append_c(string, *value);
+        }
+    }
+    g_string_append_c(string, '"');
+}
+
+static void
+_wh_ipc_client_fd_free(gpointer data)
+{
+    WhIpcClientFd *self = data;
+
+    close(self->fd);
+
+    g_slice_free(WhIpcClientFd, self);
+}
+
+static gboolean
+_wh_ipc_client_free(gpointer user_data)
+{
+    WhIpcClient *self = user_data;
+
+    g_hash_table_unref(self->topics);
+    g_queue_free_full(self->fds, _wh_ipc_client_fd_free);
+    g_string_free(self->out, TRUE);
+    g_string_free(self->in, TRUE);
+    g_object_unref(self->connection);
+
+    g_free(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_ipc_client_close(WhIpcClient *self)
+{
+    if ( self->closed )
+        return;
+    self->closed = TRUE;
+
+    GHashTableIter iter;
+    const gchar *topic;
+    g_hash_table_iter_init(&iter, self->topics);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &topic, NULL) )
+    {
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(self->ipc->subscribers, topic));
+        if ( count > 1 )
+            g_hash_table_insert(self->ipc->subscribers, g_strdup(topic), GUINT_TO_POINTER(count - 1));
+        else
+            g_hash_table_remove(self->ipc->subscribers, topic);
+    }
+
+    if ( self->out_source != NULL )
+    {
+        g_source_destroy(self->out_source);
+        g_source_unref(self->out_source);
+        self->out_source = NULL;
+    }
+    g_source_destroy(self->in_source);
+    g_source_unref(self->in_source);
+    self->in_source = NULL;
+
+    g_io_stream_close(G_IO_STREAM(self->connection), NULL, NULL);
+    self->ipc->clients = g_list_delete_link(self->ipc->clients, self->link);
+
+    /* We may be called from one of our sources or from a handler */
+    g_idle_add(_wh_ipc_client_free, self);
+}
+
+static gboolean _wh_ipc_client_out(GSocket *socket, GIOCondition condition, gpointer user_data);
+static void
+_wh_ipc_client_flush(WhIpcClient *self)
+{
+    GError *error = NULL;
+
+    while ( self->out->len > 0 )
+    {
+        GOutputVector vector = { .buffer = self->out->str, .size = self->out->len };
+        GSocketControlMessage *message = NULL;
+        WhIpcClientFd *fd = g_queue_peek_head(self->fds);
+        gssize size;
+
+        /*
+         * The kernel attaches a file descriptor to the first byte sent with it,
+         * so each one starts its own send, and stops the previous one
+         */
+        if ( ( fd != NULL ) && ( fd->offset > 0 ) )
+            vector.size = fd->offset;
+        else if ( fd != NULL )
+        {
+            WhIpcClientFd *next = g_queue_peek_nth(self->fds, 1);
+            if ( next != NULL )
+                vector.size = next->offset;
+            message = g_unix_fd_message_new();
+            g_unix_fd_message_append_fd(G_UNIX_FD_MESSAGE(message), fd->fd, NULL);
+        }
+
+        size = g_socket_send_message(self->socket, NULL, &vector, 1, ( message != NULL ) ? &message : NULL, ( message != NULL ) ? 1 : 0, G_SOCKET_MSG_NONE, NULL, &error);
+        if ( message != NULL )
+            g_object_unref(message);
+        if ( size < 0 )
+        {
+            if ( g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK) )
+            {
+                g_clear_error(&error);
+                if ( self->out_source == NULL )
+                {
+                    self->out_source = g_socket_create_source(self->socket, G_IO_OUT, NULL);
+                    g_source_set_callback(self->out_source, (GSourceFunc) _wh_ipc_client_out, self, NULL);
+                    g_source_attach(self->out_source, NULL);
+                }
+                return;
+            }
+            g_debug("IPC client write failed: %s", error->message);
+            g_clear_error(&error);
+            _wh_ipc_client_close(self);
+            return;
+        }
+        g_string_erase(self->out, 0, size);
+
+        if ( message != NULL )
+            _wh_ipc_client_fd_free(g_queue_pop_head(self->fds));
+        GList *fd_;
+        for ( fd_ = self->fds->head ; fd_ != NULL ; fd_ = g_list_next(fd_) )
+            ((WhIpcClientFd *) fd_->data)->offset -= size;
+    }
+
+    if ( self->out_source != NULL )
+    {
+        g_source_destroy(self->out_source);
+        g_source_unref(self->out_source);
+        self->out_source = NULL;
+    }
+}
+
+static gboolean
+_wh_ipc_client_out(GSocket *socket, GIOCondition condition, gpointer user_data)
+{
+    WhIpcClient *self = user_data;
+
+    _wh_ipc_client_flush(self);
+
+    return G_SOURCE_CONTINUE;
+}
+
+void
+wh_ipc_client_send(WhIpcClient *self, const gchar *message)
+{
+    if ( self->closed )
+        return;
+
+    g_string_append(self->out, message);
+    g_string_append_c(self->out, '\n');
+    if ( self->out_source == NULL )
+        _wh_ipc_client_flush(self);
+}
+
+void
+wh_ipc_client_send_fd(WhIpcClient *self, const gchar *message, int fd)
+{
+    if ( self->closed )
+        return;
+
+    WhIpcClientFd *data;
+    data = g_slice_new(WhIpcClientFd);
+    data->offset = self->out->len;
+    data->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if ( data->fd < 0 )
+    {
+        g_slice_free(WhIpcClientFd, data);
+        wh_ipc_client_send(self, "{\"success\":false,\"error\":\"no file descriptor\"}");
+        return;
+    }
+    g_queue_push_tail(self->fds, data);
+
+    wh_ipc_client_send(self, message);
+}
+
+static void
+_wh_ipc_client_subscribe(WhIpcClient *self, const gchar *topic)
+{
+    if ( g_hash_table_contains(self->topics, topic) )
+        return;
+
+    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(self->ipc->subscribers, topic));
+    g_hash_table_insert(self->ipc->subscribers, g_strdup(topic), GUINT_TO_POINTER(count + 1));
+    g_hash_table_add(self->topics, g_strdup(topic));
+}
+
+static void
+_wh_ipc_client_handle(WhIpcClient *self, gchar *line)
+{
+    gchar *args;
+
+    args = strchr(line, ' ');
+    if ( args != NULL )
+        *args++ = '\0';
+
+    if ( g_strcmp0(line, "subscribe") == 0 )
+    {
+        if ( args == NULL )
+        {
+            wh_ipc_client_send(self, "{\"success\":false,\"error\":\"missing topic\"}");
+            return;
+        }
+        _wh_ipc_client_subscribe(self, args);
+        wh_ipc_client_send(self, "{\"success\":true}");
+        return;
+    }
+
+    if ( g_strcmp0(line, "command") == 0 )
+    {
+        WhCommand *command = NULL;
+
+        if ( args != NULL )
+            command = wh_command_parse(wh_core_get_commands(self->ipc->core), g_strdup(args));
+        if ( command == NULL )
+        {
+            wh_ipc_client_send(self, "{\"success\":false,\"error\":\"invalid command\"}");
+            return;
+        }
+        wh_latency_begin(wh_core_get_latency(self->ipc->core), args, FALSE);
+        /* IPC has no seat of its own, act as the one last used */
+        wh_command_call(command, wh_seats_get_current(wh_core_get_seats(self->ipc->core)));
+        wh_command_free(command);
+        wh_ipc_client_send(self, "{\"success\":true}");
+        return;
+    }
+
+    WhIpcHandlerData *handler;
+    handler = g_hash_table_lookup(self->ipc->handlers, line);
+    if ( handler == NULL )
+    {
+        wh_ipc_client_send(self, "{\"success\":false,\"error\":\"unknown request\"}");
+        return;
+    }
+
+    handler->handler(handler->user_data, self, args);
+}
+
+static void
+_wh_ipc_client_handle_lines(WhIpcClient *self)
+{
+    gchar *eol;
+    while ( ( ! self->closed ) && ( ( eol = memchr(self->in->str, '\n', self->in->len) ) != NULL ) )
+    {
+        *eol = '\0';
+        _wh_ipc_client_handle(self, self->in->str);
+        g_string_erase(self->in, 0, eol - self->in->str + 1);
+    }
+}
+
+static gboolean
+_wh_ipc_client_in(GSocket *socket, GIOCondition condition, gpointer user_data)
+{
+    WhIpcClient *self = user_data;
+    gchar buffer[1024];
+    gssize size;
+    GError *error = NULL;
+
+    /*
+     * A client may write its request and hang up right away,
+     * so we read everything that is left before closing
+     */
+    for ( ;; )
+    {
+        size = g_socket_receive(socket, buffer, sizeof(buffer), NULL, &error);
+        if ( size < 0 )
+        {
+            if ( g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK) )
+            {
+                g_clear_error(&error);
+                if ( condition & ( G_IO_HUP | G_IO_ERR ) )
+                    goto close;
+                return G_SOURCE_CONTINUE;
+            }
+            g_debug("IPC client read failed: %s", error->message);
+            g_clear_error(&error);
+            goto close;
+        }
+        if ( size == 0 )
+            break;
+
+        g_string_append_len(self->in, buffer, size);
+        _wh_ipc_client_handle_lines(self);
+        if ( self->closed )
+            return G_SOURCE_REMOVE;
+
+        if ( self->in->len > WH_IPC_MAX_LINE )
+        {
+            wh_ipc_client_send(self, "{\"success\":false,\"error\":\"request too long\"}");
+            goto close;
+        }
+    }
+
+    /* A last request without its newline */
+    if ( self->in->len > 0 )
+    {
+        g_string_append_c(self->in, '\n');
+        _wh_ipc_client_handle_lines(self);
+    }
+
+close:
+    _wh_ipc_client_close(self);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_wh_ipc_incoming(GSocketService *service, GSocketConnection *connection, GObject *source_object, gpointer user_data)
+{
+    WhIpc *ipc = user_data;
+    WhIpcClient *self;
+
+    self = g_new0(WhIpcClient, 1);
+    self->ipc = ipc;
+    self->connection = g_object_ref(connection);
+    self->socket = g_socket_connection_get_socket(self->connection);
+    self->in = g_string_new("");
+    self->out = g_string_new("");
+    self->fds = g_queue_new();
+    self->topics = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    g_socket_set_blocking(self->socket, FALSE);
+
+    self->in_source = g_socket_create_source(self->socket, G_IO_IN | G_IO_HUP | G_IO_ERR, NULL);
+    g_source_set_callback(self->in_source, (GSourceFunc) _wh_ipc_client_in, self, NULL);
+    g_source_attach(self->in_source, NULL);
+
+    self->ipc->clients = g_list_prepend(self->ipc->clients, self);
+    self->link = self->ipc->clients;
+
+    return TRUE;
+}
+
+gboolean
+wh_ipc_has_subscribers(WhIpc *self, const gchar *topic)
+{
+    if ( self == NULL )
+        return FALSE;
+    return g_hash_table_contains(self->subscribers, topic);
+}
+
+void
+wh_ipc_broadcast(WhIpc *self, const gchar *topic, const gchar *message)
+{
+    if ( ! wh_ipc_has_subscribers(self, topic) )
+        return;
+
+    GList *client_, *next;
+    for ( client_ = self->clients ; client_ != NULL ; client_ = next )
+    {
+        WhIpcClient *client = client_->data;
+        next = g_list_next(client_);
+
+        if ( g_hash_table_contains(client->topics, topic) )
+            wh_ipc_client_send(client, message);
+    }
+}
+
+void
+wh_ipc_add_handler(WhIpc *self, const gchar *name, WhIpcHandler handler, gpointer user_data)
+{
+    WhIpcHandlerData *data;
+
+    if ( self == NULL )
+        return;
+
+    data = g_slice_new(WhIpcHandlerData);
+    data->handler = handler;
+    data->user_data = user_data;
+
+    g_hash_table_insert(self->handlers, g_strdup(name), data);
+}
+
+static void
+_wh_ipc_handler_free(gpointer data)
+{
+    g_slice_free(WhIpcHandlerData, data);
+}
+
+WhIpc *
+wh_ipc_new(WhCore *core, const gchar *runtime_dir, const gchar *socket_name)
+{
+    WhIpc *self;
+    GSocketAddress *address;
+    GError *error = NULL;
+
+    self = g_new0(WhIpc, 1);
+    self->core = core;
+
+    self->path = g_strdup_printf("%s/%s.ipc", runtime_dir, socket_name);
+    self->handlers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_ipc_handler_free);
+    self->subscribers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    g_unlink(self->path);
+    address = g_unix_socket_address_new(self->path);
+    self->service = g_socket_service_new();
+    if ( ! g_socket_listener_add_address(G_SOCKET_LISTENER(self->service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error) )
+    {
+        g_warning("Couldn't listen on IPC socket '%s': %s", self->path, error->message);
+        g_clear_error(&error);
+        g_object_unref(address);
+        wh_ipc_free(self);
+        return NULL;
+    }
+    g_object_unref(address);
+
+    g_signal_connect(self->service, "incoming", G_CALLBACK(_wh_ipc_incoming), self);
+    g_socket_service_start(self->service);
+
+    g_setenv("WAYHOUSE_IPC", self->path, TRUE);
+
+    return self;
+}
+
+void
+wh_ipc_free(WhIpc *self)
+{
+    if ( self == NULL )
+        return;
+
+    while ( self->clients != NULL )
+        _wh_ipc_client_close(self->clients->data);
+
+    g_socket_service_stop(self->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+    g_object_unref(self->service);
+    g_unlink(self->path);
+
+    g_hash_table_unref(self->subscribers);
+    g_hash_table_unref(self->handlers);
+
+    g_free(self->path);
+
+    g_free(self);
+}
@@ -0,0 +1,42 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_IPC_H__
+#define __WAYHOUSE_IPC_H__
+
+#include "types.h"
+
+typedef void (*WhIpcHandler)(gpointer user_data, WhIpcClient *client, const gchar *args);
+
+WhIpc *wh_ipc_new(WhCore *core, const gchar *runtime_dir, const gchar *socket_name);
+void wh_ipc_free(WhIpc *ipc);
+
+void wh_ipc_add_handler(WhIpc *ipc, const gchar *name, WhIpcHandler handler, gpointer user_data);
+gboolean wh_ipc_has_subscribers(WhIpc *ipc, const gchar *topic);
+void wh_ipc_broadcast(WhIpc *ipc, const gchar *topic, const gchar *message);
+
+void wh_ipc_client_send(WhIpcClient *client, const gchar *message);
+void wh_ipc_client_send_fd(WhIpcClient *client, const gchar *message, int fd);
+
+void wh_ipc_json_append_string(GString *string, const gchar *value);
+
+#endif /* __WAYHOUSE_IPC_H__ */
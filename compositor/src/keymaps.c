@@ -0,0 +1,362 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <xkbcommon/xkbcommon.h>
+
+#include <wayland-server.h>
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "seats.h"
+#include "keymaps.h"
+
+/*
+ * Compiling a keymap from RMLVO names means parsing a good chunk of
+ * xkeyboard-config, which is slow. We keep the serialised result on
+ * disk so the next time it is only a single file to parse.
+ */
+#define WH_KEYMAPS_CACHE_VERSION 1
+
+struct _WhKeymaps {
+    WhCore *core;
+    gchar *dir;
+    GHashTable *keymaps;
+    GHashTable *alternatives;
+    GQueue precompile;
+    guint precompile_source;
+};
+
+typedef struct {
+    gchar *name;
+    gchar *layout;
+    gchar *variant;
+} WhKeymapsAlternative;
+
+static void
+_wh_keymaps_alternative_free(gpointer data)
+{
+    WhKeymapsAlternative *self = data;
+
+    g_free(self->variant);
+    g_free(self->layout);
+    g_free(self->name);
+
+    g_slice_free(WhKeymapsAlternative, self);
+}
+
+static void
+_wh_keymaps_key_field(GString *key, const gchar *value, const gchar *env)
+{
+    /* libxkbcommon falls back to the environment for missing names */
+    if ( value == NULL )
+        value = g_getenv(env);
+    g_string_append_printf(key, "%s\n", ( value != NULL ) ? value : "");
+}
+
+static gchar *
+_wh_keymaps_key(WhKeymaps *self, struct xkb_context *context, const struct xkb_rule_names *names)
+{
+    GString *key;
+
+    key = g_string_new(NULL);
+    g_string_append_printf(key, "%d\n%s\n", WH_KEYMAPS_CACHE_VERSION, XKEYBOARD_CONFIG_VERSION);
+    _wh_keymaps_key_field(key, names->rules, "XKB_DEFAULT_RULES");
+    _wh_keymaps_key_field(key, names->model, "XKB_DEFAULT_MODEL");
+    _wh_keymaps_key_field(key, names->layout, "XKB_DEFAULT_LAYOUT");
+    _wh_keymaps_key_field(key, names->variant, "XKB_DEFAULT_VARIANT");
+    _wh_keymaps_key_field(key, names->options, "XKB_DEFAULT_OPTIONS");
+
+    /*
+     * The build-time version does not follow distribution upgrades,
+     * the rules file does
+     */
+    const gchar *rules = names->rules;
+    if ( rules == NULL )
+        rules = g_getenv("XKB_DEFAULT_RULES");
+    if ( rules == NULL )
+        rules = "evdev";
+
+    guint i, l = xkb_context_num_include_paths(context);
+    for ( i = 0 ; i < l ; ++i )
+    {
+        gchar *path;
+        GStatBuf st;
+
+        path = g_build_filename(xkb_context_include_path_get(context, i), "rules", rules, NULL);
+        if ( g_stat(path, &st) == 0 )
+            g_string_append_printf(key, "%s %" G_GUINT64_FORMAT " %" G_GINT64_FORMAT ".%09ld %" G_GINT64_FORMAT "\n", path, (guint64) st.st_ino, (gint64) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec, (gint64) st.st_size);
+        g_free(path);
+    }
+
+    gchar *checksum;
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key->str, key->len);
+    g_string_free(key, TRUE);
+
+    return checksum;
+}
+
+static struct xkb_keymap *
+_wh_keymaps_load(WhKeymaps *self, struct xkb_context *context, const gchar *path)
+{
+    struct xkb_keymap *keymap;
+    gchar *contents;
+
+    if ( ! g_file_get_contents(path, &contents, NULL, NULL) )
+        return NULL;
+
+    keymap = xkb_keymap_new_from_string(context, contents, XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if ( keymap == NULL )
+        g_debug("Keymap cache '%s' is invalid", path);
+    g_free(contents);
+
+    return keymap;
+}
+
+static void
+_wh_keymaps_save(WhKeymaps *self, struct xkb_keymap *keymap, const gchar *path)
+{
+    gchar *contents;
+    GError *error = NULL;
+
+    contents = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if ( contents == NULL )
+        return;
+
+    if ( g_mkdir_with_parents(self->dir, 0700) < 0 )
+        g_warning("Could not create the cache directory '%s': %s", self->dir, g_strerror(errno));
+    else if ( ! g_file_set_contents(path, contents, -1, &error) )
+    {
+        g_warning("Could not write the keymap cache '%s': %s", path, error->message);
+        g_error_free(error);
+    }
+
+    free(contents);
+}
+
+struct xkb_keymap *
+wh_keymaps_get(WhKeymaps *self, const struct xkb_rule_names *names)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    struct xkb_context *context = compositor->xkb_context;
+    struct xkb_keymap *keymap;
+    gchar *key;
+
+    key = _wh_keymaps_key(self, context, names);
+    keymap = g_hash_table_lookup(self->keymaps, key);
+    if ( keymap != NULL )
+    {
+        g_free(key);
+        return keymap;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    gchar *filename, *path;
+
+    filename = g_strdup_printf("%s.xkb", key);
+    path = g_build_filename(self->dir, filename, NULL);
+    g_free(filename);
+
+    keymap = _wh_keymaps_load(self, context, path);
+    if ( keymap != NULL )
+        g_debug("Keymap %s (%s) loaded from cache in %" G_GINT64_FORMAT "µs", names->layout, ( names->variant != NULL ) ? names->variant : "", g_get_monotonic_time() - start);
+    else
+    {
+        keymap = xkb_keymap_new_from_names(context, names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        if ( keymap != NULL )
+        {
+            g_debug("Keymap %s (%s) compiled in %" G_GINT64_FORMAT "µs", names->layout, ( names->variant != NULL ) ? names->variant : "", g_get_monotonic_time() - start);
+            _wh_keymaps_save(self, keymap, path);
+        }
+    }
+    g_free(path);
+
+    if ( keymap == NULL )
+    {
+        g_warning("Could not compile keymap %s (%s)", names->layout, ( names->variant != NULL ) ? names->variant : "");
+        g_free(key);
+        return NULL;
+    }
+
+    g_hash_table_insert(self->keymaps, key, keymap);
+    return keymap;
+}
+
+static struct xkb_keymap *
+_wh_keymaps_get_alternative(WhKeymaps *self, const gchar *name)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    struct xkb_rule_names names = compositor->xkb_names;
+
+    if ( g_strcmp0(name, WH_KEYMAPS_DEFAULT) != 0 )
+    {
+        WhKeymapsAlternative *alternative;
+
+        alternative = g_hash_table_lookup(self->alternatives, name);
+        if ( alternative == NULL )
+            return NULL;
+        names.layout = alternative->layout;
+        names.variant = alternative->variant;
+    }
+
+    return wh_keymaps_get(self, &names);
+}
+
+static gboolean
+_wh_keymaps_precompile(gpointer user_data)
+{
+    WhKeymaps *self = user_data;
+    gchar *name;
+
+    /* One keymap per iteration to keep the loop responsive */
+    name = g_queue_pop_head(&self->precompile);
+    if ( name != NULL )
+    {
+        _wh_keymaps_get_alternative(self, name);
+        g_free(name);
+    }
+
+    if ( ! g_queue_is_empty(&self->precompile) )
+        return G_SOURCE_CONTINUE;
+
+    self->precompile_source = 0;
+    return G_SOURCE_REMOVE;
+}
+
+WhKeymaps *
+wh_keymaps_new(WhCore *core)
+{
+    WhKeymaps *self;
+
+    self = g_new0(WhKeymaps, 1);
+    self->core = core;
+
+    self->dir = g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, "keymaps", NULL);
+    self->keymaps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) xkb_keymap_unref);
+    self->alternatives = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _wh_keymaps_alternative_free);
+    g_queue_init(&self->precompile);
+
+    return self;
+}
+
+void
+wh_keymaps_free(WhKeymaps *self)
+{
+    if ( self->precompile_source > 0 )
+        g_source_remove(self->precompile_source);
+    g_queue_foreach(&self->precompile, (GFunc) g_free, NULL);
+    g_queue_clear(&self->precompile);
+
+    g_hash_table_unref(self->alternatives);
+    g_hash_table_unref(self->keymaps);
+
+    g_free(self->dir);
+
+    g_free(self);
+}
+
+void
+wh_keymaps_set_alternatives(WhKeymaps *self, const gchar * const *alternatives)
+{
+    const gchar * const *alternative;
+
+    g_hash_table_remove_all(self->alternatives);
+    g_queue_foreach(&self->precompile, (GFunc) g_free, NULL);
+    g_queue_clear(&self->precompile);
+
+    /*
+     * The default keymap is compiled by weston directly,
+     * we want it in our cache for switching back
+     */
+    g_queue_push_tail(&self->precompile, g_strdup(WH_KEYMAPS_DEFAULT));
+
+    for ( alternative = alternatives ; ( alternative != NULL ) && ( *alternative != NULL ) ; ++alternative )
+    {
+        WhKeymapsAlternative *self_alternative;
+        const gchar *variant;
+
+        /* Syntax is "layout" or "layout(variant)" */
+        self_alternative = g_slice_new0(WhKeymapsAlternative);
+        self_alternative->name = g_strdup(*alternative);
+        variant = strchr(*alternative, '(');
+        if ( ( variant != NULL ) && g_str_has_suffix(variant, ")") )
+        {
+            self_alternative->layout = g_strndup(*alternative, variant - *alternative);
+            self_alternative->variant = g_strndup(variant + 1, strlen(variant) - 2);
+        }
+        else
+            self_alternative->layout = g_strdup(*alternative);
+
+        g_hash_table_replace(self->alternatives, self_alternative->name, self_alternative);
+        g_queue_push_tail(&self->precompile, g_strdup(*alternative));
+    }
+
+    if ( self->precompile_source == 0 )
+        self->precompile_source = g_idle_add_full(G_PRIORITY_LOW, _wh_keymaps_precompile, self, NULL);
+}
+
+void
+wh_keymaps_switch(WhKeymaps *self, WhSeat *seat, const gchar *name)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    struct xkb_keymap *keymap;
+
+    if ( ( g_strcmp0(name, WH_KEYMAPS_DEFAULT) != 0 ) && ( ! g_hash_table_contains(self->alternatives, name) ) )
+    {
+        g_warning("Unknown keymap %s", name);
+        return;
+    }
+
+    keymap = _wh_keymaps_get_alternative(self, name);
+    if ( keymap == NULL )
+        return;
+
+    struct weston_seat *weston_seat;
+
+    /* Each seat has its own keyboard layout */
+    if ( seat != NULL )
+    {
+        g_debug("Switch to keymap %s", name);
+        weston_seat = wh_seat_get_weston_seat(seat);
+        if ( weston_seat_get_keyboard(weston_seat) != NULL )
+            weston_seat_update_keymap(weston_seat, keymap);
+        return;
+    }
+
+    /* Nobody asked in particular, switch them all */
+    g_debug("Switch all seats to keymap %s", name);
+    wl_list_for_each(weston_seat, &compositor->seat_list, link)
+    {
+        if ( weston_seat_get_keyboard(weston_seat) != NULL )
+            weston_seat_update_keymap(weston_seat, keymap);
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_KEYMAPS_H__
+#define __WAYHOUSE_KEYMAPS_H__
+
+#include "types.h"
+
+struct xkb_keymap;
+struct xkb_rule_names;
+
+#define WH_KEYMAPS_DEFAULT "default"
+
+WhKeymaps *wh_keymaps_new(WhCore *core);
+void wh_keymaps_free(WhKeymaps *keymaps);
+
+struct xkb_keymap *wh_keymaps_get(WhKeymaps *keymaps, const struct xkb_rule_names *names);
+void wh_keymaps_set_alternatives(WhKeymaps *keymaps, const gchar * const *alternatives);
+void wh_keymaps_switch(WhKeymaps *keymaps, WhSeat *seat, const gchar *name);
+
+#endif /* __WAYHOUSE_KEYMAPS_H__ */
@@ -0,0 +1,420 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "ipc.h"
+#include "latency.h"
+
+/*
+ * Latency tracing
+ *
+ * One action at a time is followed from the input event that
+ * triggered it to the frame that shows its result:
+ *     input      the libinput event time
+ *     dispatch   the binding or IPC command running
+ *     configure  the first client asked to resize
+ *     commit     that client committing its new buffer
+ *     repaint    the output repaint picking it up
+ *     present    the vblank that repaint targets
+ * Actions that do not configure anyone complete on the next repaint.
+ *
+ * Completed traces are added to a histogram for the action and one
+ * for the client, both served over IPC as "latency".
+ */
+
+#define WH_LATENCY_TRACE_EXPIRY (G_USEC_PER_SEC)
+#define WH_LATENCY_BUCKETS 24
+
+typedef enum {
+    WH_LATENCY_STAGE_INPUT,
+    WH_LATENCY_STAGE_DISPATCH,
+    WH_LATENCY_STAGE_CONFIGURE,
+    WH_LATENCY_STAGE_COMMIT,
+    WH_LATENCY_STAGE_REPAINT,
+    WH_LATENCY_STAGE_PRESENT,
+    _WH_LATENCY_STAGE_SIZE
+} WhLatencyStage;
+
+static const gchar * const _wh_latency_stages[_WH_LATENCY_STAGE_SIZE] = {
+    [WH_LATENCY_STAGE_INPUT]     = "input",
+    [WH_LATENCY_STAGE_DISPATCH]  = "dispatch",
+    [WH_LATENCY_STAGE_CONFIGURE] = "configure",
+    [WH_LATENCY_STAGE_COMMIT]    = "commit",
+    [WH_LATENCY_STAGE_REPAINT]   = "repaint",
+    [WH_LATENCY_STAGE_PRESENT]   = "present",
+};
+
+typedef struct {
+    guint64 count;
+    /* Time spent reaching each stage from the previous one, in µs */
+    gint64 stages[_WH_LATENCY_STAGE_SIZE];
+    guint64 stages_count[_WH_LATENCY_STAGE_SIZE];
+    /* End-to-end, bucket n counts traces under 2^n µs */
+    guint64 buckets[WH_LATENCY_BUCKETS];
+} WhLatencyHistogram;
+
+typedef struct {
+    WhLatency *latency;
+    struct weston_output *output;
+    struct wl_listener frame_listener;
+} WhLatencyOutput;
+
+struct _WhLatency {
+    WhCore *core;
+    gint64 input;
+    GHashTable *actions;
+    GHashTable *clients;
+    GHashTable *outputs;
+    struct wl_listener output_created_listener;
+    struct wl_listener output_destroyed_listener;
+    struct {
+        gboolean active;
+        gchar *name;
+        gchar *client;
+        WhLatencyStage stage;
+        gint64 times[_WH_LATENCY_STAGE_SIZE];
+        gboolean reached[_WH_LATENCY_STAGE_SIZE];
+    } trace;
+};
+
+static gint64
+_wh_latency_timespec_to_usec(const struct timespec *time)
+{
+    return time->tv_sec * G_USEC_PER_SEC + time->tv_nsec / 1000;
+}
+
+/* Repaint times are only known in the presentation clock, stamp everything with it */
+static gint64
+_wh_latency_now(WhLatency *self)
+{
+    struct timespec now;
+
+    weston_compositor_read_presentation_clock(wh_core_get_compositor(self->core), &now);
+    return _wh_latency_timespec_to_usec(&now);
+}
+
+static void
+_wh_latency_histogram_add(GHashTable *histograms, const gchar *key, const gint64 *times, const gboolean *reached)
+{
+    WhLatencyHistogram *histogram;
+    WhLatencyStage stage, previous = _WH_LATENCY_STAGE_SIZE;
+    gint64 total = 0;
+
+    histogram = g_hash_table_lookup(histograms, key);
+    if ( histogram == NULL )
+    {
+        histogram = g_slice_new0(WhLatencyHistogram);
+        g_hash_table_insert(histograms, g_strdup(key), histogram);
+    }
+
+    for ( stage = 0 ; stage < _WH_LATENCY_STAGE_SIZE ; ++stage )
+    {
+        if ( ! reached[stage] )
+            continue;
+        if ( previous != _WH_LATENCY_STAGE_SIZE )
+        {
+            histogram->stages[stage] += times[stage] - times[previous];
+            ++histogram->stages_count[stage];
+        }
+        else
+            total = times[stage];
+        previous = stage;
+    }
+    total = times[WH_LATENCY_STAGE_PRESENT] - total;
+
+    ++histogram->count;
+    ++histogram->buckets[MIN(g_bit_storage(MAX(total, 0)), WH_LATENCY_BUCKETS - 1)];
+}
+
+static void
+_wh_latency_histogram_free(gpointer data)
+{
+    g_slice_free(WhLatencyHistogram, data);
+}
+
+static void
+_wh_latency_trace_reset(WhLatency *self)
+{
+    g_free(self->trace.client);
+    g_free(self->trace.name);
+    memset(&self->trace, 0, sizeof(self->trace));
+}
+
+static gboolean
+_wh_latency_trace_alive(WhLatency *self)
+{
+    if ( ! self->trace.active )
+        return FALSE;
+
+    if ( ( _wh_latency_now(self) - self->trace.times[WH_LATENCY_STAGE_DISPATCH] ) < WH_LATENCY_TRACE_EXPIRY )
+        return TRUE;
+
+    /* The client never answered */
+    _wh_latency_trace_reset(self);
+    return FALSE;
+}
+
+static void
+_wh_latency_trace_mark(WhLatency *self, WhLatencyStage stage, gint64 time)
+{
+    self->trace.stage = stage;
+    self->trace.times[stage] = time;
+    self->trace.reached[stage] = TRUE;
+}
+
+void
+wh_latency_input(WhLatency *self, guint32 time)
+{
+    guint32 delta;
+
+    /*
+     * Event times are CLOCK_MONOTONIC milliseconds, wrapping at 32 bits:
+     * take the event age there and carry it over to our clock
+     */
+    delta = (guint32) ( g_get_monotonic_time() / 1000 ) - time;
+    if ( delta > 10 * 1000 )
+        delta = 0;
+
+    self->input = _wh_latency_now(self) - (gint64) delta * 1000;
+}
+
+void
+wh_latency_begin(WhLatency *self, const gchar *name, gboolean from_input)
+{
+    _wh_latency_trace_reset(self);
+
+    self->trace.active = TRUE;
+    self->trace.name = g_strdup(name);
+    if ( from_input && ( self->input > 0 ) )
+        _wh_latency_trace_mark(self, WH_LATENCY_STAGE_INPUT, self->input);
+    _wh_latency_trace_mark(self, WH_LATENCY_STAGE_DISPATCH, _wh_latency_now(self));
+}
+
+void
+wh_latency_configure(WhLatency *self, const gchar *client)
+{
+    if ( ( ! _wh_latency_trace_alive(self) ) || ( self->trace.stage != WH_LATENCY_STAGE_DISPATCH ) )
+        return;
+
+    self->trace.client = g_strdup(( client != NULL ) ? client : "");
+    _wh_latency_trace_mark(self, WH_LATENCY_STAGE_CONFIGURE, _wh_latency_now(self));
+}
+
+void
+wh_latency_commit(WhLatency *self, const gchar *client)
+{
+    if ( ( ! _wh_latency_trace_alive(self) ) || ( self->trace.stage != WH_LATENCY_STAGE_CONFIGURE ) )
+        return;
+
+    if ( g_strcmp0(self->trace.client, ( client != NULL ) ? client : "") != 0 )
+        return;
+
+    _wh_latency_trace_mark(self, WH_LATENCY_STAGE_COMMIT, _wh_latency_now(self));
+}
+
+static void
+_wh_latency_output_frame(struct wl_listener *listener, void *data)
+{
+    WhLatencyOutput *output = wl_container_of(listener, output, frame_listener);
+    WhLatency *self = output->latency;
+    struct weston_compositor *compositor = output->output->compositor;
+    gint64 repaint;
+
+    if ( ! _wh_latency_trace_alive(self) )
+        return;
+
+    switch ( self->trace.stage )
+    {
+    case WH_LATENCY_STAGE_DISPATCH:
+    case WH_LATENCY_STAGE_COMMIT:
+    break;
+    default:
+        return;
+    }
+
+    /* The repaint timer fires repaint_msec before the vblank it targets */
+#if LIBWESTON_MAJOR >= 3
+    repaint = _wh_latency_timespec_to_usec(&output->output->next_repaint);
+#else /* ! LIBWESTON_MAJOR >= 3 */
+    repaint = _wh_latency_now(self);
+#endif /* ! LIBWESTON_MAJOR >= 3 */
+    _wh_latency_trace_mark(self, WH_LATENCY_STAGE_REPAINT, repaint);
+    _wh_latency_trace_mark(self, WH_LATENCY_STAGE_PRESENT, repaint + compositor->repaint_msec * 1000);
+
+    _wh_latency_histogram_add(self->actions, self->trace.name, self->trace.times, self->trace.reached);
+    if ( self->trace.client != NULL )
+        _wh_latency_histogram_add(self->clients, self->trace.client, self->trace.times, self->trace.reached);
+
+    _wh_latency_trace_reset(self);
+}
+
+static void
+_wh_latency_output_new(WhLatency *latency, struct weston_output *woutput)
+{
+    WhLatencyOutput *self;
+
+    self = g_slice_new0(WhLatencyOutput);
+    self->latency = latency;
+    self->output = woutput;
+
+    self->frame_listener.notify = _wh_latency_output_frame;
+    wl_signal_add(&woutput->frame_signal, &self->frame_listener);
+
+    g_hash_table_insert(latency->outputs, woutput, self);
+}
+
+static void
+_wh_latency_output_free(gpointer data)
+{
+    WhLatencyOutput *self = data;
+
+    wl_list_remove(&self->frame_listener.link);
+
+    g_slice_free(WhLatencyOutput, self);
+}
+
+static void
+_wh_latency_output_created(struct wl_listener *listener, void *data)
+{
+    WhLatency *self = wl_container_of(listener, self, output_created_listener);
+
+    _wh_latency_output_new(self, data);
+}
+
+static void
+_wh_latency_output_destroyed(struct wl_listener *listener, void *data)
+{
+    WhLatency *self = wl_container_of(listener, self, output_destroyed_listener);
+
+    g_hash_table_remove(self->outputs, data);
+}
+
+WhLatency *
+wh_latency_new(WhCore *core)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(core);
+    WhLatency *self;
+
+    self = g_new0(WhLatency, 1);
+    self->core = core;
+
+    self->actions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_latency_histogram_free);
+    self->clients = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_latency_histogram_free);
+    self->outputs = g_hash_table_new_full(NULL, NULL, NULL, _wh_latency_output_free);
+
+    struct weston_output *output;
+    wl_list_for_each(output, &compositor->output_list, link)
+        _wh_latency_output_new(self, output);
+
+    self->output_created_listener.notify = _wh_latency_output_created;
+    wl_signal_add(&compositor->output_created_signal, &self->output_created_listener);
+    self->output_destroyed_listener.notify = _wh_latency_output_destroyed;
+    wl_signal_add(&compositor->output_destroyed_signal, &self->output_destroyed_listener);
+
+    return self;
+}
+
+void
+wh_latency_free(WhLatency *self)
+{
+    if ( self == NULL )
+        return;
+
+    wl_list_remove(&self->output_destroyed_listener.link);
+    wl_list_remove(&self->output_created_listener.link);
+
+    _wh_latency_trace_reset(self);
+
+    g_hash_table_unref(self->outputs);
+    g_hash_table_unref(self->clients);
+    g_hash_table_unref(self->actions);
+
+    g_free(self);
+}
+
+static void
+_wh_latency_ipc_append_histograms(GString *json, GHashTable *histograms)
+{
+    GHashTableIter iter;
+    const gchar *key;
+    WhLatencyHistogram *histogram;
+    WhLatencyStage stage;
+    gboolean first = TRUE;
+    guint i;
+
+    g_string_append_c(json, '{');
+    g_hash_table_iter_init(&iter, histograms);
+    while ( g_hash_table_iter_next(&iter, (gpointer *) &key, (gpointer *) &histogram) )
+    {
+        if ( ! first )
+            g_string_append_c(json, ',');
+        first = FALSE;
+
+        wh_ipc_json_append_string(json, key);
+        g_string_append_printf(json, ":{\"count\":%" G_GUINT64_FORMAT ",\"stages\":{", histogram->count);
+        gboolean first_stage = TRUE;
+        for ( stage = 0 ; stage < _WH_LATENCY_STAGE_SIZE ; ++stage )
+        {
+            if ( histogram->stages_count[stage] == 0 )
+                continue;
+            g_string_append_printf(json, "%s\"%s\":%" G_GINT64_FORMAT, first_stage ? "" : ",", _wh_latency_stages[stage], histogram->stages[stage] / (gint64) histogram->stages_count[stage]);
+            first_stage = FALSE;
+        }
+        g_string_append(json, "},\"histogram\":[");
+        gboolean first_bucket = TRUE;
+        for ( i = 0 ; i < WH_LATENCY_BUCKETS ; ++i )
+        {
+            if ( histogram->buckets[i] == 0 )
+                continue;
+            g_string_append_printf(json, "%s[%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT "]", first_bucket ? "" : ",", (guint64) 1 << i, histogram->buckets[i]);
+            first_bucket = FALSE;
+        }
+        g_string_append(json, "]}");
+    }
+    g_string_append_c(json, '}');
+}
+
+void
+wh_latency_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhLatency *self = user_data;
+    GString *json;
+
+    json = g_string_new("{\"actions\":");
+    _wh_latency_ipc_append_histograms(json, self->actions);
+    g_string_append(json, ",\"clients\":");
+    _wh_latency_ipc_append_histograms(json, self->clients);
+    g_string_append_c(json, '}');
+
+    wh_ipc_client_send(client, json->str);
+    g_string_free(json, TRUE);
+}
@@ -31,44 +31,196 @@
 #include "types.h"
 #include "wayhouse.h"
 #include "containers.h"
+#include "snapshot.h"
 #include "outputs.h"
 
+#define WH_OUTPUTS_HOTPLUG_DELAY 500
+
 struct _WhOutputs {
     WhCore *core;
     struct wl_listener output_create_listener;
     struct wl_listener output_destroy_listener;
+    struct wl_listener output_moved_listener;
+    struct wl_listener output_resized_listener;
     GHashTable *outputs;
     GHashTable *outputs_by_name;
+    struct {
+        guint delay;
+        guint source;
+        gboolean controlling;
+        GHashTable *removed;
+        GHashTable *placements;
+    } hotplug;
 };
 
 struct _WhOutput {
     WhOutputs *outputs;
     struct weston_output *output;
+    gchar *name;
+    struct weston_geometry geometry;
     WhWorkspace *current;
+    GPtrArray *neighbours[WH_DIRECTION_TREE_MASK];
 };
 
-struct _WhContainer {
-    WhWorkspaces *workspaces;
-    enum { A, B} type;
+/*
+ * Adjacency graph
+ *
+ * For each edge of each output, the outputs lying past that edge,
+ * best candidate first: outputs sharing part of the edge before the
+ * others, then the closest ones, then the ones sharing the most
+ */
 
-    gboolean current;
-    GQueue *children;
-    GList *link;
-    GQueue *history;
-    GList *history_link;
+typedef struct {
+    WhOutput *output;
+    gint32 gap;
+    gint32 overlap;
+} WhOutputNeighbour;
 
-    gboolean visible;
-    WhContainer *parent;
-    guint layout;
-    struct weston_geometry geometry;
-};
+static gint
+_wh_output_neighbour_compare(gconstpointer a_, gconstpointer b_)
+{
+    const WhOutputNeighbour *a = a_, *b = b_;
+
+    if ( ( a->overlap > 0 ) != ( b->overlap > 0 ) )
+        return ( a->overlap > 0 ) ? -1 : 1;
+    if ( a->gap != b->gap )
+        return ( a->gap < b->gap ) ? -1 : 1;
+    if ( a->overlap != b->overlap )
+        return ( a->overlap > b->overlap ) ? -1 : 1;
+    return 0;
+}
 
-struct _WhWorkspace {
-    WhContainer container;
-    WhOutput *output;
-    gchar *name;
-    guint64 number;
-};
+static gboolean
+_wh_output_neighbour_check(struct weston_output *from, struct weston_output *to, WhDirection direction, WhOutputNeighbour *neighbour)
+{
+    gint32 start, end;
+
+    switch ( direction )
+    {
+    case WH_DIRECTION_LEFT:
+        neighbour->gap = from->x - ( to->x + to->width );
+    break;
+    case WH_DIRECTION_RIGHT:
+        neighbour->gap = to->x - ( from->x + from->width );
+    break;
+    case WH_DIRECTION_TOP:
+        neighbour->gap = from->y - ( to->y + to->height );
+    break;
+    case WH_DIRECTION_BOTTOM:
+        neighbour->gap = to->y - ( from->y + from->height );
+    break;
+    default:
+        g_return_val_if_reached(FALSE);
+    }
+    if ( neighbour->gap < 0 )
+        return FALSE;
+
+    if ( direction & WH_ORIENTATION_VERTICAL )
+    {
+        start = MAX(from->x, to->x);
+        end = MIN(from->x + from->width, to->x + to->width);
+    }
+    else
+    {
+        start = MAX(from->y, to->y);
+        end = MIN(from->y + from->height, to->y + to->height);
+    }
+    /* Negative when the outputs do not share the edge at all */
+    neighbour->overlap = end - start;
+
+    return TRUE;
+}
+
+static void
+_wh_outputs_update_graph(WhOutputs *self)
+{
+    GArray *candidates;
+    GHashTableIter iter, iter2;
+    WhOutput *output, *other;
+    WhDirection direction;
+    guint i;
+
+    candidates = g_array_new(FALSE, FALSE, sizeof(WhOutputNeighbour));
+
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+    {
+        for ( direction = 0 ; direction < WH_DIRECTION_TREE_MASK ; ++direction )
+        {
+            g_ptr_array_set_size(output->neighbours[direction], 0);
+            if ( ! output->output->enabled )
+                continue;
+
+            g_array_set_size(candidates, 0);
+            g_hash_table_iter_init(&iter2, self->outputs);
+            while ( g_hash_table_iter_next(&iter2, NULL, (gpointer *) &other) )
+            {
+                WhOutputNeighbour neighbour = { .output = other };
+
+                if ( ( other == output ) || ( ! other->output->enabled ) )
+                    continue;
+                if ( _wh_output_neighbour_check(output->output, other->output, direction, &neighbour) )
+                    g_array_append_val(candidates, neighbour);
+            }
+
+            g_array_sort(candidates, _wh_output_neighbour_compare);
+            for ( i = 0 ; i < candidates->len ; ++i )
+                g_ptr_array_add(output->neighbours[direction], g_array_index(candidates, WhOutputNeighbour, i).output);
+        }
+    }
+
+    g_array_free(candidates, TRUE);
+}
+
+/*
+ * Where the workspaces of a gone output lived,
+ * to put them back when it comes back
+ */
+typedef struct {
+    gchar **workspaces;
+    gchar *current;
+} WhOutputPlacement;
+
+static void
+_wh_output_placement_free(gpointer data)
+{
+    WhOutputPlacement *self = data;
+
+    g_free(self->current);
+    g_strfreev(self->workspaces);
+
+    g_slice_free(WhOutputPlacement, self);
+}
+
+static void
+_wh_output_attach(WhOutput *self)
+{
+    WhOutputs *outputs = self->outputs;
+    WhWorkspaces *workspaces = wh_core_get_workspaces(outputs->core);
+    WhOutputPlacement *placement;
+
+    placement = g_hash_table_lookup(outputs->hotplug.placements, self->name);
+    if ( ( placement == NULL ) || ( ! wh_workspaces_restore_output(workspaces, self, (const gchar * const *) placement->workspaces, placement->current) ) )
+        wh_workspaces_add_output(workspaces, self);
+    g_hash_table_remove(outputs->hotplug.placements, self->name);
+}
+
+static void
+_wh_output_detach(WhOutput *self)
+{
+    WhOutputs *outputs = self->outputs;
+    WhWorkspaces *workspaces = wh_core_get_workspaces(outputs->core);
+    WhOutputPlacement *placement;
+
+    placement = g_slice_new0(WhOutputPlacement);
+    placement->workspaces = wh_workspaces_get_output_workspaces(workspaces, self);
+    if ( self->current != NULL )
+        placement->current = g_strdup(wh_workspace_get_name(self->current));
+    g_hash_table_replace(outputs->hotplug.placements, g_strdup(self->name), placement);
+
+    wh_workspaces_remove_output(workspaces, self);
+    self->current = NULL;
+}
 
 void
 wh_outputs_control(WhOutputs *self, WhSeat *seat, WhStateChange state, const gchar *name)
@@ -79,43 +231,39 @@ wh_outputs_control(WhOutputs *self, WhSeat *seat, WhStateChange state, const gch
     if ( output == NULL )
         return;
 
+    if ( state == WH_STATE_TOGGLE )
+        state = output->output->enabled ? WH_STATE_DISABLE : WH_STATE_ENABLE;
+
+    /* Our own enable/disable are not hotplug events */
+    self->hotplug.controlling = TRUE;
     switch ( state )
     {
     case WH_STATE_ENABLE:
         if ( ! output->output->enabled )
         {
             weston_output_enable(output->output);
-            wh_workspaces_add_output(wh_core_get_workspaces(self->core), output);
+            _wh_output_attach(output);
+            _wh_outputs_update_graph(self);
         }
     break;
     case WH_STATE_DISABLE:
         if ( output->output->enabled )
         {
             weston_output_disable(output->output);
-            wh_workspaces_remove_output(wh_core_get_workspaces(self->core), output);
-            output->current = NULL;
+            _wh_output_detach(output);
+            _wh_outputs_update_graph(self);
         }
     break;
     case WH_STATE_TOGGLE:
-        if ( output->output->enabled )
-        {
-            weston_output_disable(output->output);
-            wh_workspaces_remove_output(wh_core_get_workspaces(self->core), output);
-            output->current = NULL;
-        }
-        else
-        {
-            weston_output_enable(output->output);
-            wh_workspaces_add_output(wh_core_get_workspaces(self->core), output);
-        }
-    break;
+        g_return_if_reached();
     }
+    self->hotplug.controlling = FALSE;
 }
 
 gboolean
 wh_output_set_current_workspace(WhOutput *self, WhWorkspace *workspace)
 {
-    g_debug("Output %s got workspace %s (previous %s)", self->output->name, workspace->name, self->current ? self->current->name : "none");
+    g_debug("Output %s got workspace %s (previous %s)", self->name, wh_workspace_get_name(workspace), self->current ? wh_workspace_get_name(self->current) : "none");
     if ( self->current == workspace )
         return FALSE;
 
@@ -123,13 +271,14 @@ wh_output_set_current_workspace(WhOutput *self, WhWorkspace *workspace)
         wh_workspace_hide(self->current);
     self->current = workspace;
     wh_workspace_show(self->current);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->outputs->core));
     return TRUE;
 }
 
 WhWorkspace *
 wh_output_get_current_workspace(WhOutput *self)
 {
-    g_debug("Output %s has current workspace workspace %s", self->output->name, self->current ? self->current->name : "none");
+    g_debug("Output %s has current workspace workspace %s", self->name, self->current ? wh_workspace_get_name(self->current) : "none");
     return self->current;
 }
 
@@ -141,11 +290,29 @@ _wh_output_new(WhOutputs *outputs, struct weston_output *output)
     self = g_new0(WhOutput, 1);
     self->outputs = outputs;
     self->output = output;
+    self->name = g_strdup(output->name);
+
+    WhDirection direction;
+    for ( direction = 0 ; direction < WH_DIRECTION_TREE_MASK ; ++direction )
+        self->neighbours[direction] = g_ptr_array_new();
 
     g_hash_table_insert(self->outputs->outputs, self->output, self);
-    g_hash_table_insert(self->outputs->outputs_by_name, self->output->name, self);
+    g_hash_table_insert(self->outputs->outputs_by_name, self->name, self);
+
+    _wh_output_attach(self);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->outputs->core));
+}
+
+static void
+_wh_output_release(WhOutput *self)
+{
+    WhDirection direction;
+    for ( direction = 0 ; direction < WH_DIRECTION_TREE_MASK ; ++direction )
+        g_ptr_array_unref(self->neighbours[direction]);
+
+    g_free(self->name);
 
-    wh_workspaces_add_output(wh_core_get_workspaces(self->outputs->core), self);
+    g_free(self);
 }
 
 static void
@@ -154,13 +321,18 @@ _wh_output_free(gpointer data)
     WhOutput *self = data;
 
     wh_workspaces_remove_output(wh_core_get_workspaces(self->outputs->core), self);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->outputs->core));
 
-    g_free(self);
+    _wh_output_release(self);
 }
 
 struct weston_geometry
 wh_output_get_geometry(WhOutput *self)
 {
+    /* Gone outputs keep their last geometry until their workspaces move */
+    if ( self->output == NULL )
+        return self->geometry;
+
     struct weston_geometry geometry = {
         .x = self->output->x,
         .y = self->output->y,
@@ -170,25 +342,160 @@ wh_output_get_geometry(WhOutput *self)
     return geometry;
 }
 
+const gchar *
+wh_output_get_name(WhOutput *self)
+{
+    return self->name;
+}
+
+void
+wh_outputs_fill_snapshot(WhOutputs *self, WhStateSnapshotData *data)
+{
+    GHashTableIter iter;
+    WhOutput *output;
+
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( ( data->n_outputs < WH_STATE_SNAPSHOT_MAX_OUTPUTS ) && g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+    {
+        WhStateSnapshotOutput *soutput = &data->outputs[data->n_outputs++];
+
+        g_strlcpy(soutput->name, output->output->name, sizeof(soutput->name));
+        soutput->x = output->output->x;
+        soutput->y = output->output->y;
+        soutput->width = output->output->width;
+        soutput->height = output->output->height;
+        soutput->workspace = WH_STATE_SNAPSHOT_NONE;
+    }
+}
+
+/*
+ * Hotplug
+ *
+ * Docks and KVM switches send bursts of disconnect/reconnect events.
+ * A gone output is kept aside, with its workspaces untouched, until the
+ * burst settles: if it comes back in time, it just gets its new
+ * weston_output. Only then are the workspaces of the outputs that stayed
+ * gone moved away, remembering where they lived.
+ */
+
+static gboolean
+_wh_outputs_hotplug_timeout(gpointer user_data)
+{
+    WhOutputs *self = user_data;
+    GHashTableIter iter;
+    WhOutput *output;
+
+    self->hotplug.source = 0;
+
+    /* Nowhere to move the workspaces to, wait for an output to show up */
+    if ( g_hash_table_size(self->outputs) == 0 )
+        return G_SOURCE_REMOVE;
+
+    g_hash_table_iter_init(&iter, self->hotplug.removed);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+    {
+        g_debug("Output %s is gone", output->name);
+        g_hash_table_iter_steal(&iter);
+        _wh_output_detach(output);
+        _wh_output_release(output);
+    }
+
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->core));
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_outputs_hotplug_schedule(WhOutputs *self)
+{
+    if ( self->hotplug.source > 0 )
+        g_source_remove(self->hotplug.source);
+    self->hotplug.source = g_timeout_add(self->hotplug.delay, _wh_outputs_hotplug_timeout, self);
+}
+
 static void
 _wh_outputs_output_created(struct wl_listener *listener, void *data)
 {
     WhOutputs *self = wl_container_of(listener, self, output_create_listener);
-    struct weston_output *output = data;
+    struct weston_output *woutput = data;
+    WhOutput *output;
+
+    if ( self->hotplug.controlling || g_hash_table_contains(self->outputs, woutput) )
+        return;
 
-    _wh_output_new(self, output);
+    output = g_hash_table_lookup(self->hotplug.removed, woutput->name);
+    if ( output != NULL )
+    {
+        g_debug("Output %s came back", output->name);
+        g_hash_table_steal(self->hotplug.removed, output->name);
+        output->output = woutput;
+        g_hash_table_insert(self->outputs, output->output, output);
+        g_hash_table_insert(self->outputs_by_name, output->name, output);
+
+        /* Only relayouts if the mode changed */
+        wh_workspaces_update_output(wh_core_get_workspaces(self->core), output);
+    }
+    else
+        _wh_output_new(self, woutput);
+
+    _wh_outputs_update_graph(self);
+    if ( g_hash_table_size(self->hotplug.removed) > 0 )
+        _wh_outputs_hotplug_schedule(self);
 }
 
 static void
 _wh_outputs_output_destroyed(struct wl_listener *listener, void *data)
 {
-    /* FIXME: we need a way to check that the output is gone for good or just disabled
     WhOutputs *self = wl_container_of(listener, self, output_destroy_listener);
-    struct weston_output *output = data;
+    struct weston_output *woutput = data;
+    WhOutput *output;
+
+    if ( self->hotplug.controlling )
+        return;
 
+    output = g_hash_table_lookup(self->outputs, woutput);
+    if ( output == NULL )
+        return;
+
+    output->geometry = wh_output_get_geometry(output);
+    output->output = NULL;
     g_hash_table_remove(self->outputs_by_name, output->name);
-    g_hash_table_remove(self->outputs, output);
-    */
+    g_hash_table_steal(self->outputs, woutput);
+    g_hash_table_insert(self->hotplug.removed, output->name, output);
+
+    WhDirection direction;
+    for ( direction = 0 ; direction < WH_DIRECTION_TREE_MASK ; ++direction )
+        g_ptr_array_set_size(output->neighbours[direction], 0);
+    _wh_outputs_update_graph(self);
+
+    _wh_outputs_hotplug_schedule(self);
+}
+
+static void
+_wh_outputs_output_moved(struct wl_listener *listener, void *data)
+{
+    WhOutputs *self = wl_container_of(listener, self, output_moved_listener);
+
+    _wh_outputs_update_graph(self);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->core));
+}
+
+static void
+_wh_outputs_output_resized(struct wl_listener *listener, void *data)
+{
+    WhOutputs *self = wl_container_of(listener, self, output_resized_listener);
+
+    _wh_outputs_update_graph(self);
+    wh_snapshot_invalidate(wh_core_get_snapshot(self->core));
+}
+
+void
+wh_outputs_set_hotplug_delay(WhOutputs *self, gint delay)
+{
+    /* Unset, use our default */
+    if ( delay < 0 )
+        delay = WH_OUTPUTS_HOTPLUG_DELAY;
+    self->hotplug.delay = delay;
 }
 
 WhOutputs *
@@ -201,12 +508,16 @@ wh_outputs_new(WhCore *core)
 
     self->outputs = g_hash_table_new_full(NULL, NULL, NULL, _wh_output_free);
     self->outputs_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+    self->hotplug.delay = WH_OUTPUTS_HOTPLUG_DELAY;
+    self->hotplug.removed = g_hash_table_new(g_str_hash, g_str_equal);
+    self->hotplug.placements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _wh_output_placement_free);
 
     struct weston_compositor *compositor = wh_core_get_compositor(self->core);
     struct weston_output *output;
 
     wl_list_for_each(output, &compositor->output_list, link)
         _wh_output_new(self, output);
+    _wh_outputs_update_graph(self);
 
     self->output_create_listener.notify = _wh_outputs_output_created;
     wl_signal_add(&compositor->output_created_signal, &self->output_create_listener);
@@ -214,6 +525,12 @@ wh_outputs_new(WhCore *core)
     self->output_destroy_listener.notify = _wh_outputs_output_destroyed;
     wl_signal_add(&compositor->output_destroyed_signal, &self->output_destroy_listener);
 
+    self->output_moved_listener.notify = _wh_outputs_output_moved;
+    wl_signal_add(&compositor->output_moved_signal, &self->output_moved_listener);
+
+    self->output_resized_listener.notify = _wh_outputs_output_resized;
+    wl_signal_add(&compositor->output_resized_signal, &self->output_resized_listener);
+
     return self;
 }
 
@@ -223,6 +540,17 @@ wh_outputs_free(WhOutputs *self)
     if ( self == NULL )
         return;
 
+    if ( self->hotplug.source > 0 )
+        g_source_remove(self->hotplug.source);
+
+    GHashTableIter iter;
+    WhOutput *output;
+    g_hash_table_iter_init(&iter, self->hotplug.removed);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+        _wh_output_release(output);
+    g_hash_table_unref(self->hotplug.removed);
+    g_hash_table_unref(self->hotplug.placements);
+
     g_hash_table_unref(self->outputs_by_name);
     g_hash_table_unref(self->outputs);
 
@@ -230,91 +558,37 @@ wh_outputs_free(WhOutputs *self)
 }
 
 WhOutput *
-wh_outputs_get(WhOutputs *self, WhOutput *current, WhDirection direction)
+wh_outputs_get_by_name(WhOutputs *self, const gchar *name)
 {
-    gint32 cx, cy, dx, dy, tx, ty, x, y, min, max, val;
-    gboolean vertical;
-
-    dx = current->output->width / 2;
-    dy = current->output->height / 2;
-    cx = current->output->x + dx;
-    cy = current->output->y + dy;
-    tx = G_MAXINT32;
-    ty = G_MAXINT32;
-
-    const gchar * const directions[] = {
-        [WH_DIRECTION_TOP] = "top",
-        [WH_DIRECTION_BOTTOM] = "bottom",
-        [WH_DIRECTION_LEFT] = "left",
-        [WH_DIRECTION_RIGHT] = "right",
-    };
+    return g_hash_table_lookup(self->outputs_by_name, name);
+}
 
-    g_debug("Get output on %s of %s (%dx%d+%dx%d): %dx%d (%dx%d)", directions[direction], current->output->name, current->output->width, current->output->height, current->output->x, current->output->y, cx, cy, dx, dy);
+WhOutput *
+wh_outputs_get_at(WhOutputs *self, gint32 x, gint32 y)
+{
     GHashTableIter iter;
-    g_hash_table_iter_init(&iter, self->outputs);
-    switch ( direction )
-    {
-    case WH_DIRECTION_TOP:
-        min = G_MININT32;
-        max = current->output->y;
-        vertical = TRUE;
-    break;
-    case WH_DIRECTION_BOTTOM:
-        min = current->output->y + current->output->height;
-        max = G_MAXINT32;
-        vertical = TRUE;
-    break;
-    case WH_DIRECTION_LEFT:
-        min = G_MININT32;
-        max = current->output->x;
-        vertical = FALSE;
-    break;
-    case WH_DIRECTION_RIGHT:
-        min = current->output->x + current->output->width;
-        max = G_MAXINT32;
-        vertical = FALSE;
-    break;
-    case WH_DIRECTION_PARENT:
-    case WH_DIRECTION_CHILD:
-    default:
-        g_return_val_if_reached(NULL);
-    }
+    WhOutput *output;
 
-    WhOutput *output, *target = NULL;
+    g_hash_table_iter_init(&iter, self->outputs);
     while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
     {
-        if ( current == output )
+        if ( ( output->output == NULL ) || ( ! output->output->enabled ) )
             continue;
+        if ( pixman_region32_contains_point(&output->output->region, x, y, NULL) )
+            return output;
+    }
 
-        x = cx - ( output->output->x + output->output->width / 2 );
-        x = ABS(x);
-        y = cy - ( output->output->y + output->output->height / 2 );
-        y = ABS(y);
-        g_debug("        Try %s (%dx%d+%dx%d): %dx%d", output->output->name, output->output->width, output->output->height, output->output->x, output->output->y, x, y);
-        if ( vertical )
-        {
-            g_debug("            Vertical move, deviation: %d / %d|%d", x, dx, tx);
-            if ( ( x > dx ) || ( x > tx ) )
-                continue;
-            val = output->output->y;
-        }
-        else
-        {
-            g_debug("            Horizontal move, deviation: %d / %d|%d", y, dy, ty);
-            if ( ( y > dy ) || ( y > ty ) )
-                continue;
-            val = output->output->x;
-        }
-        g_debug("Check min < val < max: %d < %d < %d", min, val, max);
-        if ( ( val < min ) || ( val > max ) )
-            continue;
+    return NULL;
+}
 
-        tx = x;
-        ty = y;
-        target = output;
-    }
+WhOutput *
+wh_outputs_get(WhOutputs *self, WhOutput *current, WhDirection direction)
+{
+    g_return_val_if_fail(( direction & WH_DIRECTION_TREE_MASK ) == 0, NULL);
+
+    GPtrArray *neighbours = current->neighbours[direction];
+    if ( neighbours->len == 0 )
+        return NULL;
 
-    if ( target != NULL )
-        g_debug("    Found %s", target->output->name);
-    return target;
+    return g_ptr_array_index(neighbours, 0);
 }
@@ -24,17 +24,23 @@
 #define __WAYHOUSE_OUTPUTS_H__
 
 #include "types.h"
+#include <wayhouse-snapshot.h>
 
 WhOutputs *wh_outputs_new(WhCore *core);
 void wh_outputs_free(WhOutputs *outputs);
 
 WhOutput *wh_outputs_get(WhOutputs *outputs, WhOutput *output, WhDirection direction);
+WhOutput *wh_outputs_get_by_name(WhOutputs *outputs, const gchar *name);
+WhOutput *wh_outputs_get_at(WhOutputs *outputs, gint32 x, gint32 y);
+void wh_outputs_fill_snapshot(WhOutputs *outputs, WhStateSnapshotData *data);
 
 void wh_outputs_control(WhOutputs *outputs, WhSeat *seat, WhStateChange state, const gchar *name);
+void wh_outputs_set_hotplug_delay(WhOutputs *outputs, gint delay);
 
 gboolean wh_output_set_current_workspace(WhOutput *output, WhWorkspace *workspace);
 WhWorkspace *wh_output_get_current_workspace(WhOutput *output);
 
 struct weston_geometry wh_output_get_geometry(WhOutput *self);
+const gchar *wh_output_get_name(WhOutput *self);
 
 #endif /* __WAYHOUSE_OUTPUTS_H__ */
@@ -0,0 +1,284 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "ipc.h"
+#include "repaint.h"
+
+/*
+ * Repaint scheduling
+ *
+ * weston starts repainting an output repaint_msec before its next
+ * vblank. We measure how long each repaint actually takes, and move
+ * that point as close to the vblank as the slowest output allows:
+ * anything that comes in before it makes it into the next frame.
+ *
+ * libweston 2 does not tell us when a repaint was scheduled, so we
+ * never get samples there and repaint_msec stays as weston set it.
+ */
+
+#define WH_REPAINT_SAMPLES 128
+#define WH_REPAINT_MIN_SAMPLES 16
+#define WH_REPAINT_PERCENTILE 95
+#define WH_REPAINT_DEFAULT_MARGIN 2
+
+struct _WhRepaint {
+    WhCore *core;
+    gint margin;
+    gint32 default_msec;
+    GHashTable *outputs;
+    struct wl_listener output_created_listener;
+    struct wl_listener output_destroyed_listener;
+};
+
+typedef struct {
+    WhRepaint *repaint;
+    struct weston_output *output;
+    struct wl_listener frame_listener;
+    gint64 samples[WH_REPAINT_SAMPLES];
+    guint n_samples;
+    guint next_sample;
+    guint64 frames;
+    gint64 percentile;
+    gint64 max;
+} WhRepaintOutput;
+
+static gint
+_wh_repaint_sample_compare(gconstpointer a_, gconstpointer b_)
+{
+    const gint64 *a = a_, *b = b_;
+
+    return ( *a < *b ) ? -1 : ( *a > *b ) ? 1 : 0;
+}
+
+static void
+_wh_repaint_update(WhRepaint *self)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    GHashTableIter iter;
+    WhRepaintOutput *output;
+    gint64 needed = 0;
+    gint32 msec, period = G_MAXINT32;
+
+    if ( self->margin < 0 )
+        return;
+
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+    {
+        /* Not enough data yet for this one, the others still count */
+        if ( output->n_samples < WH_REPAINT_MIN_SAMPLES )
+            continue;
+        needed = MAX(needed, output->percentile);
+        if ( ( output->output->current_mode != NULL ) && ( output->output->current_mode->refresh > 0 ) )
+            period = MIN(period, 1000000 / output->output->current_mode->refresh);
+    }
+    if ( needed == 0 )
+        return;
+
+    msec = ( needed + 999 ) / 1000 + self->margin;
+    msec = CLAMP(msec, 1, MAX(1, period - 1));
+
+    if ( compositor->repaint_msec != msec )
+        g_debug("Repaint window: %dms", msec);
+    compositor->repaint_msec = msec;
+}
+
+#if LIBWESTON_MAJOR >= 3
+static void
+_wh_repaint_output_frame(struct wl_listener *listener, void *data)
+{
+    WhRepaintOutput *self = wl_container_of(listener, self, frame_listener);
+    struct weston_compositor *compositor = self->output->compositor;
+    struct timespec now;
+    gint64 duration;
+
+    weston_compositor_read_presentation_clock(compositor, &now);
+    duration = ( now.tv_sec - self->output->next_repaint.tv_sec ) * G_USEC_PER_SEC + ( now.tv_nsec - self->output->next_repaint.tv_nsec ) / 1000;
+
+    /* Repaints forced outside of the timer tell us nothing */
+    if ( ( duration < 0 ) || ( duration > G_USEC_PER_SEC ) )
+        return;
+
+    self->samples[self->next_sample] = duration;
+    self->next_sample = ( self->next_sample + 1 ) % WH_REPAINT_SAMPLES;
+    if ( self->n_samples < WH_REPAINT_SAMPLES )
+        ++self->n_samples;
+    ++self->frames;
+
+    /* Re-evaluating every few frames is plenty */
+    if ( ( self->frames % WH_REPAINT_MIN_SAMPLES ) != 0 )
+        return;
+
+    gint64 sorted[WH_REPAINT_SAMPLES];
+    memcpy(sorted, self->samples, self->n_samples * sizeof(gint64));
+    qsort(sorted, self->n_samples, sizeof(gint64), _wh_repaint_sample_compare);
+    self->percentile = sorted[( self->n_samples - 1 ) * WH_REPAINT_PERCENTILE / 100];
+    self->max = sorted[self->n_samples - 1];
+
+    _wh_repaint_update(self->repaint);
+}
+#endif /* LIBWESTON_MAJOR >= 3 */
+
+static void
+_wh_repaint_output_new(WhRepaint *repaint, struct weston_output *output)
+{
+    WhRepaintOutput *self;
+
+    self = g_slice_new0(WhRepaintOutput);
+    self->repaint = repaint;
+    self->output = output;
+
+#if LIBWESTON_MAJOR >= 3
+    self->frame_listener.notify = _wh_repaint_output_frame;
+    wl_signal_add(&output->frame_signal, &self->frame_listener);
+#endif /* LIBWESTON_MAJOR >= 3 */
+
+    g_hash_table_insert(repaint->outputs, output, self);
+}
+
+static void
+_wh_repaint_output_free(gpointer data)
+{
+    WhRepaintOutput *self = data;
+
+#if LIBWESTON_MAJOR >= 3
+    wl_list_remove(&self->frame_listener.link);
+#endif /* LIBWESTON_MAJOR >= 3 */
+
+    g_slice_free(WhRepaintOutput, self);
+}
+
+static void
+_wh_repaint_output_created(struct wl_listener *listener, void *data)
+{
+    WhRepaint *self = wl_container_of(listener, self, output_created_listener);
+    struct weston_output *output = data;
+
+    _wh_repaint_output_new(self, output);
+}
+
+static void
+_wh_repaint_output_destroyed(struct wl_listener *listener, void *data)
+{
+    WhRepaint *self = wl_container_of(listener, self, output_destroyed_listener);
+    struct weston_output *output = data;
+
+    g_hash_table_remove(self->outputs, output);
+    _wh_repaint_update(self);
+}
+
+WhRepaint *
+wh_repaint_new(WhCore *core)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(core);
+    WhRepaint *self;
+
+    self = g_new0(WhRepaint, 1);
+    self->core = core;
+    self->margin = WH_REPAINT_DEFAULT_MARGIN;
+    self->default_msec = compositor->repaint_msec;
+
+    self->outputs = g_hash_table_new_full(NULL, NULL, NULL, _wh_repaint_output_free);
+
+    struct weston_output *output;
+    wl_list_for_each(output, &compositor->output_list, link)
+        _wh_repaint_output_new(self, output);
+
+    self->output_created_listener.notify = _wh_repaint_output_created;
+    wl_signal_add(&compositor->output_created_signal, &self->output_created_listener);
+    self->output_destroyed_listener.notify = _wh_repaint_output_destroyed;
+    wl_signal_add(&compositor->output_destroyed_signal, &self->output_destroyed_listener);
+
+    return self;
+}
+
+void
+wh_repaint_free(WhRepaint *self)
+{
+    if ( self == NULL )
+        return;
+
+    wl_list_remove(&self->output_destroyed_listener.link);
+    wl_list_remove(&self->output_created_listener.link);
+
+    g_hash_table_unref(self->outputs);
+
+    g_free(self);
+}
+
+void
+wh_repaint_set_margin(WhRepaint *self, gint margin)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+
+    /* Unset, use our default */
+    if ( margin == G_MININT )
+        margin = WH_REPAINT_DEFAULT_MARGIN;
+    self->margin = margin;
+
+    /* Negative margin: leave weston alone */
+    if ( self->margin < 0 )
+        compositor->repaint_msec = self->default_msec;
+    else
+        _wh_repaint_update(self);
+}
+
+void
+wh_repaint_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhRepaint *self = user_data;
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    GHashTableIter iter;
+    WhRepaintOutput *output;
+    GString *json;
+    gboolean first = TRUE;
+
+    json = g_string_new("");
+    g_string_append_printf(json, "{\"repaint_msec\":%d,\"margin\":%d,\"outputs\":[", compositor->repaint_msec, self->margin);
+    g_hash_table_iter_init(&iter, self->outputs);
+    while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &output) )
+    {
+        if ( ! first )
+            g_string_append_c(json, ',');
+        first = FALSE;
+
+        g_string_append(json, "{\"name\":");
+        wh_ipc_json_append_string(json, output->output->name);
+        g_string_append_printf(json, ",\"frames\":%" G_GUINT64_FORMAT ",\"p%d\":%" G_GINT64_FORMAT ",\"max\":%" G_GINT64_FORMAT "}", output->frames, WH_REPAINT_PERCENTILE, output->percentile, output->max);
+    }
+    g_string_append(json, "]}");
+
+    wh_ipc_client_send(client, json->str);
+    g_string_free(json, TRUE);
+}
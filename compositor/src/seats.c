@@ -30,27 +30,315 @@
 
 #include "types.h"
 #include "wayhouse.h"
+#include "config_.h"
 #include "containers.h"
+#include "outputs.h"
+#include "bindings.h"
+#include "latency.h"
 #include "seats.h"
 
+#define WH_SEATS_DEFAULT_FOCUS_DWELL 100
+
 struct _WhSeats {
     WhCore *core;
     struct wl_listener seat_create_listener;
     GHashTable *seats;
+    WhSeat *current;
+    WhSurface *focus;
+    GHashTable *focused;
+    const struct weston_keyboard_grab_interface *keyboard_default;
+    const struct weston_pointer_grab_interface *pointer_default;
+    struct weston_keyboard_grab_interface keyboard_interface;
+    struct weston_pointer_grab_interface pointer_interface;
 };
 
 struct _WhSeat {
     WhSeats *seats;
     struct weston_seat *seat;
     struct wl_listener destroy_listener;
+    struct wl_listener caps_listener;
+    guint32 group;
+    WhBindingsState *bindings_state;
+    GHashTable *swallowed_keys;
+    GHashTable *swallowed_buttons;
+    WhSurface *focus;
+    GQueue *history;
+    GHashTable *history_links;
+    gchar *workspace;
+    struct {
+        WhSurface *surface;
+        guint source;
+    } hover;
 };
 
+static WhSeat *
+_wh_seats_lookup(struct weston_seat *seat)
+{
+    WhCore *core = weston_compositor_get_user_data(seat->compositor);
+
+    return g_hash_table_lookup(wh_core_get_seats(core)->seats, seat);
+}
+
+static void
+_wh_seats_unfocus(WhSeats *self, WhSurface *surface)
+{
+    guint count;
+
+    if ( surface == NULL )
+        return;
+
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(self->focused, surface));
+    if ( count > 1 )
+        g_hash_table_insert(self->focused, surface, GUINT_TO_POINTER(count - 1));
+    else
+    {
+        g_hash_table_remove(self->focused, surface);
+        wh_surface_set_activated(surface, FALSE);
+    }
+}
+
+static void
+_wh_seats_focus(WhSeats *self, WhSurface *surface)
+{
+    guint count;
+
+    if ( surface == NULL )
+        return;
+
+    count = GPOINTER_TO_UINT(g_hash_table_lookup(self->focused, surface));
+    g_hash_table_insert(self->focused, surface, GUINT_TO_POINTER(count + 1));
+    if ( count == 0 )
+        wh_surface_set_activated(surface, TRUE);
+}
+
+static void
+_wh_seat_set_focus(WhSeat *self, WhSurface *surface)
+{
+    if ( surface != NULL )
+    {
+        GList *link = g_hash_table_lookup(self->history_links, surface);
+        if ( link != NULL )
+            g_queue_unlink(self->history, link);
+        else
+        {
+            link = g_list_alloc();
+            link->data = surface;
+            g_hash_table_insert(self->history_links, surface, link);
+        }
+        g_queue_push_head_link(self->history, link);
+    }
+
+    if ( self->focus == surface )
+        return;
+
+    _wh_seats_unfocus(self->seats, self->focus);
+    self->focus = surface;
+    _wh_seats_focus(self->seats, self->focus);
+
+    weston_seat_set_keyboard_focus(self->seat, ( surface == NULL ) ? NULL : wh_surface_get_surface(surface));
+}
+
+static void
+_wh_seats_set_current(WhSeats *self, WhSeat *seat)
+{
+    if ( self->current == seat )
+        return;
+
+    if ( self->current == NULL )
+    {
+        _wh_seats_unfocus(self, self->focus);
+        self->focus = NULL;
+    }
+    self->current = seat;
+
+    /* Bring back where this seat left off, the tree follows the active seat */
+    wh_workspaces_restore_seat(wh_core_get_workspaces(self->core), seat, seat->focus, seat->workspace);
+}
+
+static void
+_wh_seat_keyboard_key(struct weston_keyboard_grab *grab, uint32_t time, uint32_t key, uint32_t state)
+{
+    WhSeat *self = _wh_seats_lookup(grab->keyboard->seat);
+    gpointer code = GUINT_TO_POINTER(key);
+
+    if ( state == WL_KEYBOARD_KEY_STATE_PRESSED )
+    {
+        _wh_seats_set_current(self->seats, self);
+        wh_latency_input(wh_core_get_latency(self->seats->core), time);
+        WhBindings *bindings = wh_core_get_bindings(self->seats->core);
+        if ( wh_bindings_handle_key(bindings, self->bindings_state, grab->keyboard->xkb_info->keymap, self->group, self->seat->modifier_state, key) )
+        {
+            g_hash_table_add(self->swallowed_keys, code);
+            return;
+        }
+    }
+    else if ( g_hash_table_remove(self->swallowed_keys, code) )
+        return;
+
+    self->seats->keyboard_default->key(grab, time, key, state);
+}
+
+static void
+_wh_seat_keyboard_modifiers(struct weston_keyboard_grab *grab, uint32_t serial, uint32_t mods_depressed, uint32_t mods_latched, uint32_t mods_locked, uint32_t group)
+{
+    WhSeat *self = _wh_seats_lookup(grab->keyboard->seat);
+
+    /* Only called on changes, so we keep the group without querying xkb on each key */
+    self->group = group;
+
+    self->seats->keyboard_default->modifiers(grab, serial, mods_depressed, mods_latched, mods_locked, group);
+}
+
+static void
+_wh_seat_pointer_button(struct weston_pointer_grab *grab, uint32_t time, uint32_t button, uint32_t state)
+{
+    WhSeat *self = _wh_seats_lookup(grab->pointer->seat);
+    gpointer code = GUINT_TO_POINTER(button);
+
+    if ( state == WL_POINTER_BUTTON_STATE_PRESSED )
+    {
+        _wh_seats_set_current(self->seats, self);
+        wh_latency_input(wh_core_get_latency(self->seats->core), time);
+        WhBindings *bindings = wh_core_get_bindings(self->seats->core);
+        if ( wh_bindings_handle_button(bindings, self, self->seat->modifier_state, button) )
+        {
+            g_hash_table_add(self->swallowed_buttons, code);
+            return;
+        }
+    }
+    else if ( g_hash_table_remove(self->swallowed_buttons, code) )
+        return;
+
+    self->seats->pointer_default->button(grab, time, button, state);
+}
+
+static void
+_wh_seat_hover_cancel(WhSeat *self)
+{
+    if ( self->hover.source > 0 )
+        g_source_remove(self->hover.source);
+    self->hover.source = 0;
+    self->hover.surface = NULL;
+}
+
+static gboolean
+_wh_seat_hover_focus(gpointer user_data)
+{
+    WhSeat *self = user_data;
+    WhSurface *surface = self->hover.surface;
+
+    self->hover.source = 0;
+    self->hover.surface = NULL;
+
+    _wh_seats_set_current(self->seats, self);
+    wh_surface_focus(surface, self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_seat_pointer_motion(struct weston_pointer_grab *grab, uint32_t time, struct weston_pointer_motion_event *event)
+{
+    WhSeat *self = _wh_seats_lookup(grab->pointer->seat);
+    WhCore *core = self->seats->core;
+
+    self->seats->pointer_default->motion(grab, time, event);
+
+    if ( ! wh_config_get_focus_follows_mouse(wh_core_get_config(core)) )
+        return;
+
+    gint32 x = wl_fixed_to_int(grab->pointer->x);
+    gint32 y = wl_fixed_to_int(grab->pointer->y);
+    WhOutput *output;
+    WhSurface *surface = NULL;
+
+    output = wh_outputs_get_at(wh_core_get_outputs(core), x, y);
+    if ( output != NULL )
+        surface = wh_workspaces_get_surface_at(wh_core_get_workspaces(core), output, x, y);
+
+    if ( ( surface == NULL ) || ( ( surface == self->focus ) && ( self->seats->current == self ) ) )
+    {
+        _wh_seat_hover_cancel(self);
+        return;
+    }
+    if ( surface == self->hover.surface )
+        return;
+
+    /* Only focus once the pointer rests, sweeping across splits must not refocus each one */
+    gint dwell = wh_config_get_focus_dwell(wh_core_get_config(core));
+    if ( dwell < 0 )
+        dwell = WH_SEATS_DEFAULT_FOCUS_DWELL;
+
+    _wh_seat_hover_cancel(self);
+    self->hover.surface = surface;
+    if ( dwell == 0 )
+        _wh_seat_hover_focus(self);
+    else
+        self->hover.source = g_timeout_add(dwell, _wh_seat_hover_focus, self);
+}
+
+static void
+_wh_seat_hook_grabs(WhSeat *self)
+{
+    WhSeats *seats = self->seats;
+    struct weston_keyboard *keyboard = weston_seat_get_keyboard(self->seat);
+    struct weston_pointer *pointer = weston_seat_get_pointer(self->seat);
+
+    /*
+     * Bindings are looked up from the default grabs only, so they are
+     * inactive while a client or the shell holds another grab, the same
+     * way weston runs its own bindings
+     */
+    if ( ( keyboard != NULL ) && ( keyboard->default_grab.interface != &seats->keyboard_interface ) )
+    {
+        if ( seats->keyboard_default == NULL )
+        {
+            seats->keyboard_default = keyboard->default_grab.interface;
+            seats->keyboard_interface = *seats->keyboard_default;
+            seats->keyboard_interface.key = _wh_seat_keyboard_key;
+            seats->keyboard_interface.modifiers = _wh_seat_keyboard_modifiers;
+        }
+        keyboard->default_grab.interface = &seats->keyboard_interface;
+    }
+
+    if ( ( pointer != NULL ) && ( pointer->default_grab.interface != &seats->pointer_interface ) )
+    {
+        if ( seats->pointer_default == NULL )
+        {
+            seats->pointer_default = pointer->default_grab.interface;
+            seats->pointer_interface = *seats->pointer_default;
+            seats->pointer_interface.button = _wh_seat_pointer_button;
+            seats->pointer_interface.motion = _wh_seat_pointer_motion;
+        }
+        pointer->default_grab.interface = &seats->pointer_interface;
+    }
+}
+
+static void
+_wh_seat_caps_updated(struct wl_listener *listener, void *data)
+{
+    WhSeat *self = wl_container_of(listener, self, caps_listener);
+
+    _wh_seat_hook_grabs(self);
+}
+
 static void
 _wh_seat_destroyed(struct wl_listener *listener, void *data)
 {
     WhSeat *self = wl_container_of(listener, self, destroy_listener);
+    WhSeats *seats = self->seats;
+
+    if ( seats->current == self )
+    {
+        /* The remaining seats keep their own focus, only ours is handed over */
+        seats->current = NULL;
+        seats->focus = self->focus;
+    }
+    else
+        _wh_seats_unfocus(seats, self->focus);
+    self->focus = NULL;
 
-    g_hash_table_remove(self->seats->seats, self->seat);
+    g_hash_table_remove(seats->seats, self->seat);
 }
 
 static void
@@ -62,9 +350,27 @@ _wh_seat_new(WhSeats *seats, struct weston_seat *seat)
     self->seats = seats;
     self->seat = seat;
 
+    self->bindings_state = wh_bindings_state_new(wh_core_get_bindings(seats->core), self);
+    self->swallowed_keys = g_hash_table_new(NULL, NULL);
+    self->swallowed_buttons = g_hash_table_new(NULL, NULL);
+    self->history = g_queue_new();
+    self->history_links = g_hash_table_new(NULL, NULL);
+
     g_hash_table_insert(self->seats->seats, seat, self);
     self->destroy_listener.notify = _wh_seat_destroyed;
     wl_signal_add(&self->seat->destroy_signal, &self->destroy_listener);
+    self->caps_listener.notify = _wh_seat_caps_updated;
+    wl_signal_add(&self->seat->updated_caps_signal, &self->caps_listener);
+
+    _wh_seat_hook_grabs(self);
+
+    if ( seats->current == NULL )
+    {
+        /* The first seat inherits whatever got focus before any input existed */
+        seats->current = self;
+        _wh_seat_set_focus(self, seats->focus);
+        seats->focus = NULL;
+    }
 }
 
 static void
@@ -72,21 +378,91 @@ _wh_seat_free(gpointer data)
 {
     WhSeat *self = data;
 
+    _wh_seat_hover_cancel(self);
+    wl_list_remove(&self->caps_listener.link);
     wl_list_remove(&self->destroy_listener.link);
 
+    g_free(self->workspace);
+    g_hash_table_unref(self->history_links);
+    g_queue_free(self->history);
+    g_hash_table_unref(self->swallowed_buttons);
+    g_hash_table_unref(self->swallowed_keys);
+    wh_bindings_state_free(self->bindings_state);
+
     g_free(self);
 }
 
+WhSurface *
+wh_seats_get_focus(WhSeats *self)
+{
+    if ( self->current == NULL )
+        return self->focus;
+    return self->current->focus;
+}
+
+WhSeat *
+wh_seats_get_current(WhSeats *self)
+{
+    return self->current;
+}
+
 void
 wh_seats_set_focus(WhSeats *self, WhSurface *surface)
+{
+    if ( self->current != NULL )
+    {
+        _wh_seat_set_focus(self->current, surface);
+        return;
+    }
+
+    /* No seat yet, keep it for the first one */
+    if ( self->focus == surface )
+        return;
+    _wh_seats_unfocus(self, self->focus);
+    self->focus = surface;
+    _wh_seats_focus(self, self->focus);
+}
+
+void
+wh_seats_set_workspace(WhSeats *self, const gchar *name)
+{
+    if ( self->current == NULL )
+        return;
+
+    if ( g_strcmp0(self->current->workspace, name) == 0 )
+        return;
+    g_free(self->current->workspace);
+    self->current->workspace = g_strdup(name);
+}
+
+void
+wh_seats_remove_surface(WhSeats *self, WhSurface *surface)
 {
     GHashTableIter iter;
     WhSeat *seat;
-    struct weston_surface *focus = ( surface == NULL ) ? NULL : wh_surface_get_surface(surface);
+
+    if ( self->focus == surface )
+        wh_seats_set_focus(self, NULL);
 
     g_hash_table_iter_init(&iter, self->seats);
     while ( g_hash_table_iter_next(&iter, NULL, (gpointer *) &seat) )
-        weston_seat_set_keyboard_focus(seat->seat, focus);
+    {
+        if ( seat->hover.surface == surface )
+            _wh_seat_hover_cancel(seat);
+
+        GList *link = g_hash_table_lookup(seat->history_links, surface);
+        if ( link == NULL )
+            continue;
+
+        g_hash_table_remove(seat->history_links, surface);
+        g_queue_delete_link(seat->history, link);
+
+        if ( seat->focus != surface )
+            continue;
+
+        /* The active seat refocuses through the tree, the others fall back on their own history */
+        _wh_seat_set_focus(seat, ( seat == self->current ) ? NULL : g_queue_peek_head(seat->history));
+    }
 }
 
 static void
@@ -107,6 +483,7 @@ wh_seats_new(WhCore *core)
     self->core = core;
 
     self->seats = g_hash_table_new_full(NULL, NULL, NULL, _wh_seat_free);
+    self->focused = g_hash_table_new(NULL, NULL);
 
     struct weston_compositor *compositor = wh_core_get_compositor(self->core);
     struct weston_seat *seat;
@@ -127,12 +504,19 @@ wh_seats_free(WhSeats *self)
         return;
 
     g_hash_table_unref(self->seats);
+    g_hash_table_unref(self->focused);
 
     g_free(self);
 }
 
 WhSeat *
-wh_seats_get_from_weston_seat(WhSeats *seats, struct weston_seat *seat)
+wh_seats_get_from_weston_seat(WhSeats *self, struct weston_seat *seat)
+{
+    return g_hash_table_lookup(self->seats, seat);
+}
+
+struct weston_seat *
+wh_seat_get_weston_seat(WhSeat *self)
 {
-    return NULL;
+    return self->seat;
 }
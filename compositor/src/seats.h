@@ -29,7 +29,12 @@ WhSeats *wh_seats_new(WhCore *core);
 void wh_seats_free(WhSeats *seats);
 
 WhSeat *wh_seats_get_from_weston_seat(WhSeats *seats, struct weston_seat *seat);
+struct weston_seat *wh_seat_get_weston_seat(WhSeat *seat);
 
+WhSeat *wh_seats_get_current(WhSeats *seats);
+WhSurface *wh_seats_get_focus(WhSeats *seats);
 void wh_seats_set_focus(WhSeats *seats, WhSurface *surface);
+void wh_seats_set_workspace(WhSeats *seats, const gchar *name);
+void wh_seats_remove_surface(WhSeats *seats, WhSurface *surface);
 
 #endif /* __WAYHOUSE_SEATS_H__ */
@@ -0,0 +1,173 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+
+#include <glib.h>
+
+#include <compositor.h>
+
+#include <wayhouse-snapshot.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "ipc.h"
+#include "outputs.h"
+#include "containers.h"
+#include "snapshot.h"
+
+struct _WhSnapshot {
+    WhCore *core;
+    int fd;
+    int read_fd;
+    WhStateSnapshot *shared;
+    WhStateSnapshotData data;
+    guint update;
+};
+
+static gboolean
+_wh_snapshot_update(gpointer user_data)
+{
+    WhSnapshot *self = user_data;
+    WhStateSnapshotData *data = &self->data;
+    guint64 serial = data->serial;
+
+    self->update = 0;
+
+    memset(data, 0, sizeof(WhStateSnapshotData));
+    data->serial = serial + 1;
+    wh_outputs_fill_snapshot(wh_core_get_outputs(self->core), data);
+    wh_workspaces_fill_snapshot(wh_core_get_workspaces(self->core), data);
+
+    guint32 sequence = self->shared->sequence;
+    __atomic_store_n(&self->shared->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&self->shared->data, data, sizeof(WhStateSnapshotData));
+    __atomic_store_n(&self->shared->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+wh_snapshot_invalidate(WhSnapshot *self)
+{
+    if ( self == NULL )
+        return;
+
+    /* Coalesce all the changes of a dispatch in one update */
+    if ( self->update == 0 )
+        self->update = g_idle_add_full(G_PRIORITY_HIGH_IDLE, _wh_snapshot_update, self, NULL);
+}
+
+WhSnapshot *
+wh_snapshot_new(WhCore *core)
+{
+    WhSnapshot *self;
+
+    self = g_new0(WhSnapshot, 1);
+    self->core = core;
+    self->read_fd = -1;
+
+    /* Anonymous memory: nothing to clean up if we crash, readers get it over IPC */
+    self->fd = syscall(SYS_memfd_create, "wayhouse-snapshot", MFD_CLOEXEC);
+    if ( self->fd < 0 )
+    {
+        g_warning("Couldn't create snapshot memory: %s", g_strerror(errno));
+        goto error;
+    }
+
+    if ( ftruncate(self->fd, sizeof(WhStateSnapshot)) < 0 )
+    {
+        g_warning("Couldn't resize snapshot memory: %s", g_strerror(errno));
+        goto error;
+    }
+
+    self->shared = mmap(NULL, sizeof(WhStateSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if ( self->shared == MAP_FAILED )
+    {
+        self->shared = NULL;
+        g_warning("Couldn't map snapshot memory: %s", g_strerror(errno));
+        goto error;
+    }
+
+    /* Readers only get a read-only descriptor, so they can neither write nor resize it */
+    gchar *path;
+    path = g_strdup_printf("/proc/self/fd/%d", self->fd);
+    self->read_fd = open(path, O_RDONLY | O_CLOEXEC);
+    g_free(path);
+    if ( self->read_fd < 0 )
+    {
+        g_warning("Couldn't reopen snapshot memory read-only: %s", g_strerror(errno));
+        goto error;
+    }
+
+    self->shared->magic = WH_STATE_SNAPSHOT_MAGIC;
+    self->shared->version = WH_STATE_SNAPSHOT_VERSION;
+    self->shared->size = sizeof(WhStateSnapshot);
+    self->shared->sequence = 0;
+
+    _wh_snapshot_update(self);
+
+    return self;
+
+error:
+    wh_snapshot_free(self);
+    return NULL;
+}
+
+void
+wh_snapshot_free(WhSnapshot *self)
+{
+    if ( self == NULL )
+        return;
+
+    if ( self->update > 0 )
+        g_source_remove(self->update);
+
+    if ( self->shared != NULL )
+        munmap(self->shared, sizeof(WhStateSnapshot));
+    if ( self->read_fd >= 0 )
+        close(self->read_fd);
+    if ( self->fd >= 0 )
+        close(self->fd);
+
+    g_free(self);
+}
+
+void
+wh_snapshot_ipc_get(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhSnapshot *self = user_data;
+    gchar *message;
+
+    message = g_strdup_printf("{\"success\":true,\"size\":%zu}", sizeof(WhStateSnapshot));
+    wh_ipc_client_send_fd(client, message, self->read_fd);
+    g_free(message);
+}
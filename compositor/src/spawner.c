@@ -0,0 +1,228 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "types.h"
+#include "spawner.h"
+
+/*
+ * Forking the compositor means duplicating its whole address space,
+ * GPU mappings included, which stalls the main loop on large heaps.
+ * Instead, we fork a tiny helper once, early at startup, and send it
+ * the argv/envp/cwd of each launch over a socket.
+ */
+#define WH_SPAWNER_MESSAGE_TYPE "(sasas)"
+#define WH_SPAWNER_MESSAGE_FORMAT "(s^as^as)"
+#define WH_SPAWNER_MESSAGE_MAX (128 * 1024)
+
+struct _WhSpawner {
+    int fd;
+    GPid pid;
+};
+
+static void
+_wh_spawner_helper(int fd)
+{
+    gchar *buffer;
+    int cwd;
+    posix_spawnattr_t attr;
+    sigset_t mask, defaults;
+
+    /* Ctrl+C reaches the whole process group, we exit when the compositor closes the socket */
+    signal(SIGINT, SIG_IGN);
+    /* Let the kernel reap our children */
+    signal(SIGCHLD, SIG_IGN);
+
+    sigemptyset(&mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    buffer = g_malloc(WH_SPAWNER_MESSAGE_MAX);
+
+    for (;;)
+    {
+        ssize_t size;
+
+        size = recv(fd, buffer, WH_SPAWNER_MESSAGE_MAX, 0);
+        if ( ( size < 0 ) && ( errno == EINTR ) )
+            continue;
+        if ( size <= 0 )
+            break;
+
+        GVariant *message;
+        const gchar *dir;
+        const gchar **argv, **envp;
+
+        message = g_variant_ref_sink(g_variant_new_from_data(G_VARIANT_TYPE(WH_SPAWNER_MESSAGE_TYPE), buffer, size, FALSE, NULL, NULL));
+        g_variant_get(message, "(&s^a&s^a&s)", &dir, &argv, &envp);
+
+        if ( ( *dir != '\0' ) && ( chdir(dir) < 0 ) )
+            g_warning("Couldn't change directory to '%s': %s", dir, g_strerror(errno));
+        else if ( argv[0] != NULL )
+        {
+            pid_t pid;
+            int error;
+
+            error = posix_spawnp(&pid, argv[0], NULL, &attr, (char * const *) argv, (char * const *) envp);
+            if ( error != 0 )
+                g_warning("Couldn't spawn %s: %s", argv[0], g_strerror(error));
+        }
+
+        if ( ( *dir != '\0' ) && ( cwd >= 0 ) && ( fchdir(cwd) < 0 ) )
+            g_warning("Couldn't restore the working directory: %s", g_strerror(errno));
+
+        g_free(envp);
+        g_free(argv);
+        g_variant_unref(message);
+    }
+
+    _exit(0);
+}
+
+WhSpawner *
+wh_spawner_new(void)
+{
+    WhSpawner *self;
+    int pair[2];
+
+    self = g_new0(WhSpawner, 1);
+    self->fd = -1;
+    self->pid = -1;
+
+    if ( socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) < 0 )
+    {
+        g_warning("Couldn't create spawn helper socket pair: %s", g_strerror(errno));
+        return self;
+    }
+
+    self->pid = fork();
+    switch ( self->pid )
+    {
+    case -1:
+        g_warning("Couldn't fork the spawn helper: %s", g_strerror(errno));
+        close(pair[0]);
+        close(pair[1]);
+    break;
+    case 0:
+        close(pair[0]);
+        _wh_spawner_helper(pair[1]);
+    break;
+    default:
+        close(pair[1]);
+        self->fd = pair[0];
+    }
+
+    return self;
+}
+
+static void
+_wh_spawner_stop(WhSpawner *self)
+{
+    close(self->fd);
+    self->fd = -1;
+
+    waitpid(self->pid, NULL, 0);
+    self->pid = -1;
+}
+
+void
+wh_spawner_free(WhSpawner *self)
+{
+    if ( self->fd >= 0 )
+        _wh_spawner_stop(self);
+
+    g_free(self);
+}
+
+static gboolean
+_wh_spawner_send(WhSpawner *self, const gchar *cwd, gchar **argv, gchar **envp)
+{
+    GVariant *message;
+    gssize size;
+
+    message = g_variant_ref_sink(g_variant_new(WH_SPAWNER_MESSAGE_FORMAT, ( cwd != NULL ) ? cwd : "", (const gchar * const *) argv, (const gchar * const *) envp));
+    size = g_variant_get_size(message);
+    if ( size > WH_SPAWNER_MESSAGE_MAX )
+    {
+        g_variant_unref(message);
+        return FALSE;
+    }
+
+    size = send(self->fd, g_variant_get_data(message), size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    g_variant_unref(message);
+    if ( size >= 0 )
+        return TRUE;
+
+    if ( ( errno == EPIPE ) || ( errno == ECONNRESET ) )
+    {
+        g_warning("Spawn helper died, falling back to in-process spawning");
+        _wh_spawner_stop(self);
+    }
+    return FALSE;
+}
+
+gboolean
+wh_spawner_spawn(WhSpawner *self, const gchar *cwd, gchar **argv, gchar **envp)
+{
+    gchar **env = NULL;
+    gboolean ret = TRUE;
+
+    /* The helper was forked before we set up WAYLAND_DISPLAY and friends */
+    if ( envp == NULL )
+        envp = env = g_get_environ();
+
+    if ( ( self->fd < 0 ) || ( ! _wh_spawner_send(self, cwd, argv, envp) ) )
+    {
+        GError *error = NULL;
+        if ( ! g_spawn_async(cwd, argv, envp, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, &error) )
+        {
+            g_warning("Couldn't spawn %s: %s", argv[0], error->message);
+            g_error_free(error);
+            ret = FALSE;
+        }
+    }
+
+    g_strfreev(env);
+
+    return ret;
+}
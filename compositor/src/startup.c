@@ -0,0 +1,241 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <compositor.h>
+
+#include "types.h"
+#include "wayhouse.h"
+#include "ipc.h"
+#include "startup.h"
+
+typedef struct {
+    gchar *name;
+    gint64 time;
+} WhStartupPhase;
+
+typedef struct {
+    WhStartup *startup;
+    struct weston_output *output;
+    struct wl_listener frame_listener;
+    struct wl_listener destroy_listener;
+} WhStartupOutput;
+
+struct _WhStartup {
+    WhCore *core;
+    gint64 start;
+    gboolean exit_after_first_frame;
+    GArray *phases;
+    GSList *outputs;
+    gchar *path;
+    gchar *summary;
+    guint report_source;
+};
+
+static void
+_wh_startup_phase_clear(gpointer data)
+{
+    WhStartupPhase *phase = data;
+
+    g_free(phase->name);
+}
+
+WhStartup *
+wh_startup_new(WhCore *core, gint64 start, gboolean exit_after_first_frame)
+{
+    WhStartup *self;
+
+    self = g_new0(WhStartup, 1);
+    self->core = core;
+    self->start = start;
+    self->exit_after_first_frame = exit_after_first_frame;
+
+    self->phases = g_array_new(FALSE, FALSE, sizeof(WhStartupPhase));
+    g_array_set_clear_func(self->phases, _wh_startup_phase_clear);
+
+    return self;
+}
+
+static void
+_wh_startup_output_free(gpointer data)
+{
+    WhStartupOutput *self = data;
+
+    wl_list_remove(&self->destroy_listener.link);
+    wl_list_remove(&self->frame_listener.link);
+
+    g_slice_free(WhStartupOutput, self);
+}
+
+void
+wh_startup_free(WhStartup *self)
+{
+    if ( self == NULL )
+        return;
+
+    if ( self->report_source > 0 )
+        g_source_remove(self->report_source);
+    g_slist_free_full(self->outputs, _wh_startup_output_free);
+
+    g_free(self->summary);
+    g_free(self->path);
+    g_array_unref(self->phases);
+
+    g_free(self);
+}
+
+void
+wh_startup_mark(WhStartup *self, const gchar *name)
+{
+    WhStartupPhase phase = {
+        .name = g_strdup(name),
+        .time = g_get_monotonic_time() - self->start,
+    };
+
+    g_array_append_val(self->phases, phase);
+}
+
+static void
+_wh_startup_report(WhStartup *self)
+{
+    GString *line, *json;
+    guint i;
+
+    line = g_string_new("Startup:");
+    json = g_string_new("{\"phases\":[");
+    for ( i = 0 ; i < self->phases->len ; ++i )
+    {
+        WhStartupPhase *phase = &g_array_index(self->phases, WhStartupPhase, i);
+
+        g_string_append_printf(line, " %s=%" G_GINT64_FORMAT ".%03" G_GINT64_FORMAT "ms", phase->name, phase->time / 1000, phase->time % 1000);
+        if ( i > 0 )
+            g_string_append_c(json, ',');
+        g_string_append(json, "{\"name\":");
+        wh_ipc_json_append_string(json, phase->name);
+        g_string_append_printf(json, ",\"time\":%" G_GINT64_FORMAT "}", phase->time);
+    }
+    g_string_append(json, "]}");
+
+    g_message("%s", line->str);
+    g_string_free(line, TRUE);
+
+    g_free(self->summary);
+    self->summary = g_string_free(json, FALSE);
+
+    GError *error = NULL;
+    if ( ( self->path != NULL ) && ( ! g_file_set_contents(self->path, self->summary, -1, &error) ) )
+    {
+        g_warning("Couldn't write startup stats to '%s': %s", self->path, error->message);
+        g_error_free(error);
+    }
+
+    if ( self->exit_after_first_frame )
+        wh_stop(self->core, NULL);
+}
+
+static gboolean
+_wh_startup_report_idle(gpointer user_data)
+{
+    WhStartup *self = user_data;
+
+    self->report_source = 0;
+    _wh_startup_report(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_startup_output_done(WhStartupOutput *output, gboolean repainted)
+{
+    WhStartup *self = output->startup;
+
+    if ( repainted )
+    {
+        gchar *name;
+
+        name = g_strdup_printf("first-frame:%s", output->output->name);
+        wh_startup_mark(self, name);
+        g_free(name);
+    }
+
+    self->outputs = g_slist_remove(self->outputs, output);
+    _wh_startup_output_free(output);
+
+    if ( self->outputs == NULL )
+        _wh_startup_report(self);
+}
+
+static void
+_wh_startup_output_frame(struct wl_listener *listener, void *data)
+{
+    WhStartupOutput *self = wl_container_of(listener, self, frame_listener);
+
+    _wh_startup_output_done(self, TRUE);
+}
+
+static void
+_wh_startup_output_destroy(struct wl_listener *listener, void *data)
+{
+    WhStartupOutput *self = wl_container_of(listener, self, destroy_listener);
+
+    _wh_startup_output_done(self, FALSE);
+}
+
+void
+wh_startup_wait_first_frame(WhStartup *self, const gchar *runtime_dir)
+{
+    struct weston_compositor *compositor = wh_core_get_compositor(self->core);
+    struct weston_output *output;
+
+    self->path = g_build_filename(runtime_dir, "startup.json", NULL);
+
+    wl_list_for_each(output, &compositor->output_list, link)
+    {
+        WhStartupOutput *startup_output;
+
+        startup_output = g_slice_new0(WhStartupOutput);
+        startup_output->startup = self;
+        startup_output->output = output;
+
+        startup_output->frame_listener.notify = _wh_startup_output_frame;
+        wl_signal_add(&output->frame_signal, &startup_output->frame_listener);
+        startup_output->destroy_listener.notify = _wh_startup_output_destroy;
+        wl_signal_add(&output->destroy_signal, &startup_output->destroy_listener);
+
+        self->outputs = g_slist_prepend(self->outputs, startup_output);
+    }
+
+    /* Nothing to wait for, report once the main loop is running */
+    if ( self->outputs == NULL )
+        self->report_source = g_idle_add(_wh_startup_report_idle, self);
+}
+
+void
+wh_startup_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhStartup *self = user_data;
+
+    wh_ipc_client_send(client, ( self->summary != NULL ) ? self->summary : "null");
+}
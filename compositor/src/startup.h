@@ -0,0 +1,36 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __WAYHOUSE_STARTUP_H__
+#define __WAYHOUSE_STARTUP_H__
+
+#include "types.h"
+
+WhStartup *wh_startup_new(WhCore *core, gint64 start, gboolean exit_after_first_frame);
+void wh_startup_free(WhStartup *startup);
+
+void wh_startup_mark(WhStartup *startup, const gchar *phase);
+void wh_startup_wait_first_frame(WhStartup *startup, const gchar *runtime_dir);
+
+void wh_startup_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args);
+
+#endif /* __WAYHOUSE_STARTUP_H__ */
@@ -56,6 +56,12 @@ typedef enum {
     WH_STATE_TOGGLE,
 } WhStateChange;
 
+typedef enum {
+    WH_XWAYLAND_POLICY_ON_DEMAND,
+    WH_XWAYLAND_POLICY_PREWARM,
+    _WH_XWAYLAND_POLICY_SIZE
+} WhXwaylandPolicy;
+
 #define WH_WORKSPACE_NO_NUMBER ((guint64) -1)
 
 typedef struct {
@@ -63,11 +69,28 @@ typedef struct {
     gchar *name;
 } WhWorkspaceConfig;
 
+typedef struct {
+    gchar *app_id;
+    gchar *title;
+    gchar *mark;
+} WhCriteria;
+
 typedef struct _WhCore WhCore;
 
 typedef struct _WhCommands WhCommands;
 typedef struct _WhCommand WhCommand;
 typedef struct _WhConfig WhConfig;
+typedef struct _WhAssigns WhAssigns;
+
+typedef struct _WhBindings WhBindings;
+typedef struct _WhAction WhAction;
+typedef struct _WhBindingsState WhBindingsState;
+
+typedef struct _WhKeymaps WhKeymaps;
+
+typedef struct _WhSpawner WhSpawner;
+typedef struct _WhAutostart WhAutostart;
+typedef struct _WhBackground WhBackground;
 
 typedef struct _WhSeats WhSeats;
 typedef struct _WhSeat WhSeat;
@@ -82,5 +105,15 @@ typedef struct _WhOutput WhOutput;
 
 typedef struct _WhXwayland WhXwayland;
 
+typedef struct _WhSnapshot WhSnapshot;
+
+typedef struct _WhStartup WhStartup;
+
+typedef struct _WhRepaint WhRepaint;
+typedef struct _WhLatency WhLatency;
+
+typedef struct _WhIpc WhIpc;
+typedef struct _WhIpcClient WhIpcClient;
+
 
 #endif /* __WAYHOUSE_TYPES_H__ */
@@ -47,8 +47,18 @@
 #include "outputs.h"
 #include "containers.h"
 #include "commands.h"
+#include "bindings.h"
+#include "keymaps.h"
+#include "spawner.h"
+#include "autostart.h"
+#include "background.h"
+#include "startup.h"
+#include "repaint.h"
+#include "latency.h"
 #include "config_.h"
 #include "xwayland.h"
+#include "snapshot.h"
+#include "ipc.h"
 #include "wayhouse.h"
 
 struct _WhCore {
@@ -59,12 +69,21 @@ struct _WhCore {
     struct weston_desktop_api *desktop_api;
     struct weston_layer base;
     WhCommands *commands;
+    WhBindings *bindings;
+    WhKeymaps *keymaps;
+    WhSpawner *spawner;
+    WhAutostart *autostart;
+    WhBackground *background;
+    WhStartup *startup;
+    WhRepaint *repaint;
+    WhLatency *latency;
     WhConfig *config;
     WhSeats *seats;
     WhOutputs *outputs;
     WhWorkspaces *workspaces;
     WhXwayland *xwayland;
-    WhSurface *focus;
+    WhSnapshot *snapshot;
+    WhIpc *ipc;
     GMainLoop *loop;
 };
 
@@ -80,6 +99,54 @@ wh_core_get_commands(WhCore *context)
     return context->commands;
 }
 
+WhBindings *
+wh_core_get_bindings(WhCore *context)
+{
+    return context->bindings;
+}
+
+WhKeymaps *
+wh_core_get_keymaps(WhCore *context)
+{
+    return context->keymaps;
+}
+
+WhSpawner *
+wh_core_get_spawner(WhCore *context)
+{
+    return context->spawner;
+}
+
+WhAutostart *
+wh_core_get_autostart(WhCore *context)
+{
+    return context->autostart;
+}
+
+WhBackground *
+wh_core_get_background(WhCore *context)
+{
+    return context->background;
+}
+
+WhRepaint *
+wh_core_get_repaint(WhCore *context)
+{
+    return context->repaint;
+}
+
+WhXwayland *
+wh_core_get_xwayland(WhCore *context)
+{
+    return context->xwayland;
+}
+
+WhLatency *
+wh_core_get_latency(WhCore *context)
+{
+    return context->latency;
+}
+
 WhConfig *
 wh_core_get_config(WhCore *context)
 {
@@ -107,16 +174,26 @@ wh_core_get_workspaces(WhCore *context)
 WhSurface *
 wh_core_get_focus(WhCore *context)
 {
-    return context->focus;
+    return wh_seats_get_focus(context->seats);
+}
+
+WhSnapshot *
+wh_core_get_snapshot(WhCore *context)
+{
+    return context->snapshot;
+}
+
+WhIpc *
+wh_core_get_ipc(WhCore *context)
+{
+    return context->ipc;
 }
 
 void
 wh_core_set_focus(WhCore *context, WhSurface *surface)
 {
-    wh_surface_set_activated(context->focus, FALSE);
-    context->focus = surface;
-    wh_seats_set_focus(context->seats, context->focus);
-    wh_surface_set_activated(context->focus, TRUE);
+    wh_seats_set_focus(context->seats, surface);
+    wh_snapshot_invalidate(context->snapshot);
 }
 
 static int
@@ -294,12 +371,17 @@ main(int argc, char *argv[])
         return 2;
     }
 
+    gint64 start = g_get_monotonic_time();
+
     WhCore *context;
     context = g_new0(WhCore, 1);
 
     int retval = 0;
     GError *error = NULL;
+    gchar *backend = NULL;
     gboolean use_pixman = FALSE;
+    gboolean recompile_config = FALSE;
+    gboolean exit_after_first_frame = FALSE;
     gchar *runtime_dir = NULL;
     gchar *socket_name = NULL;
     gchar **common_plugins = NULL;
@@ -309,10 +391,13 @@ main(int argc, char *argv[])
     GOptionContext *option_context = NULL;
     GOptionEntry entries[] =
     {
+        { "backend",              'b', 0,                     G_OPTION_ARG_STRING,       &backend,           "Backend to use (drm, wayland, x11 or headless)", "<backend>" },
         { "use-pixman",           'p', 0,                     G_OPTION_ARG_NONE,         &use_pixman,        "Use Pixman rendering",                  NULL },
         { "socket",               's', 0,                     G_OPTION_ARG_STRING,       &socket_name,       "Socket name to use",                    "<socket-name>" },
         { "common-plugins",       'm', 0,                     G_OPTION_ARG_STRING_ARRAY, &common_plugins,    "Common libweston plugins to load",      "<plugin>" },
         { "weston-plugins",       'w', 0,                     G_OPTION_ARG_STRING_ARRAY, &weston_plugins,    "weston plugins to load",                "<plugin>" },
+        { "recompile-config",     0,   0,                     G_OPTION_ARG_NONE,         &recompile_config,  "Ignore the configuration cache",        NULL },
+        { "exit-after-first-frame", 0, 0,                   G_OPTION_ARG_NONE,         &exit_after_first_frame, "Exit once every output has drawn its first frame", NULL },
         { "version",              'V', 0,                     G_OPTION_ARG_NONE,         &print_version,     "Print version",                         NULL },
         { .long_name = NULL }
     };
@@ -341,6 +426,12 @@ main(int argc, char *argv[])
         goto end;
     }
 
+    context->startup = wh_startup_new(context, start, exit_after_first_frame);
+
+    /* Fork before anything else makes our heap big */
+    context->spawner = wh_spawner_new();
+    wh_startup_mark(context->startup, "spawner");
+
     weston_log_set_handler(_wh_log, _wh_log);
 
 #ifdef G_OS_UNIX
@@ -363,18 +454,32 @@ main(int argc, char *argv[])
     context->compositor->vt_switching = 1;
     context->compositor->exit = _wh_exit;
 
+    wh_startup_mark(context->startup, "compositor");
+
     weston_layer_init(&context->base, context->compositor);
     weston_layer_set_position(&context->base, WESTON_LAYER_POSITION_BACKGROUND);
 
+    context->bindings = wh_bindings_new(context);
     context->seats = wh_seats_new(context);
     context->workspaces = wh_workspaces_new(context);
     context->outputs = wh_outputs_new(context);
 
     context->commands = wh_commands_new(context);
-    context->config = wh_config_new(context, use_pixman);
+    context->autostart = wh_autostart_new(context);
+    context->config = wh_config_new(context, backend, use_pixman, recompile_config);
     weston_compositor_set_xkb_rule_names(context->compositor, wh_config_get_xkb_names(context->config));
+    context->keymaps = wh_keymaps_new(context);
+    wh_keymaps_set_alternatives(context->keymaps, wh_config_get_keymap_alternatives(context->config));
+    wh_startup_mark(context->startup, "config");
     if ( ! wh_config_load_backend(context->config) )
         goto error;
+    wh_startup_mark(context->startup, "backend");
+
+    context->background = wh_background_new(context, &context->base);
+    wh_background_set_colour(context->background, wh_config_get_background(context->config));
+    context->repaint = wh_repaint_new(context);
+    wh_repaint_set_margin(context->repaint, wh_config_get_repaint_margin(context->config));
+    context->latency = wh_latency_new(context);
 
     context->desktop = weston_desktop_create(context->compositor, &wh_workspaces_desktop_api, context->workspaces);
     if ( context->desktop == NULL )
@@ -383,41 +488,78 @@ main(int argc, char *argv[])
         goto error;
     }
 
+    wh_startup_mark(context->startup, "desktop");
+
     if ( ! _wh_listen(context, socket_name) )
         goto error;
+    wh_startup_mark(context->startup, "listen");
+
+    context->snapshot = wh_snapshot_new(context);
+    context->ipc = wh_ipc_new(context, runtime_dir, g_getenv("WAYLAND_DISPLAY"));
+    wh_ipc_add_handler(context->ipc, "tree", wh_workspaces_ipc_tree, context->workspaces);
+    if ( context->snapshot != NULL )
+        wh_ipc_add_handler(context->ipc, "snapshot", wh_snapshot_ipc_get, context->snapshot);
+    wh_ipc_add_handler(context->ipc, "startup", wh_startup_ipc_stats, context->startup);
+    wh_ipc_add_handler(context->ipc, "repaint", wh_repaint_ipc_stats, context->repaint);
+    wh_ipc_add_handler(context->ipc, "latency", wh_latency_ipc_stats, context->latency);
+    wh_startup_mark(context->startup, "ipc");
 
     if ( wh_config_get_xwayland(context->config) )
-        context->xwayland = wh_xwayland_new(context);
+        context->xwayland = wh_xwayland_new(context, wh_config_get_xwayland_policy(context->config));
+    if ( context->xwayland != NULL )
+    {
+        wh_xwayland_set_idle_timeout(context->xwayland, wh_config_get_xwayland_idle_timeout(context->config));
+        wh_ipc_add_handler(context->ipc, "xwayland", wh_xwayland_ipc_stats, context->xwayland);
+    }
+    wh_startup_mark(context->startup, "xwayland");
 
     _wh_load_common_plugins(context, (const gchar * const *) common_plugins);
     _wh_load_common_plugins(context, wh_config_get_common_plugins(context->config));
     _wh_load_weston_plugins(context, (const gchar * const *) weston_plugins);
+    wh_startup_mark(context->startup, "plugins");
 
-    gchar back_colour[8];
-    gchar *back_argv[] = {
-        "ww-background",
-        "-c",
-        back_colour,
-        NULL
-    };
-    g_snprintf(back_colour, sizeof(back_colour), "#%06x", getpid());
-    g_debug("Spawn %s %s %s", back_argv[0], back_argv[1], back_argv[2]);
-    g_spawn_async(NULL, back_argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL);
+    /* The built-in background stays below, so there is no gap while it starts */
+    gchar **background_client = wh_config_get_background_client(context->config);
+    if ( ( background_client != NULL ) && ( background_client[0] != NULL ) )
+    {
+        g_debug("Spawn background client %s", background_client[0]);
+        wh_spawner_spawn(context->spawner, NULL, background_client, NULL);
+    }
+
+    if ( wh_config_get_restore_layout(context->config) )
+        wh_workspaces_restore_layout(context->workspaces, NULL);
+    wh_autostart_launch(context->autostart);
+    wh_startup_mark(context->startup, "autostart");
 
+    wh_startup_wait_first_frame(context->startup, runtime_dir);
     weston_compositor_wake(context->compositor);
 
     context->loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(context->loop);
     g_main_loop_unref(context->loop);
 
-    if ( wh_config_get_xwayland(context->config) )
-        wh_xwayland_free(context->xwayland);
+    wh_xwayland_free(context->xwayland);
+    context->xwayland = NULL;
 
 error:
+    wh_ipc_free(context->ipc);
+    context->ipc = NULL;
+    wh_snapshot_free(context->snapshot);
+    context->snapshot = NULL;
+
     weston_desktop_destroy(context->desktop);
+    wh_background_free(context->background);
+    wh_latency_free(context->latency);
+    context->latency = NULL;
+    wh_repaint_free(context->repaint);
+    wh_startup_free(context->startup);
+    context->startup = NULL;
     weston_compositor_destroy(context->compositor);
 
     wh_config_free(context->config);
+    wh_keymaps_free(context->keymaps);
+    wh_autostart_free(context->autostart);
+    wh_bindings_free(context->bindings);
     wh_commands_free(context->commands);
     wh_outputs_free(context->outputs);
     wh_workspaces_free(context->workspaces);
@@ -426,8 +568,12 @@ error:
     g_water_wayland_server_source_free(context->source);
 
 end:
+    if ( context->spawner != NULL )
+        wh_spawner_free(context->spawner);
+    wh_startup_free(context->startup);
     g_strfreev(weston_plugins);
     g_strfreev(common_plugins);
+    g_free(backend);
     g_free(runtime_dir);
     g_free(context);
 
@@ -28,10 +28,20 @@
 struct weston_compositor *wh_core_get_compositor(WhCore *context);
 WhConfig *wh_core_get_config(WhCore *core);
 WhCommands *wh_core_get_commands(WhCore *core);
+WhBindings *wh_core_get_bindings(WhCore *core);
+WhKeymaps *wh_core_get_keymaps(WhCore *core);
+WhSpawner *wh_core_get_spawner(WhCore *core);
+WhAutostart *wh_core_get_autostart(WhCore *core);
+WhBackground *wh_core_get_background(WhCore *core);
+WhRepaint *wh_core_get_repaint(WhCore *core);
+WhXwayland *wh_core_get_xwayland(WhCore *core);
+WhLatency *wh_core_get_latency(WhCore *core);
 WhSeats *wh_core_get_seats(WhCore *core);
 WhOutputs *wh_core_get_outputs(WhCore *core);
 WhWorkspaces *wh_core_get_workspaces(WhCore *core);
 WhSurface *wh_core_get_focus(WhCore *core);
+WhSnapshot *wh_core_get_snapshot(WhCore *core);
+WhIpc *wh_core_get_ipc(WhCore *core);
 
 void wh_core_set_focus(WhCore *core, WhSurface *surface);
 
@@ -23,18 +23,47 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <glib-unix.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
 
 #include <compositor.h>
 #include <xwayland-api.h>
 
 #include "types.h"
 #include "wayhouse.h"
+#include "ipc.h"
 #include "xwayland.h"
 
+/*
+ * Xwayland lifecycle
+ *
+ * libweston spawns the server on the first X connection, and listens
+ * again once it exits. On top of that, we can prewarm it by connecting
+ * once at startup, and stop it after some time without any X window.
+ *
+ * If the server dies on its own, we kick it again the same way, so it
+ * comes back on the display sockets libweston still holds. The first
+ * restart is immediate, then the delay doubles while the server keeps
+ * dying shortly after being ready.
+ */
+
+#define WH_XWAYLAND_RESTART_DELAY 100
+#define WH_XWAYLAND_RESTART_MAX_DELAY 5000
+#define WH_XWAYLAND_STABLE_TIME (10 * G_USEC_PER_SEC)
+
+static const gchar * const _wh_xwayland_policies[_WH_XWAYLAND_POLICY_SIZE] = {
+    [WH_XWAYLAND_POLICY_ON_DEMAND] = "on-demand",
+    [WH_XWAYLAND_POLICY_PREWARM]   = "prewarm",
+};
+
 struct _WhXwayland {
     WhCore *core;
     const struct weston_xwayland_api *api;
@@ -42,19 +71,175 @@ struct _WhXwayland {
     GPid pid;
     struct wl_client *client;
     int wm_fd;
+    WhXwaylandPolicy policy;
+    GSocketConnection *kick;
+    struct {
+        int fd;
+        guint source;
+    } displayfd;
+    struct {
+        gboolean stopping;
+        guint failures;
+        guint source;
+        gint64 ready_time;
+        gint64 crash_time;
+    } supervisor;
+    struct {
+        guint timeout;
+        guint source;
+        guint windows;
+    } idle;
+    struct {
+        guint64 spawns;
+        guint64 readies;
+        gint64 spawn_time;
+        gint64 ready;
+        gint64 ready_last;
+        guint64 crashes;
+        guint64 restarts;
+        gint64 restart;
+        gint64 restart_last;
+    } stats;
 };
 
+static gboolean
+_wh_xwayland_idle_timeout(gpointer user_data)
+{
+    WhXwayland *self = user_data;
+
+    self->idle.source = 0;
+
+    if ( ( self->pid == -1 ) || ( self->idle.windows > 0 ) )
+        return G_SOURCE_REMOVE;
+
+    g_debug("No X window for %us, stopping Xwayland", self->idle.timeout);
+    self->supervisor.stopping = TRUE;
+    kill(self->pid, SIGTERM);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_xwayland_idle_check(WhXwayland *self)
+{
+    gboolean idle = ( self->idle.timeout > 0 ) && ( self->pid != -1 ) && ( self->idle.windows == 0 );
+
+    if ( ( ! idle ) && ( self->idle.source > 0 ) )
+    {
+        g_source_remove(self->idle.source);
+        self->idle.source = 0;
+    }
+    else if ( idle && ( self->idle.source == 0 ) )
+        self->idle.source = g_timeout_add_seconds(self->idle.timeout, _wh_xwayland_idle_timeout, self);
+}
+
 static void
 _wh_xwayland_spawn_child(gpointer user_data)
 {
-    signal(SIGUSR1, SIG_IGN);
+    /* Readiness goes through -displayfd, no SIGUSR1 to the parent */
+    signal(SIGUSR1, SIG_DFL);
+}
+
+static void
+_wh_xwayland_kick(WhXwayland *self)
+{
+    const gchar *display = g_getenv("DISPLAY");
+    GSocketClient *client;
+    GSocketAddress *address;
+    GError *error = NULL;
+    gchar *path;
+
+    if ( ( self->kick != NULL ) || ( display == NULL ) || ( display[0] != ':' ) )
+        return;
+
+    /* Any connection to the listening socket makes libweston spawn the server */
+    path = g_strdup_printf("/tmp/.X11-unix/X%s", display + 1);
+    client = g_socket_client_new();
+    address = g_unix_socket_address_new(path);
+    self->kick = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_object_unref(address);
+    g_object_unref(client);
+
+    if ( self->kick == NULL )
+    {
+        g_warning("Couldn’t start Xwayland through %s: %s", path, error->message);
+        g_clear_error(&error);
+    }
+    g_free(path);
+}
+
+static void
+_wh_xwayland_ready(WhXwayland *self)
+{
+    gint64 now = g_get_monotonic_time();
+
+    self->api->xserver_loaded(self->xwayland, self->client, self->wm_fd);
+
+    self->supervisor.ready_time = now;
+    self->stats.ready_last = now - self->stats.spawn_time;
+    self->stats.ready += self->stats.ready_last;
+    ++self->stats.readies;
+    g_debug("Xwayland ready in %" G_GINT64_FORMAT "µs", self->stats.ready_last);
+
+    if ( self->supervisor.crash_time > 0 )
+    {
+        self->stats.restart_last = now - self->supervisor.crash_time;
+        self->stats.restart += self->stats.restart_last;
+        ++self->stats.restarts;
+        self->supervisor.crash_time = 0;
+        g_message("Xwayland restarted %" G_GINT64_FORMAT "µs after crashing", self->stats.restart_last);
+    }
+
+    /* The server is up, it holds on by itself now */
+    if ( self->kick != NULL )
+    {
+        g_object_unref(self->kick);
+        self->kick = NULL;
+    }
+    _wh_xwayland_idle_check(self);
+}
+
+static void
+_wh_xwayland_displayfd_close(WhXwayland *self)
+{
+    if ( self->displayfd.source > 0 )
+        g_source_remove(self->displayfd.source);
+    self->displayfd.source = 0;
+    if ( self->displayfd.fd >= 0 )
+        close(self->displayfd.fd);
+    self->displayfd.fd = -1;
 }
 
 static gboolean
-_wh_xwayland_sigusr1(gpointer user_data)
+_wh_xwayland_displayfd(gint fd, GIOCondition condition, gpointer user_data)
 {
     WhXwayland *self = user_data;
-    self->api->xserver_loaded(self->xwayland, self->client, self->wm_fd);
+    gchar buf[16];
+    gssize r;
+
+    /* The server writes its display number once it accepts connections */
+    r = read(fd, buf, sizeof(buf));
+    if ( ( r < 0 ) && ( ( errno == EINTR ) || ( errno == EAGAIN ) ) )
+        return G_SOURCE_CONTINUE;
+
+    self->displayfd.source = 0;
+    _wh_xwayland_displayfd_close(self);
+
+    /* On EOF, the server is dying, the child watch takes it from there */
+    if ( r > 0 )
+        _wh_xwayland_ready(self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+_wh_xwayland_restart(gpointer user_data)
+{
+    WhXwayland *self = user_data;
+
+    self->supervisor.source = 0;
+    _wh_xwayland_kick(self);
+
     return G_SOURCE_REMOVE;
 }
 
@@ -62,22 +247,57 @@ static void
 _wh_xwayland_child_watch(GPid pid, gint status, gpointer user_data)
 {
     WhXwayland *self = user_data;
+    gboolean crashed;
 
+    _wh_xwayland_displayfd_close(self);
     self->api->xserver_exited(self->xwayland, status);
 
     self->client = NULL;
+    self->idle.windows = 0;
 
     g_spawn_close_pid(self->pid);
     self->pid = -1;
+    _wh_xwayland_idle_check(self);
+
+    if ( self->kick != NULL )
+    {
+        g_object_unref(self->kick);
+        self->kick = NULL;
+    }
+
+    crashed = ( ! self->supervisor.stopping ) && ( ( ! WIFEXITED(status) ) || ( WEXITSTATUS(status) != 0 ) );
+    self->supervisor.stopping = FALSE;
+    if ( ! crashed )
+        return;
+
+    ++self->stats.crashes;
+    if ( self->supervisor.crash_time == 0 )
+        self->supervisor.crash_time = g_get_monotonic_time();
+
+    /* A server dying right after startup is likely to do it again */
+    if ( ( self->supervisor.ready_time > 0 ) && ( ( self->supervisor.crash_time - self->supervisor.ready_time ) > WH_XWAYLAND_STABLE_TIME ) )
+        self->supervisor.failures = 0;
+    else
+        ++self->supervisor.failures;
+    self->supervisor.ready_time = 0;
+
+    guint delay = 0;
+    if ( self->supervisor.failures > 0 )
+        delay = MIN((guint64) WH_XWAYLAND_RESTART_DELAY << MIN(self->supervisor.failures - 1, 16), WH_XWAYLAND_RESTART_MAX_DELAY);
+    g_warning("Xwayland crashed (status %d), restarting in %ums", status, delay);
+
+    if ( self->supervisor.source > 0 )
+        g_source_remove(self->supervisor.source);
+    self->supervisor.source = g_timeout_add(delay, _wh_xwayland_restart, self);
 }
 
 static pid_t
 _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd, int unix_fd)
 {
     WhXwayland *self = user_data;
-    int wayland_pair[2], x_pair[2];
-    int wayland_fd, x_fd;
-    gchar wayland_fd_str[8], abstract_fd_str[8], unix_fd_str[8], x_fd_str[8];
+    int wayland_pair[2], x_pair[2], display_pair[2];
+    int wayland_fd, x_fd, display_fd;
+    gchar wayland_fd_str[8], abstract_fd_str[8], unix_fd_str[8], x_fd_str[8], display_fd_str[8];
 
     if ( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wayland_pair) < 0 )
     {
@@ -92,6 +312,12 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
         return -1;
     }
 
+    if ( ! g_unix_open_pipe(display_pair, FD_CLOEXEC, NULL) )
+    {
+        g_warning("Couldn't create display fd pipe: %s", g_strerror(errno));
+        return -1;
+    }
+
 #define check_dup(a, b) G_STMT_START { \
         a = dup(b); \
         if ( a < 0 ) \
@@ -106,17 +332,20 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
     check_dup(abstract_fd, abstract_fd);
     check_dup(unix_fd, unix_fd);
     check_dup(x_fd, x_pair[1]);
+    check_dup(display_fd, display_pair[1]);
 
 #undef check_dup
 
     close(wayland_pair[1]);
     close(x_pair[1]);
+    close(display_pair[1]);
 
 #define fd_to_str(name) g_snprintf(name##_fd_str, sizeof(name##_fd_str), "%d", name##_fd);
     fd_to_str(wayland);
     fd_to_str(abstract);
     fd_to_str(unix);
     fd_to_str(x);
+    fd_to_str(display);
 #undef fd_to_str
 
     gchar *argv[] = {
@@ -126,6 +355,7 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
         "-listen", abstract_fd_str,
         "-listen", unix_fd_str,
         "-wm", x_fd_str,
+        "-displayfd", display_fd_str,
         "-terminate",
         NULL
     };
@@ -135,12 +365,15 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
 
     GError *error = NULL;
 
+    self->stats.spawn_time = g_get_monotonic_time();
     if ( g_spawn_async(NULL, argv, envp, G_SPAWN_SEARCH_PATH | G_SPAWN_LEAVE_DESCRIPTORS_OPEN | G_SPAWN_DO_NOT_REAP_CHILD, _wh_xwayland_spawn_child, self, &self->pid, &error) )
     {
         g_child_watch_add(self->pid, _wh_xwayland_child_watch, self);
-        g_unix_signal_add(SIGUSR1, _wh_xwayland_sigusr1, self);
+        self->displayfd.fd = display_pair[0];
+        self->displayfd.source = g_unix_fd_add(self->displayfd.fd, G_IO_IN | G_IO_HUP | G_IO_ERR, _wh_xwayland_displayfd, self);
         self->client = wl_client_create(wh_core_get_compositor(self->core)->wl_display, wayland_pair[0]);
         self->wm_fd = x_pair[0];
+        ++self->stats.spawns;
     }
     else
     {
@@ -150,11 +383,13 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
         self->pid = -1;
         close(wayland_pair[0]);
         close(x_pair[0]);
+        close(display_pair[0]);
     }
 
     /* Close child-side fds */
     close(wayland_fd);
     close(x_fd);
+    close(display_fd);
     close(abstract_fd);
     close(unix_fd);
 
@@ -162,7 +397,7 @@ _wh_xwayland_spawn_xserver(void *user_data, const char *display, int abstract_fd
 }
 
 WhXwayland *
-wh_xwayland_new(WhCore *core)
+wh_xwayland_new(WhCore *core, WhXwaylandPolicy policy)
 {
     WhXwayland *self;
     struct weston_compositor *compositor;
@@ -170,6 +405,8 @@ wh_xwayland_new(WhCore *core)
     self = g_new0(WhXwayland, 1);
     self->core = core;
     self->pid = -1;
+    self->policy = policy;
+    self->displayfd.fd = -1;
 
     compositor = wh_core_get_compositor(self->core);
 
@@ -193,14 +430,105 @@ wh_xwayland_new(WhCore *core)
     if ( self->api->listen(self->xwayland, self, _wh_xwayland_spawn_xserver) < 0 )
         return NULL;
 
+    if ( self->policy == WH_XWAYLAND_POLICY_PREWARM )
+        _wh_xwayland_kick(self);
+
     return self;
 }
 
 void
 wh_xwayland_free(WhXwayland *self)
 {
+    if ( self == NULL )
+        return;
+
+    if ( self->supervisor.source > 0 )
+        g_source_remove(self->supervisor.source);
+    if ( self->idle.source > 0 )
+        g_source_remove(self->idle.source);
+    _wh_xwayland_displayfd_close(self);
+    if ( self->kick != NULL )
+        g_object_unref(self->kick);
     if ( self->pid != -1 )
         g_spawn_close_pid(self->pid);
 
     g_free(self);
 }
+
+void
+wh_xwayland_set_idle_timeout(WhXwayland *self, guint timeout)
+{
+    if ( self == NULL )
+        return;
+
+    if ( ( self->idle.timeout != timeout ) && ( self->idle.source > 0 ) )
+    {
+        g_source_remove(self->idle.source);
+        self->idle.source = 0;
+    }
+    self->idle.timeout = timeout;
+    _wh_xwayland_idle_check(self);
+}
+
+void
+wh_xwayland_client_surface_added(WhXwayland *self, struct wl_client *client)
+{
+    if ( ( self == NULL ) || ( client == NULL ) || ( client != self->client ) )
+        return;
+
+    ++self->idle.windows;
+    _wh_xwayland_idle_check(self);
+}
+
+void
+wh_xwayland_client_surface_removed(WhXwayland *self, struct wl_client *client)
+{
+    if ( ( self == NULL ) || ( client == NULL ) || ( client != self->client ) || ( self->idle.windows == 0 ) )
+        return;
+
+    --self->idle.windows;
+    _wh_xwayland_idle_check(self);
+}
+
+static gint64
+_wh_xwayland_get_rss(WhXwayland *self)
+{
+    gchar *path, *contents;
+    gint64 rss = -1;
+    guint64 size, resident;
+
+    if ( self->pid == -1 )
+        return -1;
+
+    path = g_strdup_printf("/proc/%d/statm", self->pid);
+    if ( g_file_get_contents(path, &contents, NULL, NULL) )
+    {
+        if ( sscanf(contents, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &size, &resident) == 2 )
+            rss = resident * sysconf(_SC_PAGESIZE) / 1024;
+        g_free(contents);
+    }
+    g_free(path);
+
+    return rss;
+}
+
+void
+wh_xwayland_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args)
+{
+    WhXwayland *self = user_data;
+    GString *json;
+
+    json = g_string_new("");
+    g_string_append_printf(json, "{\"policy\":\"%s\",\"idle_timeout\":%u,\"running\":%s,\"windows\":%u,\"spawns\":%" G_GUINT64_FORMAT, _wh_xwayland_policies[self->policy], self->idle.timeout, ( self->pid != -1 ) ? "true" : "false", self->idle.windows, self->stats.spawns);
+    if ( self->stats.readies > 0 )
+        g_string_append_printf(json, ",\"ready_us\":%" G_GINT64_FORMAT ",\"ready_average_us\":%" G_GINT64_FORMAT, self->stats.ready_last, self->stats.ready / (gint64) self->stats.readies);
+    g_string_append_printf(json, ",\"crashes\":%" G_GUINT64_FORMAT ",\"restarts\":%" G_GUINT64_FORMAT, self->stats.crashes, self->stats.restarts);
+    if ( self->stats.restarts > 0 )
+        g_string_append_printf(json, ",\"restart_us\":%" G_GINT64_FORMAT ",\"restart_average_us\":%" G_GINT64_FORMAT, self->stats.restart_last, self->stats.restart / (gint64) self->stats.restarts);
+    if ( self->pid != -1 )
+        g_string_append_printf(json, ",\"pid\":%d,\"rss_kb\":%" G_GINT64_FORMAT, self->pid, _wh_xwayland_get_rss(self));
+    g_string_append_c(json, '}');
+
+    wh_ipc_client_send(client, json->str);
+    g_string_free(json, TRUE);
+}
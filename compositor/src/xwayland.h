@@ -25,7 +25,13 @@
 
 #include "types.h"
 
-WhXwayland *wh_xwayland_new(WhCore *core);
+WhXwayland *wh_xwayland_new(WhCore *core, WhXwaylandPolicy policy);
 void wh_xwayland_free(WhXwayland *xwayland);
 
+void wh_xwayland_set_idle_timeout(WhXwayland *xwayland, guint timeout);
+void wh_xwayland_client_surface_added(WhXwayland *xwayland, struct wl_client *client);
+void wh_xwayland_client_surface_removed(WhXwayland *xwayland, struct wl_client *client);
+
+void wh_xwayland_ipc_stats(gpointer user_data, WhIpcClient *client, const gchar *args);
+
 #endif /* __WAYHOUSE_XWAYLAND_H__ */
@@ -37,6 +37,7 @@ void wh_client_free(WhClient *client);
 
 void wh_client_add_option_group(WhClient *client, GOptionContext *option_context);
 gint wh_client_run(WhClient *client);
+void wh_client_stop(WhClient *client);
 
 struct wl_display *wh_client_get_display(WhClient *client);
 PangoFontMetrics *wh_client_get_font_metrics(WhClient *client);
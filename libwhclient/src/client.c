@@ -881,6 +881,13 @@ wh_client_run(WhClient *self)
     return 0;
 }
 
+void
+wh_client_stop(WhClient *self)
+{
+    if ( self->loop != NULL )
+        g_main_loop_quit(self->loop);
+}
+
 struct wl_display *
 wh_client_get_display(WhClient *self)
 {
@@ -0,0 +1,522 @@
+/*
+ * WayHouse - A Wayland compositor based on libweston
+ *
+ * Copyright © 2016-2017 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of WayHouse.
+ *
+ * WayHouse is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * WayHouse is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with WayHouse. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <locale.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <wayland-client.h>
+#include <cairo.h>
+#include <pango/pango.h>
+#include "client.h"
+#include "xdg-shell-unstable-v6-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+/*
+ * Latency probe
+ *
+ * Maps a toplevel, then repeatedly asks the compositor over IPC to toggle
+ * it fullscreen, timing the configure, our commit and the presentation of
+ * the resulting frame. Once done, the compositor-side histograms are
+ * fetched from the "latency" IPC request and printed as-is.
+ */
+
+/* Supported interface versions */
+#define ZXDG_SHELL_V6_INTERFACE_VERSION 1
+#define WP_PRESENTATION_INTERFACE_VERSION 1
+
+#define WH_PROBE_APP_ID "wh-latency-probe"
+#define WH_PROBE_INTERVAL 100
+#define WH_PROBE_TIMEOUT 1000
+
+typedef enum {
+    WH_PROBE_SAMPLE_CONFIGURE,
+    WH_PROBE_SAMPLE_COMMIT,
+    WH_PROBE_SAMPLE_PRESENT,
+    _WH_PROBE_SAMPLE_SIZE
+} WhProbeSample;
+
+static const gchar * const _wh_probe_samples[_WH_PROBE_SAMPLE_SIZE] = {
+    [WH_PROBE_SAMPLE_CONFIGURE] = "configure",
+    [WH_PROBE_SAMPLE_COMMIT]    = "commit",
+    [WH_PROBE_SAMPLE_PRESENT]   = "present",
+};
+
+typedef enum {
+    WH_PROBE_STATE_IDLE,
+    WH_PROBE_STATE_CONFIGURE,
+    WH_PROBE_STATE_PRESENT,
+    WH_PROBE_STATE_STATS,
+} WhProbeState;
+
+typedef struct {
+    WhClient *client;
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct zxdg_shell_v6 *shell;
+    struct wp_presentation *presentation;
+    clockid_t clock;
+    WhClientSurface *surface;
+    struct zxdg_surface_v6 *xdg_surface;
+    struct zxdg_toplevel_v6 *toplevel;
+    WhClientSize size;
+    WhClientSize pending_size;
+    struct {
+        GSocketConnection *connection;
+        GDataInputStream *input;
+        GOutputStream *output;
+    } ipc;
+    gint iterations;
+    gint iteration;
+    guint discarded;
+    WhProbeState state;
+    guint timeout;
+    gint64 start;
+    GArray *samples[_WH_PROBE_SAMPLE_SIZE];
+} WhProbe;
+
+static gboolean _wh_probe_iterate(gpointer user_data);
+
+static void
+_wh_probe_next(WhProbe *self)
+{
+    if ( self->timeout > 0 )
+        g_source_remove(self->timeout);
+    self->state = WH_PROBE_STATE_IDLE;
+    self->timeout = g_timeout_add(WH_PROBE_INTERVAL, _wh_probe_iterate, self);
+}
+
+static void
+_wh_probe_ipc_send(WhProbe *self, const gchar *line)
+{
+    GError *error = NULL;
+
+    if ( ! g_output_stream_write_all(self->ipc.output, line, strlen(line), NULL, NULL, &error) )
+    {
+        g_warning("Couldn’t write to IPC socket: %s", error->message);
+        g_clear_error(&error);
+        wh_client_stop(self->client);
+    }
+}
+
+static gint
+_wh_probe_sample_compare(gconstpointer a_, gconstpointer b_)
+{
+    const gint64 *a = a_, *b = b_;
+
+    return ( *a > *b ) - ( *a < *b );
+}
+
+static void
+_wh_probe_print_samples(WhProbe *self)
+{
+    WhProbeSample sample;
+
+    g_printf("%d iterations, %u discarded\n", self->iteration, self->discarded);
+    for ( sample = 0 ; sample < _WH_PROBE_SAMPLE_SIZE ; ++sample )
+    {
+        GArray *samples = self->samples[sample];
+        gint64 *values = (gint64 *) samples->data;
+
+        if ( samples->len == 0 )
+            continue;
+
+        g_array_sort(samples, _wh_probe_sample_compare);
+        g_printf("%-10s min %6" G_GINT64_FORMAT " µs  median %6" G_GINT64_FORMAT " µs  max %6" G_GINT64_FORMAT " µs\n", _wh_probe_samples[sample], values[0], values[samples->len / 2], values[samples->len - 1]);
+    }
+}
+
+static gboolean
+_wh_probe_iterate(gpointer user_data)
+{
+    WhProbe *self = user_data;
+
+    self->timeout = 0;
+
+    if ( self->state != WH_PROBE_STATE_IDLE )
+    {
+        /* The previous iteration never completed */
+        ++self->discarded;
+        self->state = WH_PROBE_STATE_IDLE;
+    }
+
+    if ( self->iteration >= self->iterations )
+    {
+        _wh_probe_print_samples(self);
+        self->state = WH_PROBE_STATE_STATS;
+        _wh_probe_ipc_send(self, "latency\n");
+        return G_SOURCE_REMOVE;
+    }
+
+    ++self->iteration;
+    self->state = WH_PROBE_STATE_CONFIGURE;
+    self->start = g_get_monotonic_time();
+    _wh_probe_ipc_send(self, "command [app_id=\"" WH_PROBE_APP_ID "\"] fullscreen toggle\n");
+    self->timeout = g_timeout_add(WH_PROBE_TIMEOUT, _wh_probe_iterate, self);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+_wh_probe_ipc_read_callback(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    WhProbe *self = user_data;
+    GError *error = NULL;
+    gchar *line;
+
+    line = g_data_input_stream_read_line_finish(self->ipc.input, res, NULL, &error);
+    if ( line == NULL )
+    {
+        if ( error != NULL )
+            g_warning("Couldn’t read from IPC socket: %s", error->message);
+        g_clear_error(&error);
+        wh_client_stop(self->client);
+        return;
+    }
+
+    if ( g_str_has_prefix(line, "{\"success\":false") )
+        g_warning("Compositor refused the request: %s", line);
+    else if ( ( self->state == WH_PROBE_STATE_STATS ) && ( ! g_str_has_prefix(line, "{\"success\"") ) )
+    {
+        g_printf("%s\n", line);
+        g_free(line);
+        wh_client_stop(self->client);
+        return;
+    }
+    g_free(line);
+
+    g_data_input_stream_read_line_async(self->ipc.input, G_PRIORITY_DEFAULT, NULL, _wh_probe_ipc_read_callback, self);
+}
+
+static gboolean
+_wh_probe_ipc_connect(WhProbe *self)
+{
+    const gchar *path = g_getenv("WAYHOUSE_IPC");
+    GSocketClient *client;
+    GSocketAddress *address;
+    GError *error = NULL;
+
+    if ( path == NULL )
+    {
+        g_warning("WAYHOUSE_IPC is not set, are we running under WayHouse?");
+        return FALSE;
+    }
+
+    client = g_socket_client_new();
+    address = g_unix_socket_address_new(path);
+    self->ipc.connection = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_object_unref(address);
+    g_object_unref(client);
+
+    if ( self->ipc.connection == NULL )
+    {
+        g_warning("Couldn’t connect to IPC socket %s: %s", path, error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+
+    self->ipc.input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(self->ipc.connection)));
+    self->ipc.output = g_io_stream_get_output_stream(G_IO_STREAM(self->ipc.connection));
+    g_data_input_stream_read_line_async(self->ipc.input, G_PRIORITY_DEFAULT, NULL, _wh_probe_ipc_read_callback, self);
+
+    return TRUE;
+}
+
+static void
+_wh_probe_add_sample(WhProbe *self, WhProbeSample sample, gint64 time)
+{
+    gint64 delta = time - self->start;
+    g_array_append_val(self->samples[sample], delta);
+}
+
+static void
+_wh_probe_feedback_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output)
+{
+}
+
+static void
+_wh_probe_feedback_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    WhProbe *self = data;
+    gint64 time;
+
+    wp_presentation_feedback_destroy(feedback);
+
+    if ( self->state != WH_PROBE_STATE_PRESENT )
+        return;
+
+    if ( self->clock == CLOCK_MONOTONIC )
+        time = ( ( (gint64) tv_sec_hi << 32 ) + tv_sec_lo ) * G_USEC_PER_SEC + tv_nsec / 1000;
+    else
+        time = g_get_monotonic_time();
+    _wh_probe_add_sample(self, WH_PROBE_SAMPLE_PRESENT, time);
+
+    _wh_probe_next(self);
+}
+
+static void
+_wh_probe_feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+    WhProbe *self = data;
+
+    wp_presentation_feedback_destroy(feedback);
+
+    if ( self->state != WH_PROBE_STATE_PRESENT )
+        return;
+
+    ++self->discarded;
+    _wh_probe_next(self);
+}
+
+static const struct wp_presentation_feedback_listener _wh_probe_feedback_listener = {
+    .sync_output = _wh_probe_feedback_sync_output,
+    .presented = _wh_probe_feedback_presented,
+    .discarded = _wh_probe_feedback_discarded,
+};
+
+static void
+_wh_probe_draw(WhProbe *self)
+{
+    WhClientBuffer *buffer;
+
+    if ( ! wh_client_surface_resize(self->surface, self->size) )
+        return;
+
+    buffer = wh_client_surface_get_buffer(self->surface);
+    if ( buffer == NULL )
+        return;
+
+    cairo_t *cr;
+
+    cr = cairo_create(wh_client_buffer_get_surface(buffer));
+    cairo_set_source_rgba(cr, ( self->iteration % 2 ), 0.0, ( ( self->iteration + 1 ) % 2 ), 1.0);
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    if ( ( self->presentation != NULL ) && ( self->state == WH_PROBE_STATE_PRESENT ) )
+    {
+        struct wp_presentation_feedback *feedback;
+        feedback = wp_presentation_feedback(self->presentation, wh_client_surface_get_surface(self->surface));
+        wp_presentation_feedback_add_listener(feedback, &_wh_probe_feedback_listener, self);
+    }
+
+    wh_client_buffer_commit(buffer, NULL);
+}
+
+static void
+_wh_probe_toplevel_configure(void *data, struct zxdg_toplevel_v6 *toplevel, int32_t width, int32_t height, struct wl_array *states)
+{
+    WhProbe *self = data;
+
+    self->pending_size.width = ( width > 0 ) ? width : 320;
+    self->pending_size.height = ( height > 0 ) ? height : 240;
+}
+
+static void
+_wh_probe_toplevel_close(void *data, struct zxdg_toplevel_v6 *toplevel)
+{
+    WhProbe *self = data;
+
+    wh_client_stop(self->client);
+}
+
+static const struct zxdg_toplevel_v6_listener _wh_probe_toplevel_listener = {
+    .configure = _wh_probe_toplevel_configure,
+    .close = _wh_probe_toplevel_close,
+};
+
+static void
+_wh_probe_xdg_surface_configure(void *data, struct zxdg_surface_v6 *xdg_surface, uint32_t serial)
+{
+    WhProbe *self = data;
+
+    if ( self->state == WH_PROBE_STATE_CONFIGURE )
+    {
+        _wh_probe_add_sample(self, WH_PROBE_SAMPLE_CONFIGURE, g_get_monotonic_time());
+        self->state = WH_PROBE_STATE_PRESENT;
+    }
+
+    zxdg_surface_v6_ack_configure(xdg_surface, serial);
+    self->size = self->pending_size;
+    _wh_probe_draw(self);
+
+    if ( self->state == WH_PROBE_STATE_PRESENT )
+    {
+        _wh_probe_add_sample(self, WH_PROBE_SAMPLE_COMMIT, g_get_monotonic_time());
+        if ( self->presentation == NULL )
+            _wh_probe_next(self);
+    }
+}
+
+static const struct zxdg_surface_v6_listener _wh_probe_xdg_surface_listener = {
+    .configure = _wh_probe_xdg_surface_configure,
+};
+
+static void
+_wh_probe_shell_ping(void *data, struct zxdg_shell_v6 *shell, uint32_t serial)
+{
+    zxdg_shell_v6_pong(shell, serial);
+}
+
+static const struct zxdg_shell_v6_listener _wh_probe_shell_listener = {
+    .ping = _wh_probe_shell_ping,
+};
+
+static void
+_wh_probe_presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clock)
+{
+    WhProbe *self = data;
+
+    self->clock = clock;
+}
+
+static const struct wp_presentation_listener _wh_probe_presentation_listener = {
+    .clock_id = _wh_probe_presentation_clock_id,
+};
+
+static void
+_wh_probe_registry_handle_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version)
+{
+    WhProbe *self = data;
+
+    if ( g_strcmp0(interface, "zxdg_shell_v6") == 0 )
+    {
+        self->shell = wl_registry_bind(registry, name, &zxdg_shell_v6_interface, ZXDG_SHELL_V6_INTERFACE_VERSION);
+        zxdg_shell_v6_add_listener(self->shell, &_wh_probe_shell_listener, self);
+    }
+    else if ( g_strcmp0(interface, "wp_presentation") == 0 )
+    {
+        self->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, WP_PRESENTATION_INTERFACE_VERSION);
+        wp_presentation_add_listener(self->presentation, &_wh_probe_presentation_listener, self);
+    }
+}
+
+static void
+_wh_probe_registry_handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener _wh_probe_registry_listener = {
+    .global = _wh_probe_registry_handle_global,
+    .global_remove = _wh_probe_registry_handle_global_remove,
+};
+
+int
+main(int argc, char *argv[])
+{
+    static WhProbe self_;
+    WhProbe *self = &self_;
+
+    setlocale(LC_ALL, "");
+
+    int retval = 0;
+    GError *error = NULL;
+    WhProbeSample sample;
+
+    self->client = wh_client_new();
+    self->clock = CLOCK_REALTIME;
+    self->iterations = 50;
+
+    GOptionContext *option_context = NULL;
+    GOptionGroup *option_group = NULL;
+    GOptionEntry entries[] =
+    {
+        { "iterations",        'n', 0,                     G_OPTION_ARG_INT,      &self->iterations,        "Number of fullscreen toggles to time, defaults to 50", "<n>" },
+        { .long_name = NULL }
+    };
+
+    option_context = g_option_context_new("- ");
+    option_group = g_option_group_new("", "", "", self, NULL);
+    g_option_group_add_entries(option_group, entries);
+    g_option_group_set_translation_domain(option_group, GETTEXT_PACKAGE);
+    g_option_context_set_main_group(option_context, option_group);
+    wh_client_add_option_group(self->client, option_context);
+    if ( ! g_option_context_parse(option_context, &argc, &argv, &error) )
+    {
+        g_warning("Option parsing failed: %s\n", error->message);
+        retval = 2;
+        goto end;
+    }
+    g_option_context_free(option_context);
+
+    self->display = wh_client_get_display(self->client);
+    self->registry = wl_display_get_registry(self->display);
+    wl_registry_add_listener(self->registry, &_wh_probe_registry_listener, self);
+    wl_display_roundtrip(self->display);
+
+    if ( self->shell == NULL )
+    {
+        wh_client_free(self->client);
+        g_warning("No zxdg_shell_v6 interface provided by the compositor");
+        return 4;
+    }
+    if ( self->presentation == NULL )
+        g_warning("No wp_presentation interface provided by the compositor, presentation will not be timed");
+
+    if ( ! _wh_probe_ipc_connect(self) )
+    {
+        wh_client_free(self->client);
+        return 5;
+    }
+
+    for ( sample = 0 ; sample < _WH_PROBE_SAMPLE_SIZE ; ++sample )
+        self->samples[sample] = g_array_sized_new(FALSE, FALSE, sizeof(gint64), self->iterations);
+
+    self->surface = wh_client_surface_new(self->client);
+    self->xdg_surface = zxdg_shell_v6_get_xdg_surface(self->shell, wh_client_surface_get_surface(self->surface));
+    zxdg_surface_v6_add_listener(self->xdg_surface, &_wh_probe_xdg_surface_listener, self);
+    self->toplevel = zxdg_surface_v6_get_toplevel(self->xdg_surface);
+    zxdg_toplevel_v6_add_listener(self->toplevel, &_wh_probe_toplevel_listener, self);
+    zxdg_toplevel_v6_set_app_id(self->toplevel, WH_PROBE_APP_ID);
+    zxdg_toplevel_v6_set_title(self->toplevel, "WayHouse latency probe");
+    wl_surface_commit(wh_client_surface_get_surface(self->surface));
+    wl_display_roundtrip(self->display);
+
+    _wh_probe_next(self);
+
+    retval = wh_client_run(self->client);
+
+    if ( self->timeout > 0 )
+        g_source_remove(self->timeout);
+    for ( sample = 0 ; sample < _WH_PROBE_SAMPLE_SIZE ; ++sample )
+        g_array_unref(self->samples[sample]);
+    g_object_unref(self->ipc.input);
+    g_object_unref(self->ipc.connection);
+
+    zxdg_toplevel_v6_destroy(self->toplevel);
+    zxdg_surface_v6_destroy(self->xdg_surface);
+    wh_client_surface_free(self->surface);
+    if ( self->presentation != NULL )
+        wp_presentation_destroy(self->presentation);
+    zxdg_shell_v6_destroy(self->shell);
+    wh_client_free(self->client);
+
+end:
+    return retval;
+}